@@ -3,6 +3,8 @@
 #include <glm/gtc/matrix_access.hpp>
 
 #include <iostream>
+#include <cmath>
+#include <cfloat>
 
 #include "Camera.hpp"
 
@@ -20,6 +22,7 @@ Camera::Camera(int xsize, int ysize, float fovy, float near, float far){
 	view = glm::mat4();
 	this->fovy = fovy;
 	this->aspect = (float)xsize/ysize;
+	this->windowHeight = ysize;
 	this->near = near;
 	this->far = far;
 
@@ -63,8 +66,22 @@ float Camera::maxX(){
 	return std::abs(2.0f * distance / atan((M_PI - aspect)/2.0f));
 }
 
+/**
+ * projectedDiameter returns the height in pixels of the image of a
+ * world-space sphere, or FLT_MAX if the camera is inside it.
+ */
+float Camera::projectedDiameter(const glm::vec3 &centre, float radius){
+	float distance = glm::length(glm::vec3(getView() * glm::vec4(centre, 1.0f)));
+	if( distance <= radius ){
+		return FLT_MAX;
+	}
+	// Tangent of the sphere's angular radius, over that of half the view
+	return windowHeight * radius / (std::sqrt(distance * distance - radius * radius) * std::tan(fovy / 2.0f));
+}
+
 void Camera::setWindowSize(int x, int y){
 	aspect = (float)x/y;
+	windowHeight = y;
 	projectionChanged = true;
 }
 
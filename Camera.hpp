@@ -15,6 +15,7 @@ class Camera{
 	glm::vec3 target;
 	glm::vec3 up;
 	float fovy, aspect, near, far;
+	int windowHeight;
 	float xrot, yrot;
 
 	// Camera transformations matrices
@@ -37,6 +38,7 @@ public:
 	glm::mat4 getView();
 	glm::mat4 getCameraMatrix();
 	float maxX();
+	float projectedDiameter(const glm::vec3 &centre, float radius);
 
 	// Move camera
 	// Looking
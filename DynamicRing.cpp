@@ -0,0 +1,171 @@
+#include "DynamicRing.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string.h>
+#include <GL/glew.h>
+
+// Initial size of each section, grown as frames need
+#define DYNAMIC_RING_SECTION_BYTES (1 << 20)
+
+// Target the buffer is bound to while it is written or reallocated, so
+// no binding used for drawing is disturbed
+#define RING_TARGET GL_COPY_WRITE_BUFFER
+
+DynamicRing::DynamicRing(){
+	buffer = 0;
+	mapped = NULL;
+	persistent = false;
+	sectionBytes = 0;
+	uniformAlignment = 256;
+	section = 0;
+	head = frameStart = 0;
+	for( int i=0; i<DYNAMIC_RING_SECTIONS; i++ ){
+		fences[i] = 0;
+	}
+}
+
+DynamicRing &DynamicRing::shared(){
+	static DynamicRing ring;
+	return ring;
+}
+
+/**
+ * initialise creates the buffer, persistently mapped if the context
+ * supports buffer storage. Must be called with the GL context current.
+ */
+void DynamicRing::initialise(){
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	uniformAlignment = std::max(alignment, 16);
+	persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	allocate(DYNAMIC_RING_SECTION_BYTES);
+	std::cout << "Dynamic ring: " << DYNAMIC_RING_SECTIONS << " x " << sectionBytes / 1024 << " KB, "
+		<< (persistent ? "persistently mapped" : "orphaned each frame") << std::endl;
+}
+
+bool DynamicRing::isInitialised(){
+	return buffer != 0;
+}
+
+bool DynamicRing::isPersistent(){
+	return persistent;
+}
+
+/**
+ * allocate replaces the buffer with one of the given section size. The
+ * old buffer is deleted, which GL defers until draws using it are done.
+ * Falls back to orphaning if the buffer cannot be mapped.
+ */
+void DynamicRing::allocate(size_t sectionBytes){
+	release();
+	this->sectionBytes = sectionBytes;
+	size_t bytes = sectionBytes * DYNAMIC_RING_SECTIONS;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(RING_TARGET, buffer);
+	if( persistent ){
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(RING_TARGET, bytes, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(RING_TARGET, 0, bytes, flags);
+		if( !mapped ){
+			std::cerr << "Dynamic ring could not be mapped, orphaning instead" << std::endl;
+			persistent = false;
+			glBindBuffer(RING_TARGET, 0);
+			glDeleteBuffers(1, &buffer);
+			glGenBuffers(1, &buffer);
+			glBindBuffer(RING_TARGET, buffer);
+		}
+	}
+	if( !persistent ){
+		glBufferData(RING_TARGET, bytes, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(RING_TARGET, 0);
+	head = frameStart = section * sectionBytes;
+}
+
+void DynamicRing::release(){
+	for( int i=0; i<DYNAMIC_RING_SECTIONS; i++ ){
+		if( fences[i] ){
+			glDeleteSync((GLsync)fences[i]);
+			fences[i] = 0;
+		}
+	}
+	if( buffer == 0 ){
+		return;
+	}
+	if( mapped ){
+		glBindBuffer(RING_TARGET, buffer);
+		glUnmapBuffer(RING_TARGET);
+		glBindBuffer(RING_TARGET, 0);
+		mapped = NULL;
+	}
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+}
+
+/**
+ * beginFrame moves to the next section. If the GPU has not yet finished
+ * the frame that last wrote it, waits until it has; otherwise orphans the
+ * buffer.
+ */
+void DynamicRing::beginFrame(){
+	section = (section + 1) % DYNAMIC_RING_SECTIONS;
+	if( persistent && fences[section] ){
+		GLsync fence = (GLsync)fences[section];
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		while( status == GL_TIMEOUT_EXPIRED ){
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		glDeleteSync(fence);
+		fences[section] = 0;
+	}else if( !persistent ){
+		glBindBuffer(RING_TARGET, buffer);
+		glBufferData(RING_TARGET, sectionBytes * DYNAMIC_RING_SECTIONS, NULL, GL_STREAM_DRAW);
+		glBindBuffer(RING_TARGET, 0);
+	}
+	head = frameStart = section * sectionBytes;
+}
+
+/**
+ * endFrame fences the section written this frame, once its draws have
+ * been issued.
+ */
+void DynamicRing::endFrame(){
+	if( persistent ){
+		fences[section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+/**
+ * write copies data into this frame's section.
+ * @param alignment Alignment of the data's offset in the buffer, e.g.
+ * 		getUniformAlignment() for a uniform block range
+ * @return Offset of the data in getBuffer()
+ */
+size_t DynamicRing::write(const void *data, size_t bytes, size_t alignment){
+	size_t offset = (head + alignment - 1) / alignment * alignment;
+	if( offset + bytes > (section + 1) * sectionBytes ){
+		// Out of room: continue the frame in a larger buffer
+		size_t needed = offset + bytes - frameStart;
+		allocate(std::max(2 * sectionBytes, 2 * needed));
+		std::cout << "Dynamic ring grown to " << DYNAMIC_RING_SECTIONS << " x " << sectionBytes / 1024 << " KB" << std::endl;
+		offset = (head + alignment - 1) / alignment * alignment;
+	}
+	if( persistent ){
+		memcpy(mapped + offset, data, bytes);
+	}else{
+		glBindBuffer(RING_TARGET, buffer);
+		glBufferSubData(RING_TARGET, offset, bytes, data);
+		glBindBuffer(RING_TARGET, 0);
+	}
+	head = offset + bytes;
+	return offset;
+}
+
+unsigned int DynamicRing::getBuffer(){
+	return buffer;
+}
+
+size_t DynamicRing::getUniformAlignment(){
+	return uniformAlignment;
+}
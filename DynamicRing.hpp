@@ -0,0 +1,58 @@
+#ifndef DYNAMIC_RING_HPP
+#define DYNAMIC_RING_HPP
+
+#include <cstddef>
+
+// Frames the GPU may be behind the CPU, each writing its own section
+#define DYNAMIC_RING_SECTIONS 3
+
+/**
+ * The DynamicRing class streams the per-draw data of each frame (the
+ * Draw uniform block, instance matrices) through one buffer split into
+ * DYNAMIC_RING_SECTIONS sections, one per frame in flight.
+ * With GL 4.4 or ARB_buffer_storage the buffer is persistently mapped
+ * with coherent writes, and write() is a memcpy. Each frame's section is
+ * fenced when the frame ends, and beginFrame waits on the fence of the
+ * section it reuses, which has normally long been passed.
+ * Without them each frame orphans the buffer and write() is a
+ * glBufferSubData into the new storage, which also never waits.
+ * A frame that outgrows its section moves to a buffer twice the size,
+ * so the buffer must be looked up again after every write.
+ * Must only be used on the GL thread, after initialise.
+ */
+class DynamicRing{
+public:
+	DynamicRing();
+
+	static DynamicRing &shared();
+
+	void initialise();
+	bool isInitialised();
+	bool isPersistent();
+
+	void beginFrame();
+	void endFrame();
+	size_t write(const void *data, size_t bytes, size_t alignment);
+	unsigned int getBuffer();
+	size_t getUniformAlignment();
+private:
+	unsigned int buffer;
+	unsigned char *mapped;
+	bool persistent;
+	size_t sectionBytes;
+	size_t uniformAlignment;
+
+	// Section written this frame, the next free byte and the first byte
+	// written this frame
+	int section;
+	size_t head;
+	size_t frameStart;
+
+	// Fence of the last frame to write each section, 0 if none
+	void *fences[DYNAMIC_RING_SECTIONS];
+
+	void allocate(size_t sectionBytes);
+	void release();
+};
+
+#endif
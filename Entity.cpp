@@ -17,23 +17,52 @@ Entity::Entity(Model *model){
 
 	// Tranformation matrix
 	transformation = glm::mat4(1.0f);
+	update = true;
+
+	// Full detail until a level is chosen
+	level = 0;
 }
 
+/**
+ * updateTransformation rebuilds the transformation matrix if a setter has
+ * changed position, orientation or scale since it was last built.
+ */
 void Entity::updateTransformation(){
+	if( !update ){
+		return;
+	}
 	transformation = glm::translate(glm::mat4(), position);
 	transformation = glm::scale(transformation, scale);
 	transformation = glm::rotate(transformation, orientation.x, glm::vec3(1.0f, 0.0f, 0.0f));
 	transformation = glm::rotate(transformation, orientation.y, glm::vec3(0.0f, 1.0f, 0.0f));
 	transformation = glm::rotate(transformation, orientation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+	update = false;
 }
 
 // Rendering
-void Entity::render(glm::mat4 projection, glm::mat4 camera, unsigned int PID){
+void Entity::render(const glm::mat4 &projection, const glm::mat4 &camera, const ShaderProgram &shader){
 	updateTransformation();
-	model->render(projection, camera * transformation, camera, PID);
+	model->render(projection, camera * transformation, camera, shader, level);
+}
+
+Model *Entity::getModel(){
+	return model;
+}
+
+int Entity::getLevel(){
+	return level;
+}
+
+void Entity::setLevel(int level){
+	this->level = level;
 }
 
 // Getting tranformation properties
+const glm::mat4 &Entity::getTransform(){
+	updateTransformation();
+	return transformation;
+}
+
 glm::vec3 Entity::getPosition(){
 	return position;
 }
@@ -54,37 +83,45 @@ glm::vec3 Entity::getScale(){
 // Position
 void Entity::reposition(glm::vec3 pos){
 	position = pos;
+	update = true;
 }
 
 void Entity::reposition(float xpos, float ypos, float zpos){
 	position = glm::vec3(xpos, ypos, zpos);
+	update = true;
 }
 
 // Orientation
 void Entity::reorient(float radians, glm::vec3 axis){
 	axis /= length(axis);
 	orientation = radians * axis;
+	update = true;
 }
 
 void Entity::reorient(glm::vec3 orientation){
 	this->orientation = orientation;
+	update = true;
 }
 
 void Entity::reorient(float xrad, float yrad, float zrad){
 	orientation = glm::vec3(xrad, yrad, zrad);
+	update = true;
 }
 
 // Scale
 void Entity::rescale(glm::vec3 scale){
 	this->scale = scale;
+	update = true;
 }
 
 void Entity::rescale(float xscale, float yscale, float zscale){
 	scale = glm::vec3(xscale, yscale, zscale);
+	update = true;
 }
 
 void Entity::resize(float scaleFactor){
 	scale = glm::vec3(scaleFactor);
+	update = true;
 }
 
 /**
@@ -96,41 +133,50 @@ void Entity::resize(float scaleFactor){
 void Entity::move(float distance, glm::vec3 direction){
 	direction /= length(direction);
 	position += distance * direction;
+	update = true;
 }
 
 void Entity::move(glm::vec3 movement){
 	position += movement;
+	update = true;
 }
 
 void Entity::move(float xdist, float ydist, float zdist){
 	position += glm::vec3(xdist, ydist, zdist);
+	update = true;
 }
 
 // Orientation
 void Entity::rotate(float radians, glm::vec3 axis){
 	axis /= length(axis);
 	orientation += radians * axis;
+	update = true;
 }
 
 void Entity::rotate(glm::vec3 rotation){
 	orientation += rotation;
+	update = true;
 }
 
 void Entity::rotate(float xrad, float yrad, float zrad){
 	orientation += glm::vec3(xrad, yrad, zrad);
+	update = true;
 }
 
 // Scale
 void Entity::stretch(glm::vec3 stretchFactors){
 	scale *= stretchFactors;
+	update = true;
 }
 
 void Entity::stretch(float xstretch, float ystretch, float zstretch){
 	scale *= glm::vec3(xstretch, ystretch, zstretch);
+	update = true;
 }
 
 void Entity::expand(float scaleFactor){
 	scale *= scaleFactor;
+	update = true;
 }
 
 
@@ -25,17 +25,27 @@ class Entity{
 	glm::vec3 orientation;
 	glm::vec3 scale;
 
-	// Indicates whether transform needs to be updated on next render
+	// Indicates whether transform needs to be updated on next render;
+	// set by every setter, cleared by updateTransformation
 	bool update;
 	glm::mat4 transformation;
 
+	// Level of detail of the model last chosen for this entity
+	int level;
+
 	void updateTransformation();
 public:
 	Entity(Model *model);
-	void render(glm::mat4 projection, glm::mat4 camera, unsigned int PID);
+	void render(const glm::mat4 &projection, const glm::mat4 &camera, const ShaderProgram &shader);
+
+	Model *getModel();
+
+	// Level of detail
+	int getLevel();
+	void setLevel(int level);
 
 	// Getting tranformation properties
-	glm::mat4 getTransform();
+	const glm::mat4 &getTransform();
 	glm::vec3 getPosition();
 	glm::vec3 getOrientation();
 	glm::vec3 getScale();
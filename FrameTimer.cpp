@@ -0,0 +1,246 @@
+#include "FrameTimer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <GL/glew.h>
+
+// Column names of the phases, in frame_phase order
+static const char *phaseNames[N_PHASES] = {
+	"clear",
+	"upload",
+	"draw",
+	"flush",
+	"swap",
+	"poll"
+};
+
+void FrameTimer::Series::add(float ms){
+	if( samples.size() < FRAME_STATS_WINDOW ){
+		samples.push_back(ms);
+	}else{
+		samples[next] = ms;
+	}
+	next = (next + 1) % FRAME_STATS_WINDOW;
+}
+
+size_t FrameTimer::Series::size() const{
+	return samples.size();
+}
+
+/**
+ * stats sorts a copy of the samples and takes the min, median and 99th
+ * percentile (by nearest rank).
+ */
+PhaseStats FrameTimer::Series::stats() const{
+	PhaseStats stats;
+	if( samples.empty() ){
+		return stats;
+	}
+	std::vector<float> sorted(samples);
+	std::sort(sorted.begin(), sorted.end());
+	size_t n = sorted.size();
+	stats.min = sorted[0];
+	stats.median = (n % 2) ? sorted[n / 2] : 0.5f * (sorted[n / 2 - 1] + sorted[n / 2]);
+	size_t rank = (size_t)std::ceil(0.99 * n);
+	stats.p99 = sorted[std::max<size_t>(rank, 1) - 1];
+	return stats;
+}
+
+FrameTimer::FrameTimer(){
+	for( int i=0; i<FRAME_TIMER_LATENCY; i++ ){
+		slots[i].frame = 0;
+		slots[i].pending = false;
+	}
+	initialised = false;
+	frame = 0;
+	current = N_PHASES;
+}
+
+/**
+ * initialise creates the timer queries. Must be called on the GL thread;
+ * until it is, only CPU times are taken.
+ */
+void FrameTimer::initialise(){
+	for( int i=0; i<FRAME_TIMER_LATENCY; i++ ){
+		glGenQueries(N_PHASES, slots[i].queries);
+	}
+	initialised = true;
+}
+
+const char *FrameTimer::phaseName(int phase){
+	return phaseNames[phase];
+}
+
+// Phases that issue GL work worth timing on the GPU
+bool FrameTimer::gpuTimed(int phase){
+	return phase == PHASE_CLEAR || phase == PHASE_UPLOAD || phase == PHASE_DRAW;
+}
+
+/**
+ * beginFrame takes the GPU times of earlier frames that have become
+ * available, and starts timing a new frame in the slot of the oldest.
+ * A frame still without GPU times by then is logged without them.
+ */
+void FrameTimer::beginFrame(){
+	frame++;
+	readResults();
+	Slot &slot = slots[frame % FRAME_TIMER_LATENCY];
+	if( slot.pending ){
+		finishFrame(slot, NULL);
+	}
+	slot.frame = frame;
+	std::fill(slot.cpu, slot.cpu + N_PHASES, 0.0f);
+	current = N_PHASES;
+	frameStart = Clock::now();
+}
+
+/**
+ * beginPhase ends the current phase, if any, and starts timing the next.
+ */
+void FrameTimer::beginPhase(frame_phase phase){
+	endPhase();
+	current = phase;
+	phaseStart = Clock::now();
+	if( initialised && gpuTimed(phase) ){
+		glBeginQuery(GL_TIME_ELAPSED, slots[frame % FRAME_TIMER_LATENCY].queries[phase]);
+	}
+}
+
+void FrameTimer::endPhase(){
+	if( current == N_PHASES ){
+		return;
+	}
+	Slot &slot = slots[frame % FRAME_TIMER_LATENCY];
+	std::chrono::duration<float, std::milli> t = Clock::now() - phaseStart;
+	slot.cpu[current] = t.count();
+	if( initialised && gpuTimed(current) ){
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+	current = N_PHASES;
+}
+
+/**
+ * endFrame ends the last phase and records the frame's CPU times. Its GPU
+ * times follow when they are read back.
+ */
+void FrameTimer::endFrame(){
+	endPhase();
+	Slot &slot = slots[frame % FRAME_TIMER_LATENCY];
+	std::chrono::duration<float, std::milli> t = Clock::now() - frameStart;
+	slot.cpuFrame = t.count();
+	for( int i=0; i<N_PHASES; i++ ){
+		cpuSeries[i].add(slot.cpu[i]);
+	}
+	cpuFrameSeries.add(slot.cpuFrame);
+	slot.pending = true;
+	if( !initialised ){
+		finishFrame(slot, NULL);
+	}
+}
+
+/**
+ * readResults reads the GPU times of pending frames, oldest first, until
+ * one whose queries have not finished. Queries finish in order, so the
+ * last phase's query being available means the frame's all are.
+ */
+void FrameTimer::readResults(){
+	if( !initialised ){
+		return;
+	}
+	for( unsigned long age=FRAME_TIMER_LATENCY; age>0; age-- ){
+		if( age >= frame ){
+			continue;
+		}
+		Slot &slot = slots[(frame - age) % FRAME_TIMER_LATENCY];
+		if( !slot.pending || slot.frame != frame - age ){
+			continue;
+		}
+		unsigned int available = 0;
+		glGetQueryObjectuiv(slot.queries[PHASE_DRAW], GL_QUERY_RESULT_AVAILABLE, &available);
+		if( !available ){
+			break;
+		}
+		float gpu[N_PHASES];
+		float gpuFrame = 0.0f;
+		for( int i=0; i<N_PHASES; i++ ){
+			gpu[i] = 0.0f;
+			if( gpuTimed(i) ){
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &elapsed);
+				gpu[i] = elapsed / 1.0e6f;
+			}
+			gpuSeries[i].add(gpu[i]);
+			gpuFrame += gpu[i];
+		}
+		gpuFrameSeries.add(gpuFrame);
+		finishFrame(slot, gpu);
+	}
+}
+
+/**
+ * finishFrame writes a frame's row to the log, with empty GPU columns if
+ * its times were not read, and frees its slot.
+ */
+void FrameTimer::finishFrame(Slot &slot, const float *gpu){
+	slot.pending = false;
+	if( !log.is_open() ){
+		return;
+	}
+	log << slot.frame;
+	for( int i=0; i<N_PHASES; i++ ){
+		log << "," << slot.cpu[i];
+	}
+	log << "," << slot.cpuFrame;
+	float gpuFrame = 0.0f;
+	for( int i=0; i<N_PHASES; i++ ){
+		if( gpuTimed(i) ){
+			log << ",";
+			if( gpu ){
+				log << gpu[i];
+				gpuFrame += gpu[i];
+			}
+		}
+	}
+	log << ",";
+	if( gpu ){
+		log << gpuFrame;
+	}
+	log << "\n";
+}
+
+FrameStats FrameTimer::getStats(){
+	FrameStats stats;
+	stats.frames = cpuFrameSeries.size();
+	for( int i=0; i<N_PHASES; i++ ){
+		stats.cpu[i] = cpuSeries[i].stats();
+		stats.gpu[i] = gpuSeries[i].stats();
+	}
+	stats.cpuFrame = cpuFrameSeries.stats();
+	stats.gpuFrame = gpuFrameSeries.stats();
+	return stats;
+}
+
+/**
+ * openLog starts a CSV log of every frame's times in milliseconds, with
+ * a header row: frame, the CPU time of each phase and of the frame, then
+ * the GPU time of each GPU-timed phase and of the frame.
+ * @return Whether the file could be opened
+ */
+bool FrameTimer::openLog(const std::string &path){
+	log.open(path.c_str());
+	if( !log.is_open() ){
+		return false;
+	}
+	log << "frame";
+	for( int i=0; i<N_PHASES; i++ ){
+		log << ",cpu_" << phaseNames[i] << "_ms";
+	}
+	log << ",cpu_frame_ms";
+	for( int i=0; i<N_PHASES; i++ ){
+		if( gpuTimed(i) ){
+			log << ",gpu_" << phaseNames[i] << "_ms";
+		}
+	}
+	log << ",gpu_frame_ms\n";
+	return true;
+}
@@ -0,0 +1,111 @@
+#ifndef FRAME_TIMER_HPP
+#define FRAME_TIMER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+
+// Frames of timer queries in flight; GPU times are read this many frames
+// late at most
+#define FRAME_TIMER_LATENCY 4
+
+// Frames the rolling statistics cover
+#define FRAME_STATS_WINDOW 120
+
+// Phases of Graphics::renderFrame, in order
+enum frame_phase{
+	PHASE_CLEAR,
+	PHASE_UPLOAD,
+	PHASE_DRAW,
+	PHASE_FLUSH,
+	PHASE_SWAP,
+	PHASE_POLL,
+	N_PHASES
+};
+
+// Rolling statistics of one time, in milliseconds
+struct PhaseStats{
+	float min;
+	float median;
+	float p99;
+
+	PhaseStats() : min(0.0f), median(0.0f), p99(0.0f) {}
+};
+
+// Rolling CPU and GPU times of each phase and of whole frames. Phases
+// without GPU work (flush, swap, poll) have GPU times of 0.
+struct FrameStats{
+	int frames;
+	PhaseStats cpu[N_PHASES];
+	PhaseStats gpu[N_PHASES];
+	PhaseStats cpuFrame;
+	PhaseStats gpuFrame;
+
+	FrameStats() : frames(0) {}
+};
+
+/**
+ * The FrameTimer class times the phases of each frame on the CPU, with
+ * steady_clock, and on the GPU, with a GL_TIME_ELAPSED query around each
+ * phase that issues GL work. Queries come from a ring of
+ * FRAME_TIMER_LATENCY frames and are read back only once available, so
+ * timing never waits on the GPU.
+ * getStats() gives the min, median and 99th percentile of the last
+ * FRAME_STATS_WINDOW frames. If a log is open, each frame is written to
+ * it as a CSV row once its GPU times are in.
+ * Phases are timed between beginPhase calls; each ends the one before.
+ */
+class FrameTimer{
+public:
+	FrameTimer();
+	void initialise();
+
+	void beginFrame();
+	void beginPhase(frame_phase phase);
+	void endFrame();
+
+	FrameStats getStats();
+	bool openLog(const std::string &path);
+	static const char *phaseName(int phase);
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	// The last FRAME_STATS_WINDOW samples of a time
+	class Series{
+		std::vector<float> samples;
+		size_t next;
+	public:
+		Series() : next(0) {}
+		void add(float ms);
+		size_t size() const;
+		PhaseStats stats() const;
+	};
+
+	// Times of the frames in flight, by frame modulo FRAME_TIMER_LATENCY
+	struct Slot{
+		unsigned long frame;
+		bool pending;
+		float cpu[N_PHASES];
+		float cpuFrame;
+		unsigned int queries[N_PHASES];
+	};
+	Slot slots[FRAME_TIMER_LATENCY];
+	bool initialised;
+
+	Series cpuSeries[N_PHASES], gpuSeries[N_PHASES];
+	Series cpuFrameSeries, gpuFrameSeries;
+
+	unsigned long frame;
+	int current;
+	Clock::time_point frameStart, phaseStart;
+
+	std::ofstream log;
+
+	static bool gpuTimed(int phase);
+	void endPhase();
+	void readResults();
+	void finishFrame(Slot &slot, const float *gpu);
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+#include <glm/gtc/matrix_access.hpp>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+BoundingSpheres::BoundingSpheres(){
+	count = 0;
+}
+
+/**
+ * add appends a sphere, growing the arrays by a padded block of four when
+ * they are full. Padding has a radius of -FLT_MAX, which no plane test passes.
+ */
+void BoundingSpheres::add(const glm::vec3 &centre, float radius){
+	if( count == x.size() ){
+		x.resize(count + 4, 0.0f);
+		y.resize(count + 4, 0.0f);
+		z.resize(count + 4, 0.0f);
+		r.resize(count + 4, -FLT_MAX);
+	}
+	x[count] = centre.x;
+	y[count] = centre.y;
+	z[count] = centre.z;
+	r[count] = radius;
+	count++;
+}
+
+void BoundingSpheres::clear(){
+	x.clear();
+	y.clear();
+	z.clear();
+	r.clear();
+	count = 0;
+}
+
+size_t BoundingSpheres::size() const{
+	return count;
+}
+
+glm::vec3 BoundingSpheres::centre(size_t i) const{
+	return glm::vec3(x[i], y[i], z[i]);
+}
+
+float BoundingSpheres::radius(size_t i) const{
+	return r[i];
+}
+
+Frustum::Frustum(){
+	for( int i=0; i<6; i++ ){
+		planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	}
+	radiusScale = 1.0f;
+}
+
+/**
+ * Extracts the planes of the frustum a camera matrix projects onto the
+ * clip volume: left, right, bottom, top, near, far.
+ * Each plane is normalised, so it gives the distance of a point to it.
+ */
+Frustum::Frustum(const glm::mat4 &camera){
+	glm::vec4 x = glm::row(camera, 0);
+	glm::vec4 y = glm::row(camera, 1);
+	glm::vec4 z = glm::row(camera, 2);
+	glm::vec4 w = glm::row(camera, 3);
+	planes[0] = w + x;
+	planes[1] = w - x;
+	planes[2] = w + y;
+	planes[3] = w - y;
+	planes[4] = w + z;
+	planes[5] = w - z;
+	for( int i=0; i<6; i++ ){
+		planes[i] /= glm::length(glm::vec3(planes[i]));
+	}
+	radiusScale = 1.0f;
+}
+
+/**
+ * transformed returns the frustum in the space of a model drawn with the
+ * given transform. A point's signed distance to each plane is unchanged;
+ * radii are scaled by the transform's largest axis scale, so spheres are
+ * never culled wrongly under non-uniform scale.
+ */
+Frustum Frustum::transformed(const glm::mat4 &transform) const{
+	Frustum frustum;
+	for( int i=0; i<6; i++ ){
+		frustum.planes[i] = planes[i] * transform;
+	}
+	float scale = std::max(glm::length(glm::vec3(transform[0])),
+		std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+	frustum.radiusScale = radiusScale * scale;
+	return frustum;
+}
+
+Frustum::Result Frustum::classify(const glm::vec3 &centre, float radius) const{
+	Result result = INSIDE;
+	float r = radius * radiusScale;
+	for( int i=0; i<6; i++ ){
+		float distance = glm::dot(glm::vec3(planes[i]), centre) + planes[i].w;
+		// Written as cull() compares, so both reject a degenerate (NaN) frustum
+		if( !(distance >= -r) ){
+			return OUTSIDE;
+		}
+		if( distance < r ){
+			result = INTERSECTING;
+		}
+	}
+	return result;
+}
+
+/**
+ * cull tests every sphere of a batch against the planes, four at a time,
+ * and sets visible[i] to 1 for spheres inside or intersecting the frustum
+ * and 0 for the others.
+ * @param visible Output, one flag per sphere
+ * @return Number of visible spheres
+ */
+size_t Frustum::cull(const BoundingSpheres &spheres, unsigned char *visible) const{
+	size_t visibleCount = 0;
+#ifdef FRUSTUM_SSE
+	__m128 scale = _mm_set1_ps(radiusScale);
+	for( size_t i=0; i<spheres.count; i+=4 ){
+		__m128 x = _mm_loadu_ps(&spheres.x[i]);
+		__m128 y = _mm_loadu_ps(&spheres.y[i]);
+		__m128 z = _mm_loadu_ps(&spheres.z[i]);
+		__m128 negR = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(_mm_loadu_ps(&spheres.r[i]), scale));
+		__m128 inside = _mm_cmpeq_ps(_mm_setzero_ps(), _mm_setzero_ps());
+		for( int p=0; p<6; p++ ){
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(planes[p].y))),
+				_mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(planes[p].z)), _mm_set1_ps(planes[p].w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negR));
+		}
+		int mask = _mm_movemask_ps(inside);
+		size_t n = std::min<size_t>(4, spheres.count - i);
+		for( size_t j=0; j<n; j++ ){
+			visible[i + j] = (mask >> j) & 1;
+			visibleCount += visible[i + j];
+		}
+	}
+#else
+	for( size_t i=0; i<spheres.count; i++ ){
+		visible[i] = classify(spheres.centre(i), spheres.r[i]) != OUTSIDE;
+		visibleCount += visible[i];
+	}
+#endif
+	return visibleCount;
+}
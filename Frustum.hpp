@@ -0,0 +1,75 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+/**
+ * BoundingSpheres holds a batch of bounding spheres as separate arrays of
+ * centre coordinates and radii, so that Frustum can test four at a time.
+ * The arrays are padded to a multiple of four with spheres that are never
+ * visible.
+ */
+class BoundingSpheres{
+public:
+	BoundingSpheres();
+	void add(const glm::vec3 &centre, float radius);
+	void clear();
+	size_t size() const;
+	glm::vec3 centre(size_t i) const;
+	float radius(size_t i) const;
+private:
+	friend class Frustum;
+	std::vector<float> x, y, z, r;
+	size_t count;
+};
+
+// Visible and culled counts of a frame
+struct CullStats{
+	int entitiesVisible;
+	int entitiesCulled;
+	int shapesVisible;
+	int shapesCulled;
+
+	CullStats() : entitiesVisible(0), entitiesCulled(0), shapesVisible(0), shapesCulled(0) {}
+
+	// Counts one entity whose model has the given number of shapes, visible of them in view
+	void add(size_t shapes, size_t visible){
+		if( visible > 0 ){
+			entitiesVisible++;
+		}else{
+			entitiesCulled++;
+		}
+		shapesVisible += visible;
+		shapesCulled += shapes - visible;
+	}
+};
+
+/**
+ * The Frustum class holds the six planes of a view frustum, extracted
+ * from a camera (projection * view) matrix, with normals pointing inwards.
+ * transformed() moves the planes into the space of a model, so the bounds
+ * a Model keeps in its own space are tested without transforming them.
+ */
+class Frustum{
+public:
+	enum Result{
+		OUTSIDE,
+		INTERSECTING,
+		INSIDE
+	};
+
+	Frustum();
+	Frustum(const glm::mat4 &camera);
+
+	Frustum transformed(const glm::mat4 &transform) const;
+	Result classify(const glm::vec3 &centre, float radius) const;
+	size_t cull(const BoundingSpheres &spheres, unsigned char *visible) const;
+private:
+	glm::vec4 planes[6];
+
+	// Scales radii in the planes' space to world space
+	float radiusScale;
+};
+
+#endif
@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <stdio.h>
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,9 +16,15 @@
 #include "shader.hpp"
 
 #include "Model.hpp"
+#include "DynamicRing.hpp"
 
 #define N_SHADERS 4
 
+// Size and multisampling of the window, or of the headless framebuffer
+#define WINDOW_WIDTH 600
+#define WINDOW_HEIGHT 600
+#define WINDOW_SAMPLES 4
+
 Graphics::Graphics(std::vector<Entity> *entities, Camera *camera, int xWindowSize, int yWindowSize){
 	this->entities = entities;
 	this->camera = camera;
@@ -23,6 +32,12 @@ Graphics::Graphics(std::vector<Entity> *entities, Camera *camera, int xWindowSiz
 	windowSizeY = yWindowSize;
 	shaderMode = LIGHT_TEXTURE;
 	lightingMode = BLUE_LIGHT;
+	indirect = false;
+	occlusion = false;
+	headless = false;
+	window = NULL;
+	eglDisplay = eglContext = NULL;
+	framebuffer = resolveFramebuffer = 0;
 }
 
 void Graphics::setData(std::vector<Entity> *entities, Camera *camera){
@@ -30,50 +45,240 @@ void Graphics::setData(std::vector<Entity> *entities, Camera *camera){
 	this->camera = camera;
 }
 
+/**
+ * setIndirect requests the multi-draw indirect backend. Must be called
+ * before initWindow, which falls back to the GL 3.3 path if a GL 4.3
+ * context or the indirect shaders are not available.
+ */
+void Graphics::setIndirect(bool indirect){
+	this->indirect = indirect;
+}
+
+/**
+ * setHeadless renders into an offscreen framebuffer of a surfaceless EGL
+ * context instead of a window, for machines without a display. Frames are
+ * not shown or synchronised to vsync; readFrame reads them back. Must be
+ * called before initWindow.
+ */
+void Graphics::setHeadless(bool headless){
+	this->headless = headless;
+}
+
+/**
+ * setOcclusion requests occlusion culling of entities drawn one at a time.
+ * Must be called before initWindow, which leaves it off if the box program
+ * is not available.
+ */
+void Graphics::setOcclusion(bool occlusion){
+	this->occlusion = occlusion;
+}
+
 void Graphics::renderFrame(float t){
+	frameTimer.beginFrame();
+	frameTimer.beginPhase(PHASE_CLEAR);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glUseProgram(shaderPIDs[shaderMode]);
 
-	if( lightingMode == YELLOW_LIGHT ){
-		// Update light position
-		float x = 8 * cos(2 * M_PI * t/6);
-		float y = 8 * sin(2 * M_PI * t/6);
-		glm::vec4 lightPosition = glm::vec4(x, y, 0.0f, 1.0f);
-		GLint lightPosHandle = glGetUniformLocation(shaderPIDs[shaderMode], "light_position");
-		glUniform4fv(lightPosHandle, 1, glm::value_ptr(lightPosition));
+	frameTimer.beginPhase(PHASE_UPLOAD);
+	DynamicRing::shared().beginFrame();
+	setLighting(t);
+	uploadUniformBlocks();
+
+	frameTimer.beginPhase(PHASE_DRAW);
+
+	bool indirectMode = indirect && indirectShaders[shaderMode].getPID() != 0;
+	const ShaderProgram &shader = indirectMode ? indirectShaders[shaderMode] : shaders[shaderMode];
+	glUseProgram(shader.getPID());
+	if( !shader.hasBlock(BLOCK_LIGHTS) ){
+		setLightUniforms(shader);
 	}
-	for( int i=0; i<entities->size(); i++ ){
-		Entity current = entities->at(i);
-		current.render(camera->getProjection(), camera->getView(), shaderPIDs[shaderMode]);
+
+	// Entities and shapes outside the view are neither set up nor drawn
+	Frustum frustum(camera->getCameraMatrix());
+	cullStats = CullStats();
+	if( indirectMode ){
+		indirectRenderer.render(*entities, *camera, frustum, shader, cullStats);
+	}else if( shader.isInstanced() ){
+		renderInstanced(frustum, shader);
+	}else if( occlusion ){
+		occlusionCuller.render(*entities, *camera, frustum, shader, cullStats);
+	}else{
+		glm::mat4 projection = camera->getProjection();
+		glm::mat4 view = camera->getView();
+		for( int i=0; i<entities->size(); i++ ){
+			Entity &entity = entities->at(i);
+			Model *model = entity.getModel();
+			model->resetVisibility();
+			int visible = model->cull(frustum, entity.getTransform());
+			cullStats.add(model->getShapeCount(), visible);
+			if( visible > 0 ){
+				entity.setLevel(model->selectLevel(entity.getTransform(), *camera, entity.getLevel()));
+				entity.render(projection, view, shader);
+			}
+		}
 	}
-	
+	DynamicRing::shared().endFrame();
+
+	frameTimer.beginPhase(PHASE_FLUSH);
 	glFlush();
-	glfwSwapBuffers(window);
-	glfwPollEvents();
+	frameTimer.beginPhase(PHASE_SWAP);
+	if( !headless ){
+		glfwSwapBuffers(window);
+	}
+	frameTimer.beginPhase(PHASE_POLL);
+	if( !headless ){
+		glfwPollEvents();
+	}
+	frameTimer.endFrame();
+}
+
+CullStats Graphics::getCullStats(){
+	return cullStats;
+}
+
+OcclusionStats Graphics::getOcclusionStats(){
+	return occlusionCuller.getStats();
+}
+
+bool Graphics::isOcclusionCulling(){
+	return occlusion;
+}
+
+/**
+ * getFrameStats returns the min, median and 99th percentile CPU and GPU
+ * times of each phase of the last FRAME_STATS_WINDOW frames. GPU times
+ * lag a few frames behind.
+ */
+FrameStats Graphics::getFrameStats(){
+	return frameTimer.getStats();
+}
+
+/**
+ * setFrameLog writes the times of every frame from now on to a CSV file.
+ * @return Whether the file could be opened
+ */
+bool Graphics::setFrameLog(std::string path){
+	return frameTimer.openLog(path);
+}
+
+/**
+ * renderInstanced groups the visible entities by model and level of
+ * detail and draws each group once, passing their modelview matrices as
+ * instances. A shape is drawn if it is visible in any instance.
+ */
+void Graphics::renderInstanced(const Frustum &frustum, const ShaderProgram &shader){
+	glm::mat4 view = camera->getView();
+	for( std::map<Model*, InstanceGroups>::iterator it = instances.begin(); it != instances.end(); it++ ){
+		for( int level=0; level<LOD_LEVELS; level++ ){
+			it->second.levels[level].clear();
+		}
+		it->second.visible = false;
+	}
+	for( int i=0; i<entities->size(); i++ ){
+		Entity &entity = entities->at(i);
+		Model *model = entity.getModel();
+		InstanceGroups &groups = instances[model];
+		// Until one of the model's entities is visible, no shape visibility
+		// needs keeping
+		if( !groups.visible ){
+			model->resetVisibility();
+		}
+		int visible = model->cull(frustum, entity.getTransform());
+		cullStats.add(model->getShapeCount(), visible);
+		if( visible > 0 ){
+			entity.setLevel(model->selectLevel(entity.getTransform(), *camera, entity.getLevel()));
+			groups.levels[entity.getLevel()].push_back(view * entity.getTransform());
+			groups.visible = true;
+		}
+	}
+
+	std::map<Model*, InstanceGroups>::iterator it = instances.begin();
+	while( it != instances.end() ){
+		if( !it->second.visible ){
+			// No entities of this model are left or visible
+			instances.erase(it++);
+		}else{
+			for( int level=0; level<LOD_LEVELS; level++ ){
+				it->first->renderInstanced(camera->getProjection(), view, it->second.levels[level], shader, level);
+			}
+			it++;
+		}
+	}
 }
 
 void Graphics::initialiseShaders(){
-	shaderPIDs.resize(N_SHADERS);
-	shaderPIDs[LIGHT_TEXTURE] = (compileShader("light_texture"));
-	shaderPIDs[NORM_DEBUG] = (compileShader("debug_normal"));
-	shaderPIDs[DIFFUSE_DEBUG] = (compileShader("debug_diffuse"));
-	shaderPIDs[WIREFRAME_DEBUG] = (compileShader("debug_wireframe"));
+	shaders.resize(N_SHADERS);
+	shaders[LIGHT_TEXTURE] = compileShader("light_texture");
+	shaders[NORM_DEBUG] = compileShader("debug_normal");
+	shaders[DIFFUSE_DEBUG] = compileShader("debug_diffuse");
+	shaders[WIREFRAME_DEBUG] = compileShader("debug_wireframe");
+
+	// Indirect variants are optional: a mode without one uses the 3.3 path
+	if( indirect ){
+		indirectShaders.resize(N_SHADERS);
+		indirectShaders[LIGHT_TEXTURE] = compileShader("light_texture_indirect", false);
+		indirectShaders[NORM_DEBUG] = compileShader("debug_normal_indirect", false);
+		indirectShaders[DIFFUSE_DEBUG] = compileShader("debug_diffuse_indirect", false);
+		indirectShaders[WIREFRAME_DEBUG] = compileShader("debug_wireframe_indirect", false);
+	}
+	if( occlusion ){
+		occlusionShader = compileShader("occlusion_box", false);
+	}
 }
 
-unsigned int Graphics::compileShader(std::string name){
+/**
+ * compileShader compiles and links the named shader pair and reflects
+ * the program's uniform and attribute locations.
+ * If it fails, a required program exits, others return an empty program.
+ */
+ShaderProgram Graphics::compileShader(std::string name, bool required){
 	unsigned int PID = LoadShaders((name + ".vert").c_str(), (name + ".frag").c_str());
-	if( PID == 0 ){
+	if( PID == 0 && required ){
 		exit(1);
 	}
-	return PID;
+	return ShaderProgram(PID);
 }
 
-// TODO: time and position changing, call at render
-// Seperate into lighting module
-void Graphics::setLighting(unsigned int PID, float t){
-	glUseProgram(PID);
+/**
+ * initialiseUniformBlocks creates the camera and lights uniform buffers
+ * and attaches them to their binding points, where every program that
+ * declares the blocks reads them.
+ */
+void Graphics::initialiseUniformBlocks(){
+	glGenBuffers(1, &cameraUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLOCK_CAMERA, cameraUBO);
+
+	glGenBuffers(1, &lightsUBO);
+	glBindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(LightsBlock), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BLOCK_LIGHTS, lightsUBO);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+/**
+ * uploadUniformBlocks sends this frame's camera matrices and light state,
+ * once for all programs.
+ */
+void Graphics::uploadUniformBlocks(){
+	CameraBlock cameraBlock;
+	cameraBlock.view = camera->getView();
+	cameraBlock.projection = camera->getProjection();
+	glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &cameraBlock);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, lightsUBO);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightsBlock), &lights);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-	glm::vec4 lightPosition;
+/**
+ * setLighting sets the light state for the current lighting mode at time t.
+ * It is uploaded with the next frame.
+ */
+void Graphics::setLighting(float t){
+	glm::vec4 lightPosition = glm::vec4(0.0f);
 
 	glm::vec3 lightAmbient;
 	glm::vec3 lightDiffuse;
@@ -91,7 +296,10 @@ void Graphics::setLighting(unsigned int PID, float t){
 		lightDiffuse = glm::vec3(1.0f, 1.0f, 1.0f);
 		lightSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
 	}else if( lightingMode == YELLOW_LIGHT ){
-		lightPosition = glm::vec4(8.0f, 0.0f, 0.0f, 1.0f);
+		// Orbits the origin
+		float x = 8 * cos(2 * M_PI * t/6);
+		float y = 8 * sin(2 * M_PI * t/6);
+		lightPosition = glm::vec4(x, y, 0.0f, 1.0f);
 		lightAmbient = glm::vec3(0.1f, 0.1f, 0.1f);
 		lightDiffuse = glm::vec3(1.0f, 1.0f, 1.0f);
 		lightSpecular = glm::vec3(1.0f, 1.0f, 1.0f);
@@ -100,17 +308,23 @@ void Graphics::setLighting(unsigned int PID, float t){
 		lightDiffuse = glm::vec3(0.0f, 0.0f, 0.0f);
 		lightSpecular = glm::vec3(0.0f, 0.0f, 0.0f);
 	}
-	GLint lightPosHandle = glGetUniformLocation(PID, "light_position");
-	glUniform4fv(lightPosHandle, 1, glm::value_ptr(lightPosition));
+	lights.position = lightPosition;
+	lights.ambient = glm::vec4(lightAmbient, 0.0f);
+	lights.diffuse = glm::vec4(lightDiffuse, 0.0f);
+	lights.specular = glm::vec4(lightSpecular, 0.0f);
+}
 
-	// Load point light radiant properties
-	GLint ambientHandle = glGetUniformLocation(PID, "light_ambient");
-	GLint diffHandle = glGetUniformLocation(PID, "light_diffuse");
-	GLint specHandle = glGetUniformLocation(PID, "light_specular");
+/**
+ * setLightUniforms sends the light state as plain uniforms, for a program
+ * that does not declare the Lights block.
+ */
+void Graphics::setLightUniforms(const ShaderProgram &shader){
+	glUniform4fv(shader.uniform(UNIFORM_LIGHT_POSITION), 1, glm::value_ptr(lights.position));
 
-	glUniform3fv(ambientHandle, 1, glm::value_ptr(lightAmbient));
-	glUniform3fv(diffHandle, 1, glm::value_ptr(lightDiffuse));
-	glUniform3fv(specHandle, 1, glm::value_ptr(lightSpecular));
+	// Load point light radiant properties
+	glUniform3fv(shader.uniform(UNIFORM_LIGHT_AMBIENT), 1, glm::value_ptr(lights.ambient));
+	glUniform3fv(shader.uniform(UNIFORM_LIGHT_DIFFUSE), 1, glm::value_ptr(lights.diffuse));
+	glUniform3fv(shader.uniform(UNIFORM_LIGHT_SPECULAR), 1, glm::value_ptr(lights.specular));
 }
 
 void Graphics::setShaderMode(int mode){
@@ -124,7 +338,7 @@ void Graphics::setShaderMode(int mode){
 
 void Graphics::setLightingMode(int mode){
 	lightingMode = (lighting_mode)mode;
-	setLighting(shaderPIDs[shaderMode]);
+	setLighting();
 }
 
 
@@ -134,6 +348,58 @@ void error_callback(int error, const char* description){
 }
 
 void Graphics::initWindow(){
+	if( headless ){
+		createHeadlessContext();
+	}else{
+		createWindow();
+	}
+
+	// GLEW's GLX setup needs a display, so a headless context only loads
+	// the GL entry points
+	glewExperimental = true;
+	if( (headless ? glewContextInit() : glewInit()) != GLEW_OK ){
+		fprintf(stderr, "GLEW initialisation failed\n");
+		exit(1);
+	}
+	if( indirect && !GLEW_VERSION_4_3 ){
+		fprintf(stderr, "GL 4.3 not available, multi-draw indirect disabled\n");
+		indirect = false;
+	}
+	if( headless ){
+		createFramebuffers();
+	}
+
+	glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_MULTISAMPLE);
+	glFrontFace(GL_CCW);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+
+	initialiseShaders();
+	initialiseUniformBlocks();
+	DynamicRing::shared().initialise();
+	frameTimer.initialise();
+	if( indirect ){
+		indirectRenderer.initialise();
+	}
+	if( occlusion ){
+		occlusionCuller.initialise(occlusionShader);
+		if( !occlusionCuller.isEnabled() ){
+			fprintf(stderr, "Occlusion box program not available, occlusion culling disabled\n");
+			occlusion = false;
+		}
+	}
+	setLighting();
+}
+
+/**
+ * createWindow opens the GLFW window, with a GL 4.3 context if the
+ * indirect backend is requested and 3.3 otherwise, synchronised to vsync.
+ */
+void Graphics::createWindow(){
 	glfwSetErrorCallback(error_callback);
 
 	if( !glfwInit() ){
@@ -144,9 +410,20 @@ void Graphics::initWindow(){
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-	glfwWindowHint(GLFW_SAMPLES, 4);
-
-	window = glfwCreateWindow(600, 600, "Assignment 3", NULL, NULL);
+	glfwWindowHint(GLFW_SAMPLES, WINDOW_SAMPLES);
+
+	window = NULL;
+	if( indirect ){
+		// Try for GL 4.3, falling back to the 3.3 context
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Assignment 3", NULL, NULL);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	}
+	if( !window ){
+		window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Assignment 3", NULL, NULL);
+	}
 
 	if( !window ){
 		glfwTerminate();
@@ -155,24 +432,137 @@ void Graphics::initWindow(){
 
 	glfwMakeContextCurrent(window);
 	glfwSwapInterval(1);
+}
 
-	glewExperimental = true;
-	if( glewInit() != GLEW_OK ){
-		fprintf(stderr, "GLEW initialisation failed\n");
+// Core profile context of a GL version without a config or surface, or
+// EGL_NO_CONTEXT if the display cannot create one
+static EGLContext createEGLContext(EGLDisplay display, int major, int minor){
+	EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, major,
+		EGL_CONTEXT_MINOR_VERSION, minor,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	return eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+}
+
+/**
+ * createHeadlessContext makes a surfaceless EGL context current, with the
+ * same GL versions a window would get. Mesa's surfaceless platform needs
+ * neither a display server nor a GPU, rendering with llvmpipe if it has
+ * to; other EGL implementations are tried through the default display.
+ */
+void Graphics::createHeadlessContext(){
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if( getPlatformDisplay ){
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if( display == EGL_NO_DISPLAY ){
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if( display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API) ){
+		fprintf(stderr, "EGL initialisation failed\n");
 		exit(1);
 	}
 
-	glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_MULTISAMPLE);
-	glFrontFace(GL_CCW);
+	EGLContext context = EGL_NO_CONTEXT;
+	if( indirect ){
+		context = createEGLContext(display, 4, 3);
+	}
+	if( context == EGL_NO_CONTEXT ){
+		context = createEGLContext(display, 3, 3);
+	}
+	if( context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) ){
+		fprintf(stderr, "No surfaceless GL 3.3 context available\n");
+		eglTerminate(display);
+		exit(1);
+	}
+	eglDisplay = display;
+	eglContext = context;
+	window = NULL;
+}
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+/**
+ * createFramebuffers creates the framebuffer a headless context renders
+ * into, multisampled as a window's would be, and the single-sampled one
+ * it is resolved into for readFrame.
+ */
+void Graphics::createFramebuffers(){
+	glGenRenderbuffers(3, renderbuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, WINDOW_SAMPLES, GL_RGBA8, WINDOW_WIDTH, WINDOW_HEIGHT);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, WINDOW_SAMPLES, GL_DEPTH_COMPONENT24, WINDOW_WIDTH, WINDOW_HEIGHT);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[2]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WINDOW_WIDTH, WINDOW_HEIGHT);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &resolveFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[2]);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	if( glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE ){
+		fprintf(stderr, "Headless framebuffer incomplete\n");
+		exit(1);
+	}
+	glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+}
+
+/**
+ * readFrame resolves the last frame drawn headless and reads it back.
+ * @param rgb Filled with the frame's pixels, top row first
+ * @return Whether there was a frame to read; windows have none
+ */
+bool Graphics::readFrame(std::vector<unsigned char> &rgb, int &width, int &height){
+	if( !headless ){
+		return false;
+	}
+	width = WINDOW_WIDTH;
+	height = WINDOW_HEIGHT;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFramebuffer);
+
+	std::vector<unsigned char> rows(width * height * 3);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &rows[0]);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+	// GL's rows run bottom up
+	rgb.resize(rows.size());
+	for( int y=0; y<height; y++ ){
+		std::copy(&rows[(height - 1 - y) * width * 3], &rows[(height - y) * width * 3], &rgb[y * width * 3]);
+	}
+	return true;
+}
 
+/**
+ * finish waits until the GPU has executed every command issued so far, so
+ * that frames timed on the CPU have actually been rendered.
+ */
+void Graphics::finish(){
+	glFinish();
+}
 
-	initialiseShaders();
-	setLighting(shaderPIDs[shaderMode]);
+/**
+ * destroyWindow closes the window, or releases the headless context.
+ */
+void Graphics::destroyWindow(){
+	if( headless ){
+		eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(eglDisplay, eglContext);
+		eglTerminate(eglDisplay);
+	}else{
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 }
 
 GLFWwindow *Graphics::getWindow(){
@@ -3,9 +3,15 @@
 
 #include <GLFW/glfw3.h>
 #include <vector>
+#include <map>
+#include <glm/glm.hpp>
 
 #include "Entity.hpp"
 #include "Camera.hpp"
+#include "ShaderProgram.hpp"
+#include "IndirectRenderer.hpp"
+#include "OcclusionCuller.hpp"
+#include "FrameTimer.hpp"
 
 enum shader_mode{
 	LIGHT_TEXTURE,
@@ -25,11 +31,22 @@ class Graphics{
 public:
 	Graphics(std::vector<Entity> *entities = NULL, Camera *camera = NULL, int xWindowSize = 1000, int yWindowSize = 700);
 	void setData(std::vector<Entity> *entities, Camera *camera);
+	void setIndirect(bool indirect);
+	void setOcclusion(bool occlusion);
+	void setHeadless(bool headless);
 	void initWindow();
+	void destroyWindow();
+	void finish();
 	GLFWwindow *getWindow();
+	bool readFrame(std::vector<unsigned char> &rgb, int &width, int &height);
 
 	// Rendering
 	void renderFrame(float t = 0.0f);
+	CullStats getCullStats();
+	OcclusionStats getOcclusionStats();
+	bool isOcclusionCulling();
+	FrameStats getFrameStats();
+	bool setFrameLog(std::string path);
 
 	// Mode changes
 	void setShaderMode(int mode);
@@ -40,20 +57,76 @@ private:
 	Camera *camera;
 
 	// Shader programs
-	std::vector<unsigned int> shaderPIDs;
+	std::vector<ShaderProgram> shaders;
+
+	// Modelview matrices of the entities of each model at each level of
+	// detail, for instanced programs; kept between frames to reuse their
+	// storage
+	struct InstanceGroups{
+		std::vector<glm::mat4> levels[LOD_LEVELS];
+		bool visible;
+
+		InstanceGroups() : visible(false) {}
+	};
+	std::map<Model*, InstanceGroups> instances;
+
+	// Multi-draw indirect backend (GL 4.3), with its own shader programs
+	bool indirect;
+	IndirectRenderer indirectRenderer;
+	std::vector<ShaderProgram> indirectShaders;
+
+	// Occlusion culling of the per-entity path, with its box program
+	bool occlusion;
+	OcclusionCuller occlusionCuller;
+	ShaderProgram occlusionShader;
+
+	// Per-frame uniform blocks, in std140 layout (see shader_block)
+	struct CameraBlock{
+		glm::mat4 view;
+		glm::mat4 projection;
+	};
+	struct LightsBlock{
+		glm::vec4 position;
+		glm::vec4 ambient;
+		glm::vec4 diffuse;
+		glm::vec4 specular;
+	};
+	unsigned int cameraUBO, lightsUBO;
+	LightsBlock lights;
+
+	// Visible and culled counts of the last frame
+	CullStats cullStats;
+
+	// CPU and GPU times of the phases of recent frames
+	FrameTimer frameTimer;
 
 	// Window properties
 	GLFWwindow *window;
 	int windowSizeX, windowSizeY;
 
+	// Headless rendering: EGL display and context (as void pointers, to
+	// keep EGL out of this header), and multisampled framebuffer with the
+	// one it resolves into
+	bool headless;
+	void *eglDisplay, *eglContext;
+	unsigned int framebuffer, resolveFramebuffer;
+	unsigned int renderbuffers[3];
+
 	// Modes
 	shader_mode shaderMode;
 	lighting_mode lightingMode;
 
 	// Setup methods
+	void createWindow();
+	void createHeadlessContext();
+	void createFramebuffers();
 	void initialiseShaders();
-	unsigned int compileShader(std::string name);
-	void setLighting(unsigned int PID, float t = 0.0f);
+	ShaderProgram compileShader(std::string name, bool required = true);
+	void initialiseUniformBlocks();
+	void uploadUniformBlocks();
+	void setLighting(float t = 0.0f);
+	void setLightUniforms(const ShaderProgram &shader);
+	void renderInstanced(const Frustum &frustum, const ShaderProgram &shader);
 };
 
 // 	std::vector<unsigned int> shaderProgramIDs;
@@ -0,0 +1,289 @@
+#include "IndirectRenderer.hpp"
+
+#include <algorithm>
+#include <map>
+#include <GL/glew.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+// Follows the attribute locations of Model
+#define DRAW_ID_ATTRIB 3
+
+// Texture unit Model binds diffuse maps to
+#define DIFFMAP_UNIT 0
+
+// Storage buffer binding points
+#define TRANSFORM_BINDING 0
+#define DRAW_BINDING 1
+#define MATERIAL_BINDING 2
+#define QUANTISATION_BINDING 3
+
+IndirectRenderer::IndirectRenderer(){
+	commandBuffer = 0;
+	drawBuffer = transformBuffer = materialBuffer = quantisationBuffer = 0;
+	drawIDBuffer = 0;
+	drawIDCapacity = 0;
+	multiDraws = 0;
+}
+
+/**
+ * initialise creates the buffers. Must be called on the GL thread with
+ * a GL 4.3 context current.
+ */
+void IndirectRenderer::initialise(){
+	glGenBuffers(1, &commandBuffer);
+	glGenBuffers(1, &drawBuffer);
+	glGenBuffers(1, &transformBuffer);
+	glGenBuffers(1, &materialBuffer);
+	glGenBuffers(1, &quantisationBuffer);
+	glGenBuffers(1, &drawIDBuffer);
+}
+
+/**
+ * render draws every entity with the given program, one multi-draw per
+ * bucket of commands sharing a VAO, a texture and an index type.
+ * @param entities Entities to draw
+ * @param camera Camera whose view is combined with each entity's transform,
+ * 		and which levels of detail are chosen for
+ * @param frustum World-space view frustum entities and shapes are culled against
+ * @param shader Program implementing the interface described in the header
+ * @param stats Visible and culled counts, added to
+ */
+void IndirectRenderer::render(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, const ShaderProgram &shader, CullStats &stats){
+	build(entities, camera, frustum, stats);
+	upload();
+
+	glUseProgram(shader.getPID());
+	glUniform1i(shader.uniform(UNIFORM_DIFFMAP), DIFFMAP_UNIT);
+	glActiveTexture(GL_TEXTURE0 + DIFFMAP_UNIT);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TRANSFORM_BINDING, transformBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_BINDING, drawBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, materialBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, QUANTISATION_BINDING, quantisationBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+
+	unsigned int currentVAO = 0;
+	unsigned int currentTexture = 0;
+	multiDraws = 0;
+	for( int i=0; i<buckets.size(); i++ ){
+		const Bucket &bucket = buckets[i];
+		if( bucket.VAO != currentVAO ){
+			attachDrawIDs(bucket.VAO);
+			glBindVertexArray(bucket.VAO);
+			glUniform1i(shader.uniform(UNIFORM_OCTAHEDRAL_NORMALS), bucket.octahedral);
+			currentVAO = bucket.VAO;
+		}
+		if( bucket.texture != currentTexture ){
+			glBindTexture(GL_TEXTURE_2D, bucket.texture);
+			currentTexture = bucket.texture;
+		}
+		glMultiDrawElementsIndirect(GL_TRIANGLES, bucket.indexType, (void*)(bucket.first * sizeof(Command)), bucket.count, 0);
+		multiDraws++;
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+static void packMaterial(const tinyobj::material_t &material, glm::vec4 &ambient, glm::vec4 &diffuse, glm::vec4 &specular){
+	ambient = glm::vec4(material.ambient[0], material.ambient[1], material.ambient[2], 0.0f);
+	diffuse = glm::vec4(material.diffuse[0], material.diffuse[1], material.diffuse[2], 0.0f);
+	specular = glm::vec4(material.specular[0], material.specular[1], material.specular[2], material.shininess);
+}
+
+/**
+ * build fills the command, draw, transform, material and quantisation
+ * arrays for this frame. Entities are grouped by model and culled; for
+ * each model, the commands of the visible shapes of all its visible
+ * entities at one level of detail that use one texture and index type
+ * form a bucket. Each model's materials are
+ * appended to the material table, followed by its default material for
+ * faces without one, and its shapes' dequantisations to their table.
+ */
+void IndirectRenderer::build(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, CullStats &stats){
+	glm::mat4 view = camera.getView();
+	commands.clear();
+	draws.clear();
+	transforms.clear();
+	materials.clear();
+	quantisations.clear();
+	buckets.clear();
+
+	// Transform of each entity, and the entities of each model
+	std::vector<Model*> models;
+	std::map<Model*, std::vector<unsigned int> > instances;
+	for( int i=0; i<entities.size(); i++ ){
+		Model *model = entities[i].getModel();
+		transforms.push_back(view * entities[i].getTransform());
+		std::vector<unsigned int> &modelInstances = instances[model];
+		if( modelInstances.empty() ){
+			models.push_back(model);
+		}
+		modelInstances.push_back(i);
+	}
+
+	for( int m=0; m<models.size(); m++ ){
+		Model *model = models[m];
+		model->update();
+
+		unsigned int materialBase = materials.size();
+		for( int i=0; i<=model->materials.size(); i++ ){
+			const tinyobj::material_t &material = (i < model->materials.size()) ? model->materials[i] : model->defaultMaterial;
+			MaterialData data;
+			packMaterial(material, data.ambient, data.diffuse, data.specular);
+			materials.push_back(data);
+		}
+		unsigned int defaultMaterial = materials.size() - 1;
+
+		// Dequantisation of each shape with compact vertices, otherwise one
+		// identity shared by every shape
+		unsigned int quantisationBase = quantisations.size();
+		if( model->compressed ){
+			for( int i=0; i<model->compression.size(); i++ ){
+				const tinyobj::compression_t &compression = model->compression[i];
+				QuantisationData data;
+				data.scale = glm::vec4(compression.position_scale[0], compression.position_scale[1], compression.position_scale[2], 0.0f);
+				data.offset = glm::vec4(compression.position_offset[0], compression.position_offset[1], compression.position_offset[2], 0.0f);
+				quantisations.push_back(data);
+			}
+		}else{
+			QuantisationData data;
+			data.scale = glm::vec4(1.0f);
+			data.offset = glm::vec4(0.0f);
+			quantisations.push_back(data);
+		}
+
+		// Visible entities, with their levels of detail and the visibility
+		// of each of their shapes
+		const std::vector<unsigned int> &modelInstances = instances[model];
+		size_t shapes = model->getShapeCount();
+		visibleInstances.clear();
+		visibleLevels.clear();
+		visibility.clear();
+		for( int i=0; i<modelInstances.size(); i++ ){
+			Entity &entity = entities[modelInstances[i]];
+			model->resetVisibility();
+			int visible = model->cull(frustum, entity.getTransform());
+			stats.add(shapes, visible);
+			if( visible > 0 ){
+				entity.setLevel(model->selectLevel(entity.getTransform(), camera, entity.getLevel()));
+				visibleInstances.push_back(modelInstances[i]);
+				visibleLevels.push_back(entity.getLevel());
+				visibility.insert(visibility.end(), model->shapeVisible.begin(), model->shapeVisible.end());
+			}
+		}
+
+		// Draw ranges are sorted by level, texture and index type, so the
+		// ranges of each are consecutive
+		const std::vector<Model::DrawRange> &ranges = model->drawRanges;
+		size_t first = 0;
+		while( first < ranges.size() ){
+			unsigned int level = ranges[first].level;
+			unsigned int texture = model->materialTexture(ranges[first].materialID);
+			unsigned int indexType = ranges[first].indexType;
+			size_t last = first;
+			while( last < ranges.size() && ranges[last].level == level && model->materialTexture(ranges[last].materialID) == texture
+					&& ranges[last].indexType == indexType ){
+				last++;
+			}
+			size_t indexSize = (indexType == GL_UNSIGNED_SHORT) ? sizeof(unsigned short) : sizeof(unsigned int);
+
+			Bucket bucket;
+			bucket.VAO = model->VAO;
+			bucket.octahedral = model->compressed;
+			bucket.texture = texture;
+			bucket.indexType = indexType;
+			bucket.first = commands.size();
+			for( int i=0; i<visibleInstances.size(); i++ ){
+				if( visibleLevels[i] != level ){
+					continue;
+				}
+				for( size_t r=first; r<last; r++ ){
+					const Model::DrawRange &range = ranges[r];
+					if( !visibility[i * shapes + range.shape] ){
+						continue;
+					}
+					bool valid = range.materialID >= 0 && range.materialID < model->materials.size();
+
+					Command command;
+					command.count = range.count;
+					command.instanceCount = 1;
+					command.firstIndex = range.indexOffset / indexSize;
+					command.baseVertex = range.baseVertex;
+					command.baseInstance = commands.size();
+					commands.push_back(command);
+
+					DrawData draw;
+					draw.transform = visibleInstances[i];
+					draw.material = valid ? materialBase + range.materialID : defaultMaterial;
+					draw.quantisation = quantisationBase + (model->compressed ? range.shape : 0);
+					draw.padding = 0;
+					draws.push_back(draw);
+				}
+			}
+			bucket.count = commands.size() - bucket.first;
+			if( bucket.count > 0 ){
+				buckets.push_back(bucket);
+			}
+			first = last;
+		}
+	}
+}
+
+/**
+ * upload sends this frame's arrays, orphaning the previous frame's storage,
+ * and grows the draw ID buffer to cover every command.
+ */
+void IndirectRenderer::upload(){
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(Command), commands.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, draws.size() * sizeof(DrawData), draws.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, transformBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, transforms.size() * sizeof(glm::mat4), transforms.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(MaterialData), materials.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, quantisationBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, quantisations.size() * sizeof(QuantisationData), quantisations.data(), GL_STREAM_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// Regrowing keeps the buffer object, so attached VAOs stay valid
+	if( commands.size() > drawIDCapacity ){
+		drawIDCapacity = std::max(commands.size(), 2 * drawIDCapacity);
+		std::vector<unsigned int> drawIDs(drawIDCapacity);
+		for( unsigned int i=0; i<drawIDCapacity; i++ ){
+			drawIDs[i] = i;
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+		glBufferData(GL_ARRAY_BUFFER, drawIDs.size() * sizeof(unsigned int), drawIDs.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+}
+
+/**
+ * attachDrawIDs adds the instanced draw ID attribute to a model's VAO,
+ * once per VAO. With a divisor of 1, each command reads the element at
+ * its baseInstance, i.e. its own index.
+ */
+void IndirectRenderer::attachDrawIDs(unsigned int VAO){
+	if( attachedVAOs.count(VAO) ){
+		return;
+	}
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+	glEnableVertexAttribArray(DRAW_ID_ATTRIB);
+	glVertexAttribIPointer(DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, 0, (void*)0);
+	glVertexAttribDivisor(DRAW_ID_ATTRIB, 1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	attachedVAOs.insert(VAO);
+}
+
+int IndirectRenderer::getDraws(){
+	return commands.size();
+}
+
+int IndirectRenderer::getMultiDraws(){
+	return multiDraws;
+}
@@ -0,0 +1,114 @@
+#ifndef INDIRECT_RENDERER_HPP
+#define INDIRECT_RENDERER_HPP
+
+#include <vector>
+#include <set>
+#include <glm/glm.hpp>
+
+#include "Entity.hpp"
+#include "ShaderProgram.hpp"
+#include "Frustum.hpp"
+#include "Camera.hpp"
+
+/**
+ * The IndirectRenderer class draws entities with GL 4.3 multi-draw indirect.
+ * Every frame it builds one draw command per submesh of every entity. The
+ * commands of entities and shapes outside the frustum are left out, and
+ * each visible entity's commands are those of its level of detail. The
+ * commands are grouped into buckets of one VAO, texture and index type
+ * (models mix 16 and 32 bit indices), and each bucket is submitted with a
+ * single glMultiDrawElementsIndirect.
+ * Shaders fetch their per-draw data through a draw ID: each command's
+ * baseInstance is its index, read back by an instanced uint attribute.
+ * Programs used with it declare:
+ * 		layout(location = 3) in uint a_draw_id;
+ * 		struct Material{ vec4 ambient; vec4 diffuse; vec4 specular; };  // specular.w = shininess
+ * 		layout(std430, binding = 0) readonly buffer Transforms{ mat4 modelview[]; };
+ * 		layout(std430, binding = 1) readonly buffer Draws{ uvec4 draws[]; };  // x = transform, y = material, z = quantisation
+ * 		layout(std430, binding = 2) readonly buffer Materials{ Material materials[]; };
+ * 		struct Quantisation{ vec4 scale; vec4 offset; };
+ * 		layout(std430, binding = 3) readonly buffer Quantisations{ Quantisation quantisations[]; };
+ * along with the Camera and Lights uniform blocks, and sample diffmap.
+ * Positions are decoded as offset + scale * a_vertex, and normals as the
+ * octahedral_normals uniform says (see Model); both are identities for
+ * models without compact vertices.
+ * Requires a GL 4.3 context; Graphics falls back to Model::render without one.
+ */
+class IndirectRenderer{
+public:
+	IndirectRenderer();
+	void initialise();
+	void render(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, const ShaderProgram &shader, CullStats &stats);
+
+	// Statistics of the last render
+	int getDraws();
+	int getMultiDraws();
+private:
+	// Layout of a DrawElementsIndirectCommand
+	struct Command{
+		unsigned int count;
+		unsigned int instanceCount;
+		unsigned int firstIndex;
+		int baseVertex;
+		unsigned int baseInstance;
+	};
+
+	// Per-draw record, indexed by draw ID (std430)
+	struct DrawData{
+		unsigned int transform;
+		unsigned int material;
+		unsigned int quantisation;
+		unsigned int padding;
+	};
+
+	// Material record (std430)
+	struct MaterialData{
+		glm::vec4 ambient;
+		glm::vec4 diffuse;
+		glm::vec4 specular;
+	};
+
+	// Position dequantisation of a shape (std430)
+	struct QuantisationData{
+		glm::vec4 scale;
+		glm::vec4 offset;
+	};
+
+	// Consecutive commands sharing a VAO, a texture and an index type
+	struct Bucket{
+		unsigned int VAO;
+		bool octahedral;
+		unsigned int texture;
+		unsigned int indexType;
+		size_t first;
+		size_t count;
+	};
+
+	unsigned int commandBuffer;
+	unsigned int drawBuffer, transformBuffer, materialBuffer, quantisationBuffer;
+
+	// Holds 0, 1, 2, ... for the draw ID attribute; each VAO is pointed
+	// at it the first time it is drawn
+	unsigned int drawIDBuffer;
+	size_t drawIDCapacity;
+	std::set<unsigned int> attachedVAOs;
+
+	// Rebuilt every frame, kept to reuse their storage
+	std::vector<Command> commands;
+	std::vector<DrawData> draws;
+	std::vector<glm::mat4> transforms;
+	std::vector<MaterialData> materials;
+	std::vector<QuantisationData> quantisations;
+	std::vector<Bucket> buckets;
+	std::vector<unsigned int> visibleInstances;
+	std::vector<int> visibleLevels;
+	std::vector<unsigned char> visibility;
+
+	int multiDraws;
+
+	void build(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, CullStats &stats);
+	void upload();
+	void attachDrawIDs(unsigned int VAO);
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "MeshOptimiser.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Cache modelled by optimiseTriangles, and by simulateCache
+#define OPTIMISE_CACHE_SIZE 32
+#define SIMULATE_CACHE_SIZE 16
+
+// Weights of Forsyth's vertex scores
+#define LAST_TRIANGLE_SCORE 0.75f
+#define CACHE_DECAY_POWER 1.5f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+
+void MeshOptimiser::CacheStats::add(const CacheStats &other){
+	triangles += other.triangles;
+	vertices += other.vertices;
+	misses += other.misses;
+}
+
+float MeshOptimiser::CacheStats::acmr() const{
+	return triangles ? (float)misses / triangles : 0.0f;
+}
+
+float MeshOptimiser::CacheStats::atvr() const{
+	return vertices ? (float)misses / vertices : 0.0f;
+}
+
+/**
+ * simulateCache counts the vertices a FIFO post-transform cache would
+ * have to transform for a triangle list.
+ * @param indices Triangle list
+ * @param count Number of indices
+ * @param vertexCount Number of vertices the indices refer to
+ */
+MeshOptimiser::CacheStats MeshOptimiser::simulateCache(const unsigned int *indices, size_t count, size_t vertexCount){
+	CacheStats stats;
+	stats.triangles = count / 3;
+
+	// Time each vertex entered the cache; it is cached while within the last
+	// SIMULATE_CACHE_SIZE entries
+	std::vector<size_t> entered(vertexCount, 0);
+	std::vector<bool> used(vertexCount, false);
+	size_t time = SIMULATE_CACHE_SIZE + 1;
+	for( size_t i=0; i<count; i++ ){
+		unsigned int v = indices[i];
+		if( time - entered[v] > SIMULATE_CACHE_SIZE ){
+			entered[v] = time++;
+			stats.misses++;
+		}
+		if( !used[v] ){
+			used[v] = true;
+			stats.vertices++;
+		}
+	}
+	return stats;
+}
+
+// Forsyth's score of a vertex at a cache position (-1 if not cached) with
+// a number of triangles still to be added
+static float vertexScore(int cachePosition, unsigned int remaining){
+	if( remaining == 0 ){
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if( cachePosition >= 0 ){
+		if( cachePosition < 3 ){
+			// Used by the last triangle; a fixed score stops it being reused at once
+			score = LAST_TRIANGLE_SCORE;
+		}else{
+			float scale = 1.0f / (OPTIMISE_CACHE_SIZE - 3);
+			score = std::pow(1.0f - (cachePosition - 3) * scale, CACHE_DECAY_POWER);
+		}
+	}
+	// Favour vertices with few triangles left, to finish them off
+	return score + VALENCE_BOOST_SCALE * std::pow((float)remaining, -VALENCE_BOOST_POWER);
+}
+
+/**
+ * optimiseTriangles reorders the triangles of a triangle list in place so
+ * that consecutive triangles share vertices still in the cache.
+ * @param indices Triangle list, reordered
+ * @param count Number of indices, a multiple of 3
+ * @param vertexCount Number of vertices the indices refer to
+ */
+void MeshOptimiser::optimiseTriangles(unsigned int *indices, size_t count, size_t vertexCount){
+	size_t triangleCount = count / 3;
+	if( triangleCount < 2 ){
+		return;
+	}
+
+	// Triangles using each vertex, as ranges of one array
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for( size_t i=0; i<count; i++ ){
+		remaining[indices[i]]++;
+	}
+	std::vector<size_t> firstTriangle(vertexCount + 1, 0);
+	for( size_t v=0; v<vertexCount; v++ ){
+		firstTriangle[v + 1] = firstTriangle[v] + remaining[v];
+	}
+	std::vector<unsigned int> vertexTriangles(count);
+	std::vector<size_t> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+	for( size_t i=0; i<count; i++ ){
+		vertexTriangles[filled[indices[i]]++] = i / 3;
+	}
+
+	std::vector<float> score(vertexCount);
+	for( size_t v=0; v<vertexCount; v++ ){
+		score[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> triangleScore(triangleCount);
+	for( size_t t=0; t<triangleCount; t++ ){
+		triangleScore[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+	}
+
+	std::vector<bool> added(triangleCount, false);
+	std::vector<unsigned int> ordered;
+	ordered.reserve(count);
+
+	// LRU cache, with room for the three vertices pushed before evicting
+	std::vector<unsigned int> cache, nextCache;
+	cache.reserve(OPTIMISE_CACHE_SIZE + 3);
+	nextCache.reserve(OPTIMISE_CACHE_SIZE + 3);
+
+	size_t best = 0;
+	for( size_t t=1; t<triangleCount; t++ ){
+		if( triangleScore[t] > triangleScore[best] ){
+			best = t;
+		}
+	}
+	size_t scan = 0;
+	for( size_t n=0; n<triangleCount; n++ ){
+		if( best == triangleCount ){
+			// Nothing in the cache has triangles left: take the next unadded one
+			while( added[scan] ){
+				scan++;
+			}
+			best = scan;
+		}
+
+		// Add the triangle and remove it from its vertices' lists
+		added[best] = true;
+		const unsigned int *triangle = &indices[3 * best];
+		ordered.insert(ordered.end(), triangle, triangle + 3);
+		for( int k=0; k<3; k++ ){
+			unsigned int v = triangle[k];
+			unsigned int *list = &vertexTriangles[firstTriangle[v]];
+			unsigned int *end = list + remaining[v];
+			std::swap(*std::find(list, end, (unsigned int)best), *(end - 1));
+			remaining[v]--;
+		}
+
+		// Move its vertices to the front of the cache
+		nextCache.assign(triangle, triangle + 3);
+		for( size_t i=0; i<cache.size(); i++ ){
+			unsigned int v = cache[i];
+			if( v != triangle[0] && v != triangle[1] && v != triangle[2] ){
+				nextCache.push_back(v);
+			}
+		}
+		cache.swap(nextCache);
+
+		// Rescore the cached and evicted vertices and their triangles, and
+		// pick the best of those triangles
+		for( size_t i=0; i<cache.size(); i++ ){
+			unsigned int v = cache[i];
+			int position = (i < OPTIMISE_CACHE_SIZE) ? i : -1;
+			float delta = vertexScore(position, remaining[v]) - score[v];
+			score[v] += delta;
+			for( size_t j=firstTriangle[v]; j<firstTriangle[v] + remaining[v]; j++ ){
+				triangleScore[vertexTriangles[j]] += delta;
+			}
+		}
+		if( cache.size() > OPTIMISE_CACHE_SIZE ){
+			cache.resize(OPTIMISE_CACHE_SIZE);
+		}
+		best = triangleCount;
+		float bestScore = -1.0f;
+		for( size_t i=0; i<cache.size(); i++ ){
+			unsigned int v = cache[i];
+			for( size_t j=firstTriangle[v]; j<firstTriangle[v] + remaining[v]; j++ ){
+				unsigned int t = vertexTriangles[j];
+				if( triangleScore[t] > bestScore ){
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+	}
+	std::copy(ordered.begin(), ordered.end(), indices);
+}
+
+/**
+ * optimiseVertexFetch renumbers the vertices of a mesh in the order its
+ * indices first use them, moving positions, normals and texcoords to
+ * match, and renumbers the indices of its levels of detail. Vertices the
+ * full mesh does not use keep their relative order at the end.
+ */
+void MeshOptimiser::optimiseVertexFetch(tinyobj::mesh_t &mesh){
+	size_t vertexCount = mesh.positions.size() / 3;
+	const unsigned int unassigned = (unsigned int)-1;
+	std::vector<unsigned int> remap(vertexCount, unassigned);
+	unsigned int next = 0;
+	for( size_t i=0; i<mesh.indices.size(); i++ ){
+		unsigned int &v = remap[mesh.indices[i]];
+		if( v == unassigned ){
+			v = next++;
+		}
+		mesh.indices[i] = v;
+	}
+	for( size_t v=0; v<vertexCount; v++ ){
+		if( remap[v] == unassigned ){
+			remap[v] = next++;
+		}
+	}
+	for( size_t l=0; l<mesh.lods.size(); l++ ){
+		std::vector<unsigned int> &indices = mesh.lods[l].indices;
+		for( size_t i=0; i<indices.size(); i++ ){
+			indices[i] = remap[indices[i]];
+		}
+	}
+
+	// Moves each vertex's components of an attribute to its new place
+	struct Permute{
+		static void apply(std::vector<float> &attribute, size_t width, const std::vector<unsigned int> &remap){
+			if( attribute.size() != width * remap.size() ){
+				return;
+			}
+			std::vector<float> permuted(attribute.size());
+			for( size_t v=0; v<remap.size(); v++ ){
+				std::copy(&attribute[width * v], &attribute[width * v] + width, &permuted[width * remap[v]]);
+			}
+			attribute.swap(permuted);
+		}
+	};
+	Permute::apply(mesh.positions, 3, remap);
+	Permute::apply(mesh.normals, 3, remap);
+	Permute::apply(mesh.texcoords, 2, remap);
+}
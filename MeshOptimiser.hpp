@@ -0,0 +1,37 @@
+#ifndef MESH_OPTIMISER_HPP
+#define MESH_OPTIMISER_HPP
+
+#include <vector>
+
+#include "tiny_obj_loader.h"
+
+/**
+ * MeshOptimiser reorders triangle meshes for the GPU at load time:
+ * 		optimiseTriangles orders triangles for post-transform vertex cache
+ * 			reuse (Forsyth's linear-speed algorithm, for a 32 entry LRU cache)
+ * 		optimiseVertexFetch orders vertices by first use, so vertex fetches
+ * 			walk the vertex buffer forwards
+ * simulateCache measures an index buffer against a 16 entry FIFO cache,
+ * as a typical GPU's, giving the ACMR (cache misses per triangle) and
+ * ATVR (cache misses per vertex, 1.0 at best).
+ */
+class MeshOptimiser{
+public:
+	// Post-transform cache behaviour of one or more index buffers
+	struct CacheStats{
+		size_t triangles;
+		size_t vertices;
+		size_t misses;
+
+		CacheStats() : triangles(0), vertices(0), misses(0) {}
+		void add(const CacheStats &other);
+		float acmr() const;
+		float atvr() const;
+	};
+
+	static CacheStats simulateCache(const unsigned int *indices, size_t count, size_t vertexCount);
+	static void optimiseTriangles(unsigned int *indices, size_t count, size_t vertexCount);
+	static void optimiseVertexFetch(tinyobj::mesh_t &mesh);
+};
+
+#endif
@@ -3,7 +3,11 @@
 #include <iostream>
 #include <string>
 #include <math.h>
+#include <float.h>
+#include <stddef.h>
 #include <algorithm>
+#include <utility>
+#include <chrono>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -16,86 +20,429 @@
 #include "stb_image.h"
 
 #include "shader.hpp"
+#include "DynamicRing.hpp"
 
 #define VALS_PER_VERT 3
 #define VALS_PER_NORM 3
 #define VALS_PER_TEXEL 2
 
-unsigned int Model::nextTexUnit = 0;
+// Attribute locations shared by all shaders
+#define POSITION_ATTRIB 0
+#define NORMAL_ATTRIB 1
+#define TEXCOORD_ATTRIB 2
+
+// First of the four locations of the per-instance modelview matrix
+#define INSTANCE_ATTRIB 4
+
+// Texture unit diffuse maps are bound to
+#define DIFFMAP_UNIT 0
+
+// Screen-space error a level of detail may have, in pixels, and the
+// fraction past it a level must go before it changes
+#define LOD_PIXEL_ERROR 1.0f
+#define LOD_HYSTERESIS 0.25f
 
 
 // TESTING
 GLFWwindow *window;
 
-Model::Model(std::string objPath){
+Model::Model(std::string objPath, bool compressed){
+	this->objPath = objPath;
+	this->compressed = compressed;
 	int pos = objPath.rfind("/");
 	if( pos != std::string::npos ){
 		objDir = objPath.substr(0, pos + 1);
 	}else{
 		objDir = "";
 	}
+	extremum = 0.0f;
+	boundsMin = glm::vec3(FLT_MAX);
+	boundsMax = glm::vec3(-FLT_MAX);
+	centre = glm::vec3(0.0f);
+	radius = 0.0f;
+
+	VAO = 0;
+	vertexBuffer = indexBuffer = 0;
+	vertexBytes = vertexCapacity = 0;
+	indexBytes = indexCapacity = 0;
+	instanceBuffer = 0;
+	instanceCapacity = 0;
+	shortIndexShapes = 0;
+	indexCount = 0;
+	defaultTexture = 0;
+	for( int level=0; level<=LOD_LEVELS; level++ ){
+		levelFirst[level] = 0;
+	}
+	for( int level=0; level<LOD_LEVELS; level++ ){
+		levelErrors[level] = 0.0f;
+		levelTriangles[level] = 0;
+	}
+
+	// Used by faces without a material
+	for( int i=0; i<3; i++ ){
+		defaultMaterial.ambient[i] = 0.2f;
+		defaultMaterial.diffuse[i] = 0.8f;
+		defaultMaterial.specular[i] = 0.0f;
+	}
+	defaultMaterial.shininess = 1.0f;
+
+	// Populate shapes and materials on a background thread (using Tiny obj loader)
+	loadFailed = false;
+	loaderDone = false;
+	loading = true;
+	loader = std::thread(&Model::load, this, objPath);
+}
+
+Model::~Model(){
+	if( loader.joinable() ){
+		loader.join();
+	}
+}
 
-	// Populate shapes and materials (using Tiny obj loader)
+/**
+ * load runs on the loader thread. Shapes are queued for update()
+ * as soon as Tiny Object has finished parsing each one, along with
+ * their levels of detail.
+ */
+void Model::load(std::string objPath){
+	std::vector<tinyobj::material_t> loadedMaterials;
 	std::string error;
-	bool nonfatal = tinyobj::LoadObj(shapes, materials, error, objPath.c_str(), objDir.c_str());
-	if( !error.empty() ){
-		std::cerr << error;
+	ShapeReceiver receiver(this);
+	bool nonfatal = tinyobj::LoadObjStreaming(receiver, loadedMaterials, error, objPath.c_str(), objDir.c_str(), true, NULL, LOD_LEVELS - 1);
+
+	std::lock_guard<std::mutex> lock(pendingMutex);
+	pendingMaterials.insert(pendingMaterials.end(), loadedMaterials.begin() + receiver.materialsSent, loadedMaterials.end());
+	loadError = error;
+	loadFailed = !nonfatal;
+	loaderDone = true;
+}
+
+void Model::ShapeReceiver::operator()(const tinyobj::shape_t &shape, const std::vector<tinyobj::material_t> &materials){
+	// Split, optimise and interleave (or compress) here, off the GL thread,
+	// in the layout shared by all shapes
+	ShapeStream stream;
+	tinyobj::shape_t split = shape;
+	stream.prepare(split.mesh, model->compressed);
+
+	std::lock_guard<std::mutex> lock(model->pendingMutex);
+	model->pendingMaterials.insert(model->pendingMaterials.end(), materials.begin() + materialsSent, materials.end());
+	materialsSent = materials.size();
+	model->pendingShapes.push_back(tinyobj::shape_t());
+	std::swap(model->pendingShapes.back(), split);
+	model->pendingStreams.push_back(ShapeStream());
+	ShapeStream &pending = model->pendingStreams.back();
+	pending.vertices.swap(stream.vertices);
+	pending.compact.swap(stream.compact);
+	pending.compression = stream.compression;
+	pending.layout = stream.layout;
+	pending.lodIndices.swap(stream.lodIndices);
+	pending.shortIndices.swap(stream.shortIndices);
+	pending.submeshes.swap(stream.submeshes);
+	std::copy(stream.levelErrors, stream.levelErrors + LOD_LEVELS, pending.levelErrors);
+	pending.cacheBefore = stream.cacheBefore;
+	pending.cacheAfter = stream.cacheAfter;
+}
+
+/**
+ * update uploads the shapes and materials that have finished loading
+ * since the last call. Must be called on the GL thread.
+ */
+void Model::update(){
+	uploadTextures();
+	if( !loading ){
+		return;
+	}
+	// Read before draining, so nothing can be queued after the last drain
+	bool done = loaderDone;
+
+	std::vector<tinyobj::shape_t> newShapes;
+	std::vector<ShapeStream> newStreams;
+	std::vector<tinyobj::material_t> newMaterials;
+	{
+		std::lock_guard<std::mutex> lock(pendingMutex);
+		newShapes.swap(pendingShapes);
+		newStreams.swap(pendingStreams);
+		newMaterials.swap(pendingMaterials);
+	}
+
+	// Materials first, as the new shapes may refer to them
+	size_t firstMaterial = materials.size();
+	materials.insert(materials.end(), newMaterials.begin(), newMaterials.end());
+	genTextures(firstMaterial);
+
+	size_t firstShape = shapes.size();
+	shapes.resize(firstShape + newShapes.size());
+	for( int i=0; i<newShapes.size(); i++ ){
+		shapes[firstShape + i].name.swap(newShapes[i].name);
+		std::swap(shapes[firstShape + i].mesh, newShapes[i].mesh);
 	}
-	if( !nonfatal ){
-		exit(1);
+	uploadShapes(firstShape, newStreams);
+	calculateExtremum(firstShape);
+	calculateBounds(firstShape);
+
+	if( done ){
+		loader.join();
+		loading = false;
+		if( !loadError.empty() ){
+			std::cerr << loadError;
+		}
+		printBufferStats();
+		if( loadFailed ){
+			exit(1);
+		}
 	}
-	generateVAOs();
-	genTextures();
-	calculateExtremum();
+}
+
+bool Model::isLoading(){
+	return loading;
 }
 
 /**
- * generateVao creates a VAO based on the data provided by Tiny
- * Object that was parsed from the OBJ file.
+ * growBuffer moves a buffer's contents into a new, larger buffer.
+ * The copy targets are used so that no VAO state is touched.
+ * @param buffer Buffer to grow (0 if none yet), replaced by the new one
+ * @param used Bytes of buffer in use, which are copied
+ * @param capacity Size of the new buffer in bytes
  */
-void Model::generateVAOs(){
-	// Create VAO for each shape
-	// This is simpler and allows for per-shape uniform variables (other functionality for this NYI)
-	VAOs.resize(shapes.size());
-	glGenVertexArrays(shapes.size(), &VAOs[0]);
+static void growBuffer(unsigned int &buffer, size_t used, size_t capacity){
+	unsigned int grown;
+	glGenBuffers(1, &grown);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+	glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STATIC_DRAW);
+	if( used > 0 ){
+		glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &buffer);
+	buffer = grown;
+}
 
-	for( int i=0; i<shapes.size(); i++ ){
-		// Current mesh
-		tinyobj::mesh_t mesh = shapes[i].mesh;
+/**
+ * uploadShapes appends the vertices and indices of shapes[first] onwards
+ * to the model's shared buffers, growing them (at least doubling) when
+ * they are full, and adds a draw range for each of their submeshes.
+ * Every stream is in the same layout, with zeros for the attributes a
+ * shape lacks.
+ * @param first Index of the first shape not yet uploaded
+ * @param streams Interleaved or compact vertices of shapes[first] onwards
+ */
+void Model::uploadShapes(size_t first, std::vector<ShapeStream> &streams){
+	if( first >= shapes.size() ){
+		return;
+	}
+	if( VAO == 0 ){
+		glGenVertexArrays(1, &VAO);
+		layout = streams[0].layout;
+	}
 
-		glBindVertexArray(VAOs[i]);
+	// Make room for the new shapes, with padding to align 32 bit indices
+	size_t newVertexBytes = 0;
+	size_t newIndexBytes = 0;
+	for( int i=first; i<shapes.size(); i++ ){
+		const ShapeStream &stream = streams[i - first];
+		newVertexBytes += stream.bytes();
+		if( stream.shortIndices.empty() ){
+			newIndexBytes += (shapes[i].mesh.indices.size() + stream.lodIndices.size()) * sizeof(unsigned int) + sizeof(unsigned short);
+		}else{
+			newIndexBytes += stream.shortIndices.size() * sizeof(unsigned short);
+		}
+	}
+	bool grown = false;
+	if( vertexBytes + newVertexBytes > vertexCapacity ){
+		vertexCapacity = std::max(vertexBytes + newVertexBytes, 2 * vertexCapacity);
+		growBuffer(vertexBuffer, vertexBytes, vertexCapacity);
+		grown = true;
+	}
+	if( indexBytes + newIndexBytes > indexCapacity ){
+		indexCapacity = std::max(indexBytes + newIndexBytes, 2 * indexCapacity);
+		growBuffer(indexBuffer, indexBytes, indexCapacity);
+		grown = true;
+	}
+	if( grown ){
+		attachBuffers();
+	}
 
-		// Set up buffers for vertices, normals, texcoords, and indices
-		unsigned int buffer[4];
-		glGenBuffers(4, buffer);
+	// Append each shape
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+	for( int i=first; i<shapes.size(); i++ ){
+		ShapeStream &stream = streams[i - first];
+		const std::vector<ShapeStream::SubMesh> &submeshes = stream.submeshes;
+
+		// Indices must be aligned to their size. 32 bit indices are the full
+		// mesh's followed by the coarser levels'
+		bool shortIndices = !stream.shortIndices.empty();
+		size_t indexSize = shortIndices ? sizeof(unsigned short) : sizeof(unsigned int);
+		const std::vector<unsigned int> &indices = shapes[i].mesh.indices;
+		size_t shapeIndexBytes = (indices.size() + stream.lodIndices.size()) * indexSize;
+		indexBytes = (indexBytes + indexSize - 1) / indexSize * indexSize;
+
+		for( int j=0; j<submeshes.size(); j++ ){
+			DrawRange range;
+			range.level = submeshes[j].level;
+			range.shape = i;
+			range.materialID = submeshes[j].materialID;
+			range.count = submeshes[j].count;
+			range.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+			range.indexOffset = indexBytes + submeshes[j].firstIndex * indexSize;
+			range.baseVertex = vertexBytes / layout.stride;
+			drawRanges.push_back(range);
+			levelTriangles[range.level] += range.count / 3;
+		}
+		for( int level=0; level<LOD_LEVELS; level++ ){
+			levelErrors[level] = std::max(levelErrors[level], stream.levelErrors[level]);
+		}
 
-		// Load vertices
-		glBindBuffer(GL_ARRAY_BUFFER, buffer[0]);
-		glBufferData(GL_ARRAY_BUFFER, mesh.positions.size() * sizeof(float), &mesh.positions[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, VALS_PER_VERT, GL_FLOAT, GL_FALSE, 0, 0);
+		glBufferSubData(GL_ARRAY_BUFFER, vertexBytes, stream.bytes(), stream.data());
+		if( shortIndices ){
+			glBufferSubData(GL_COPY_WRITE_BUFFER, indexBytes, shapeIndexBytes, stream.shortIndices.data());
+		}else{
+			glBufferSubData(GL_COPY_WRITE_BUFFER, indexBytes, indices.size() * indexSize, indices.data());
+			glBufferSubData(GL_COPY_WRITE_BUFFER, indexBytes + indices.size() * indexSize, stream.lodIndices.size() * indexSize, stream.lodIndices.data());
+		}
+		vertexBytes += stream.bytes();
+		indexBytes += shapeIndexBytes;
+		indexCount += indices.size() + stream.lodIndices.size();
+		if( compressed ){
+			compression.push_back(stream.compression);
+		}
+		if( shortIndices ){
+			shortIndexShapes++;
+		}
+		cacheBefore.add(stream.cacheBefore);
+		cacheAfter.add(stream.cacheAfter);
+		std::vector<float>().swap(stream.vertices);
+		std::vector<tinyobj::compact_vertex_t>().swap(stream.compact);
+		std::vector<unsigned int>().swap(stream.lodIndices);
+		std::vector<unsigned short>().swap(stream.shortIndices);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		// Load normals
-		if( mesh.normals.size() == 0 ){
-			mesh.normals.resize(mesh.positions.size(), 0.0f);
+	sortDrawRanges();
+}
+
+/**
+ * sortDrawRanges puts the draw ranges in render order: by level of
+ * detail, then texture, then index type, then material, so each texture
+ * and each material is set once per render (once per index type in models
+ * with both), and finds where each level's ranges start.
+ */
+void Model::sortDrawRanges(){
+	std::sort(drawRanges.begin(), drawRanges.end(), [this](const DrawRange &a, const DrawRange &b){
+		if( a.level != b.level ){
+			return a.level < b.level;
+		}
+		unsigned int textureA = materialTexture(a.materialID);
+		unsigned int textureB = materialTexture(b.materialID);
+		if( textureA != textureB ){
+			return textureA < textureB;
 		}
-		glBindBuffer(GL_ARRAY_BUFFER, buffer[1]);
-		glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(float), &mesh.normals[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, VALS_PER_VERT, GL_FLOAT, GL_FALSE, 0, 0);			
+		if( a.indexType != b.indexType ){
+			return a.indexType < b.indexType;
+		}
+		if( a.materialID != b.materialID ){
+			return a.materialID < b.materialID;
+		}
+		return a.shape < b.shape;
+	});
 
-		// Load texcoords
-		if( mesh.texcoords.size() == 0 ){
-			mesh.texcoords.resize(mesh.positions.size(), 0.0f);
+	size_t i = 0;
+	for( int level=0; level<=LOD_LEVELS; level++ ){
+		while( i < drawRanges.size() && drawRanges[i].level < level ){
+			i++;
 		}
-		glBindBuffer(GL_ARRAY_BUFFER, buffer[2]);
-		glBufferData(GL_ARRAY_BUFFER, mesh.texcoords.size() * sizeof(float), &mesh.texcoords[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, VALS_PER_TEXEL, GL_FLOAT, GL_FALSE, 0, 0);
+		levelFirst[level] = i;
+	}
+}
 
-		// Load indices
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer[3]);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), &mesh.indices[0], GL_STATIC_DRAW);
+// Texture of a material, the default texture for faces without one
+unsigned int Model::materialTexture(int materialID){
+	if( materialID < 0 || materialID >= texIDs.size() ){
+		return defaultTexture;
+	}
+	return texIDs[materialID];
+}
+
+/**
+ * attachBuffers points the VAO at the current shared buffers.
+ * Called whenever growing replaces them.
+ */
+void Model::attachBuffers(){
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glEnableVertexAttribArray(POSITION_ATTRIB);
+	glEnableVertexAttribArray(NORMAL_ATTRIB);
+	glEnableVertexAttribArray(TEXCOORD_ATTRIB);
+	if( compressed ){
+		// Normals are left unnormalised: signed normalisation differs between GL versions
+		glVertexAttribPointer(POSITION_ATTRIB, VALS_PER_VERT, GL_UNSIGNED_SHORT, GL_TRUE, layout.stride, (void*)(size_t)layout.position_offset);
+		glVertexAttribPointer(NORMAL_ATTRIB, 2, GL_SHORT, GL_FALSE, layout.stride, (void*)(size_t)layout.normal_offset);
+		glVertexAttribPointer(TEXCOORD_ATTRIB, VALS_PER_TEXEL, GL_HALF_FLOAT, GL_FALSE, layout.stride, (void*)(size_t)layout.texcoord_offset);
+	}else{
+		glVertexAttribPointer(POSITION_ATTRIB, VALS_PER_VERT, GL_FLOAT, GL_FALSE, layout.stride, (void*)(size_t)layout.position_offset);
+		glVertexAttribPointer(NORMAL_ATTRIB, VALS_PER_NORM, GL_FLOAT, GL_FALSE, layout.stride, (void*)(size_t)layout.normal_offset);
+		glVertexAttribPointer(TEXCOORD_ATTRIB, VALS_PER_TEXEL, GL_FLOAT, GL_FALSE, layout.stride, (void*)(size_t)layout.texcoord_offset);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * printBufferStats reports the GL objects the model uses, next to what
+ * one VAO with a vertex and an index buffer per shape would have used.
+ */
+void Model::printBufferStats(){
+	int VAOs = (VAO != 0) ? 1 : 0;
+	std::cout << objPath << ": " << shapes.size() << " shapes in " << VAOs << " VAO and "
+		<< 2 * VAOs << " buffer objects (" << (vertexBytes + indexBytes) / (1024.0 * 1024.0) << " MB), "
+		<< VAOs << " VAO bind per render; per-shape buffers would use " << shapes.size() << " VAOs, "
+		<< 2 * shapes.size() << " buffer objects and " << shapes.size() << " VAO binds per render" << std::endl;
+
+	// State changes of the sorted draw ranges of the full detail level
+	int materialChanges = 0;
+	int textureChanges = 0;
+	for( size_t i=levelFirst[0]; i<levelFirst[1]; i++ ){
+		if( i == 0 || drawRanges[i].materialID != drawRanges[i - 1].materialID ){
+			materialChanges++;
+		}
+		if( i == 0 || materialTexture(drawRanges[i].materialID) != materialTexture(drawRanges[i - 1].materialID) ){
+			textureChanges++;
+		}
+	}
+	std::cout << objPath << ": " << levelFirst[1] - levelFirst[0] << " draw ranges, " << materialChanges << " material and "
+		<< textureChanges << " texture changes per render" << std::endl;
+
+	// Triangles and errors of the levels of detail
+	std::cout << objPath << ": levels of detail of";
+	for( int level=0; level<LOD_LEVELS; level++ ){
+		std::cout << (level > 0 ? "," : "") << " " << levelTriangles[level] << " triangles (error "
+			<< (radius > 0.0f ? 100.0f * levelErrors[level] / (2.0f * radius) : 0.0f) << "%)";
+	}
+	std::cout << " of the model's size" << std::endl;
+
+	// Vertex cache optimisation, and the savings of 16 bit indices
+	std::cout << objPath << ": vertex cache ACMR " << cacheBefore.acmr() << " -> " << cacheAfter.acmr()
+		<< ", ATVR " << cacheBefore.atvr() << " -> " << cacheAfter.atvr() << "; " << shortIndexShapes << " of "
+		<< shapes.size() << " shapes use 16 bit indices, " << indexBytes / (1024.0 * 1024.0) << " MB of indices instead of "
+		<< indexCount * sizeof(unsigned int) / (1024.0 * 1024.0) << " MB" << std::endl;
+
+	// Savings and largest errors of compact vertices
+	if( compressed && layout.stride > 0 ){
+		size_t floatBytes = (vertexBytes / layout.stride) * (VALS_PER_VERT + VALS_PER_NORM + VALS_PER_TEXEL) * sizeof(float);
+		tinyobj::compression_t worst = {};
+		for( int i=0; i<compression.size(); i++ ){
+			worst.position_error = std::max(worst.position_error, compression[i].position_error);
+			worst.normal_error = std::max(worst.normal_error, compression[i].normal_error);
+			worst.texcoord_error = std::max(worst.texcoord_error, compression[i].texcoord_error);
+		}
+		std::cout << objPath << ": compact vertices of " << layout.stride << " bytes use " << vertexBytes / (1024.0 * 1024.0)
+			<< " MB instead of " << floatBytes / (1024.0 * 1024.0) << " MB; largest error: position " << worst.position_error
+			<< " (" << (radius > 0.0f ? 100.0f * worst.position_error / (2.0f * radius) : 0.0f) << "% of the model's size), normal "
+			<< worst.normal_error << " degrees, texcoord " << worst.texcoord_error << std::endl;
 	}
 }
 
@@ -106,34 +453,77 @@ void Model::generateVAOs(){
 // Parallelisable
 
 
-void Model::genTextures(){
-	texIDs = new unsigned int[materials.size()];
-	glGenTextures(materials.size(), texIDs);
-	for( int i=0; i<materials.size(); i++ ){
-		glActiveTexture(GL_TEXTURE0 + nextTexUnit++);
-		glBindTexture(GL_TEXTURE_2D, texIDs[i]);
-
+/**
+ * genTextures creates the textures of the materials from first onwards.
+ * Materials with the same diffuse map share a texture, and materials
+ * without one use the model's default texture. Each new texture starts
+ * out as the default image and its image file is queued for decoding on
+ * the shared texture pool; uploadTextures replaces it once decoded.
+ * @param first Index of the first material without a texture
+ */
+void Model::genTextures(size_t first){
+	glActiveTexture(GL_TEXTURE0 + DIFFMAP_UNIT);
+	if( defaultTexture == 0 ){
+		glGenTextures(1, &defaultTexture);
+		glBindTexture(GL_TEXTURE_2D, defaultTexture);
+		loadDefaultTexture();
+	}
+	if( first >= materials.size() ){
+		return;
+	}
+	texIDs.resize(materials.size());
+	for( int i=first; i<materials.size(); i++ ){
 		std::string texname = materials[i].diffuse_texname;
-		if( !texname.empty() ){
-			loadTexture(objDir + texname);
-		}else{
-			loadDefaultTexture();
+		if( texname.empty() ){
+			texIDs[i] = defaultTexture;
+			continue;
+		}
+		std::map<std::string, unsigned int>::iterator shared = texturesByName.find(texname);
+		if( shared != texturesByName.end() ){
+			texIDs[i] = shared->second;
+			continue;
 		}
+
+		glGenTextures(1, &texIDs[i]);
+		glBindTexture(GL_TEXTURE_2D, texIDs[i]);
+		loadDefaultTexture();
+		texturesByName[texname] = texIDs[i];
+		TexturePool::shared().decode(textureQueue, objDir + texname, texIDs[i], DIFFMAP_UNIT);
+	}
+}
+
+/**
+ * uploadTextures uploads the texture images that have finished decoding
+ * since the last call. Must be called on the GL thread.
+ */
+void Model::uploadTextures(){
+	std::vector<TexturePool::Image> images;
+	textureQueue.take(images);
+	for( int i=0; i<images.size(); i++ ){
+		uploadTexture(images[i]);
+		TexturePool::release(images[i]);
 	}
 }
 
 /**
- * loadTexture is responsible for loading a single texture
- * from an image file specified by texPath into the currently
- * active texture.
- * @param texPath Path to the texture image file
+ * uploadTexture is responsible for loading a single decoded
+ * texture image into the texture it was decoded for.
+ * A texture whose image failed to decode keeps the default texture.
+ * @param image Decoded texture image
  */
-void Model::loadTexture(std::string texPath){
-	int x, y, n;
-	unsigned char *data = stbi_load(texPath.c_str(), &x, &y, &n, 3);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, x, y, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-	stbi_image_free(data);
+void Model::uploadTexture(TexturePool::Image &image){
+	if( !image.data ){
+		std::cerr << "Texture " << image.path << ": cannot decode (" << image.error << ")" << std::endl;
+		return;
+	}
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	glActiveTexture(GL_TEXTURE0 + image.texUnit);
+	glBindTexture(GL_TEXTURE_2D, image.texID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
 	glGenerateMipmap(GL_TEXTURE_2D);
+	std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now() - t0;
+	std::cout << "Texture " << image.path << ": " << image.width << "x" << image.height
+		<< " decoded in " << image.decodeMs << " ms, uploaded in " << t.count() << " ms" << std::endl;
 }
 
 void Model::loadDefaultTexture(){
@@ -141,51 +531,188 @@ void Model::loadDefaultTexture(){
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, colour);
 }
 
-void Model::render(glm::mat4 projection, glm::mat4 modelview, glm::mat4 view, unsigned int PID){
-	glUseProgram(PID);
+void Model::render(const glm::mat4 &projection, const glm::mat4 &modelview, const glm::mat4 &view, const ShaderProgram &shader, int level){
+	update();
+	glUseProgram(shader.getPID());
 
-	// Load transformation matrices
-	GLint viewHandle = glGetUniformLocation(PID, "view_matrix");
-	glUniformMatrix4fv(viewHandle, 1, GL_FALSE, glm::value_ptr(view));
+	// Load transformation matrices, unless they go in the Draw block
+	if( !shader.hasBlock(BLOCK_DRAW) ){
+		glUniformMatrix4fv(shader.uniform(UNIFORM_MODELVIEW_MATRIX), 1, GL_FALSE, glm::value_ptr(modelview));
 
-	GLint modelViewHandle = glGetUniformLocation(PID, "modelview_matrix");
-	glUniformMatrix4fv(modelViewHandle, 1, GL_FALSE, glm::value_ptr(modelview));
+		glm::mat3 normal(modelview);
+		glUniformMatrix3fv(shader.uniform(UNIFORM_NORMAL_MATRIX), 1, GL_FALSE, glm::value_ptr(normal));
+	}
 
-	GLint normalHandle = glGetUniformLocation(PID, "normal_matrix");
-	glm::mat3 normal(modelview);
-	glUniformMatrix3fv(normalHandle, 1, GL_FALSE, glm::value_ptr(normal));
+	drawSubmeshes(projection, modelview, view, shader, 1, level);
+}
 
-	GLint projectionHandle = glGetUniformLocation(PID, "projection_matrix");
-	glUniformMatrix4fv(projectionHandle, 1, GL_FALSE, glm::value_ptr(projection));
+/**
+ * renderInstanced draws one copy of the model per modelview matrix, with
+ * an instanced draw per draw range. The shader must be instanced (see
+ * ShaderProgram), reading the matrices from the instance attribute.
+ * @param modelviews Modelview matrix of each instance
+ */
+void Model::renderInstanced(const glm::mat4 &projection, const glm::mat4 &view, const std::vector<glm::mat4> &modelviews, const ShaderProgram &shader, int level){
+	update();
+	if( VAO == 0 || modelviews.empty() ){
+		return;
+	}
+	glUseProgram(shader.getPID());
+	uploadInstances(modelviews);
+	drawSubmeshes(projection, glm::mat4(), view, shader, modelviews.size(), level);
+}
 
-	for( int i=0; i<shapes.size(); i++ ){
-		// Load shape-specific uniform variables
-		unsigned int matID = shapes[i].mesh.material_ids[0];
+/**
+ * uploadInstances writes the given matrices to the DynamicRing and points
+ * the instance attribute at them. Before the ring is initialised, they
+ * replace the contents of the model's own instance buffer instead,
+ * orphaning the previous frame's storage; it is created on first use.
+ */
+void Model::uploadInstances(const std::vector<glm::mat4> &modelviews){
+	size_t bytes = modelviews.size() * sizeof(glm::mat4);
+	DynamicRing &ring = DynamicRing::shared();
+	if( ring.isInitialised() ){
+		size_t offset = ring.write(modelviews.data(), bytes, sizeof(glm::vec4));
+		attachInstances(ring.getBuffer(), offset);
+		return;
+	}
+	if( instanceBuffer == 0 ){
+		glGenBuffers(1, &instanceBuffer);
+		attachInstances(instanceBuffer, 0);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+	instanceCapacity = std::max(instanceCapacity, bytes);
+	glBufferData(GL_ARRAY_BUFFER, instanceCapacity, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, modelviews.data());
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-		// Load lighting material properties
-		GLint ambientHandle = glGetUniformLocation(PID, "ambient");
-		GLint diffHandle = glGetUniformLocation(PID, "diffuse");
-		GLint specHandle = glGetUniformLocation(PID, "specular");
-		GLint shininessHandle = glGetUniformLocation(PID, "shininess");
-		glUniform3fv(ambientHandle, 1, &(materials[matID].ambient[0]));
-		glUniform3fv(diffHandle, 1, &materials[matID].diffuse[0]);
-		glUniform3fv(specHandle, 1, &materials[matID].specular[0]);
-		glUniform1fv(shininessHandle, 1, &materials[matID].shininess);
+/**
+ * attachInstances points the VAO's instance attribute at the matrices at
+ * offset in buffer.
+ */
+void Model::attachInstances(unsigned int buffer, size_t offset){
+	glBindVertexArray(VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for( int i=0; i<4; i++ ){
+		glEnableVertexAttribArray(INSTANCE_ATTRIB + i);
+		glVertexAttribPointer(INSTANCE_ATTRIB + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(offset + i * sizeof(glm::vec4)));
+		glVertexAttribDivisor(INSTANCE_ATTRIB + i, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-		// Load textures
-		GLint diffmapHandle = glGetUniformLocation(PID, "diffmap");
-		glUniform1i(diffmapHandle, matID);
+/**
+ * drawSubmeshes draws every draw range of a level of detail, instances
+ * times, with the program in use and its per-model state set.
+ * A program declaring the Draw block gets its per-draw uniforms, with
+ * modelview, as a range of the DynamicRing written whenever the shape or
+ * material changes; others get plain uniforms.
+ */
+void Model::drawSubmeshes(const glm::mat4 &projection, const glm::mat4 &modelview, const glm::mat4 &view, const ShaderProgram &shader, int instances, int level){
+	// View and projection come from the Camera block unless the program
+	// still uses plain uniforms
+	if( !shader.hasBlock(BLOCK_CAMERA) ){
+		glUniformMatrix4fv(shader.uniform(UNIFORM_VIEW_MATRIX), 1, GL_FALSE, glm::value_ptr(view));
+		glUniformMatrix4fv(shader.uniform(UNIFORM_PROJECTION_MATRIX), 1, GL_FALSE, glm::value_ptr(projection));
+	}
 
-		glBindVertexArray(VAOs[i]);
-		glDrawElements(GL_TRIANGLES, shapes[i].mesh.indices.size() * sizeof(unsigned int), GL_UNSIGNED_INT, (void*)0);
+	// Diffuse maps are bound to one unit as they are needed
+	glUniform1i(shader.uniform(UNIFORM_DIFFMAP), DIFFMAP_UNIT);
+	glActiveTexture(GL_TEXTURE0 + DIFFMAP_UNIT);
+
+	DynamicRing &ring = DynamicRing::shared();
+	bool drawBlock = shader.hasBlock(BLOCK_DRAW) && ring.isInitialised();
+	DrawBlock block;
+	if( drawBlock ){
+		block.modelview = modelview;
+		for( int i=0; i<3; i++ ){
+			block.normal[i] = glm::vec4(glm::vec3(modelview[i]), 0.0f);
+		}
+		block.positionScale = glm::vec3(1.0f);
+		block.positionOffset = glm::vec3(0.0f);
+		block.octahedralNormals = compressed;
+	}else{
+		// Vertex decoding, which does nothing unless the vertices are compact
+		glUniform1i(shader.uniform(UNIFORM_OCTAHEDRAL_NORMALS), compressed);
+		if( !compressed ){
+			glUniform3f(shader.uniform(UNIFORM_POSITION_SCALE), 1.0f, 1.0f, 1.0f);
+			glUniform3f(shader.uniform(UNIFORM_POSITION_OFFSET), 0.0f, 0.0f, 0.0f);
+		}
+	}
 
-		glBindVertexArray(0);
+	// Draw ranges are sorted, so each material and texture is set once
+	glBindVertexArray(VAO);
+	int currentMaterial = -2;
+	unsigned int currentTexture = 0;
+	unsigned int currentShape = shapes.size();
+	level = std::max(0, std::min(level, LOD_LEVELS - 1));
+	for( size_t i=levelFirst[level]; i<levelFirst[level + 1]; i++ ){
+		const DrawRange &range = drawRanges[i];
+		if( !shapeVisible[range.shape] ){
+			continue;
+		}
+		bool changed = false;
+		if( compressed && range.shape != currentShape ){
+			currentShape = range.shape;
+			if( drawBlock ){
+				const tinyobj::compression_t &quantisation = compression[currentShape];
+				block.positionScale = glm::vec3(quantisation.position_scale[0], quantisation.position_scale[1], quantisation.position_scale[2]);
+				block.positionOffset = glm::vec3(quantisation.position_offset[0], quantisation.position_offset[1], quantisation.position_offset[2]);
+			}else{
+				glUniform3fv(shader.uniform(UNIFORM_POSITION_SCALE), 1, compression[currentShape].position_scale);
+				glUniform3fv(shader.uniform(UNIFORM_POSITION_OFFSET), 1, compression[currentShape].position_offset);
+			}
+			changed = true;
+		}
+		if( range.materialID != currentMaterial ){
+			currentMaterial = range.materialID;
+			bool valid = currentMaterial >= 0 && currentMaterial < materials.size();
+			const tinyobj::material_t &material = valid ? materials[currentMaterial] : defaultMaterial;
+
+			// Load lighting material properties
+			if( drawBlock ){
+				block.ambient = glm::vec3(material.ambient[0], material.ambient[1], material.ambient[2]);
+				block.diffuse = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+				block.specular = glm::vec3(material.specular[0], material.specular[1], material.specular[2]);
+				block.shininess = material.shininess;
+			}else{
+				glUniform3fv(shader.uniform(UNIFORM_AMBIENT), 1, &material.ambient[0]);
+				glUniform3fv(shader.uniform(UNIFORM_DIFFUSE), 1, &material.diffuse[0]);
+				glUniform3fv(shader.uniform(UNIFORM_SPECULAR), 1, &material.specular[0]);
+				glUniform1fv(shader.uniform(UNIFORM_SHININESS), 1, &material.shininess);
+			}
+			changed = true;
+
+			// Load textures
+			unsigned int texture = materialTexture(currentMaterial);
+			if( texture != currentTexture ){
+				glBindTexture(GL_TEXTURE_2D, texture);
+				currentTexture = texture;
+			}
+		}
+		if( drawBlock && changed ){
+			size_t offset = ring.write(&block, sizeof(DrawBlock), ring.getUniformAlignment());
+			glBindBufferRange(GL_UNIFORM_BUFFER, BLOCK_DRAW, ring.getBuffer(), offset, sizeof(DrawBlock));
+		}
+		unsigned int condition = range.shape < shapeConditions.size() ? shapeConditions[range.shape] : 0;
+		if( condition != 0 ){
+			glBeginConditionalRender(condition, GL_QUERY_WAIT);
+		}
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.count, range.indexType, (void*)range.indexOffset, instances, range.baseVertex);
+		if( condition != 0 ){
+			glEndConditionalRender();
+		}
 	}
+	glBindVertexArray(0);
 }
 
-void Model::calculateExtremum(){
-	extremum = 0.0f;
-	for( int i=0; i<shapes.size(); i++ ){
+void Model::calculateExtremum(size_t first){
+	if( first == 0 ){
+		extremum = 0.0f;
+	}
+	for( int i=first; i<shapes.size(); i++ ){
 		std::vector<float> positions = shapes[i].mesh.positions;
 		for( int j=0; j<positions.size(); j++ ){
 			extremum = std::max(extremum, std::abs(positions[j]));
@@ -198,6 +725,120 @@ float Model::getExtremum(){
 	return extremum;
 }
 
+/**
+ * calculateBounds adds the bounding spheres of shapes[first] onwards,
+ * each around the centre of the shape's bounding box, and grows the
+ * model's sphere around the box of all shapes.
+ * @param first Index of the first shape without bounds
+ */
+void Model::calculateBounds(size_t first){
+	if( first == 0 ){
+		shapeBounds.clear();
+		shapeLower.clear();
+		shapeUpper.clear();
+		boundsMin = glm::vec3(FLT_MAX);
+		boundsMax = glm::vec3(-FLT_MAX);
+	}
+	for( int i=first; i<shapes.size(); i++ ){
+		const std::vector<float> &positions = shapes[i].mesh.positions;
+		if( positions.empty() ){
+			shapeBounds.add(glm::vec3(0.0f), 0.0f);
+			shapeLower.push_back(glm::vec3(0.0f));
+			shapeUpper.push_back(glm::vec3(0.0f));
+			continue;
+		}
+		glm::vec3 lower(FLT_MAX), upper(-FLT_MAX);
+		for( int j=0; j<positions.size(); j+=3 ){
+			glm::vec3 position(positions[j], positions[j + 1], positions[j + 2]);
+			lower = glm::min(lower, position);
+			upper = glm::max(upper, position);
+		}
+		shapeBounds.add(0.5f * (lower + upper), 0.5f * glm::length(upper - lower));
+		shapeLower.push_back(lower);
+		shapeUpper.push_back(upper);
+		boundsMin = glm::min(boundsMin, lower);
+		boundsMax = glm::max(boundsMax, upper);
+		centre = 0.5f * (boundsMin + boundsMax);
+		radius = 0.5f * glm::length(boundsMax - boundsMin);
+	}
+	shapeVisible.resize(shapes.size(), 1);
+	cullScratch.resize(shapes.size());
+}
+
+/**
+ * resetVisibility marks every shape hidden, before the transforms the
+ * model is drawn with this frame are culled.
+ */
+void Model::resetVisibility(){
+	std::fill(shapeVisible.begin(), shapeVisible.end(), 0);
+}
+
+/**
+ * cull tests the model, drawn with transform, against a world-space
+ * frustum: first its bounding sphere, then, unless that is entirely
+ * inside, the sphere of every shape. Visible shapes are added to those
+ * that render draws. Shapes that finish loading are added first.
+ * @return Number of shapes visible with this transform
+ */
+int Model::cull(const Frustum &frustum, const glm::mat4 &transform){
+	update();
+	if( shapes.empty() ){
+		return 0;
+	}
+	Frustum local = frustum.transformed(transform);
+	Frustum::Result result = local.classify(centre, radius);
+	if( result == Frustum::OUTSIDE ){
+		return 0;
+	}
+	if( result == Frustum::INSIDE ){
+		std::fill(shapeVisible.begin(), shapeVisible.end(), 1);
+		return shapes.size();
+	}
+	int visible = local.cull(shapeBounds, &cullScratch[0]);
+	for( int i=0; i<shapes.size(); i++ ){
+		shapeVisible[i] |= cullScratch[i];
+	}
+	return visible;
+}
+
+size_t Model::getShapeCount(){
+	return shapes.size();
+}
+
+/**
+ * selectLevel picks the level of detail to draw the model at with the
+ * given transform: the coarsest level whose error, at the scale the
+ * model's bounding sphere is projected to, stays within LOD_PIXEL_ERROR
+ * pixels. A level is only left once its error is LOD_HYSTERESIS past
+ * that, on either side, so models near a threshold do not flicker.
+ * @param current Level chosen last frame
+ */
+int Model::selectLevel(const glm::mat4 &transform, Camera &camera, int current){
+	if( radius <= 0.0f ){
+		return 0;
+	}
+	glm::vec3 worldCentre = glm::vec3(transform * glm::vec4(centre, 1.0f));
+	float scale = std::max(glm::length(glm::vec3(transform[0])),
+		std::max(glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2]))));
+
+	// Full detail with the camera inside the bounds
+	float diameter = camera.projectedDiameter(worldCentre, radius * scale);
+	if( diameter == FLT_MAX ){
+		return 0;
+	}
+
+	// Errors are in model space, as is the radius
+	float pixelsPerUnit = diameter / (2.0f * radius);
+	int level = std::max(0, std::min(current, LOD_LEVELS - 1));
+	while( level > 0 && levelErrors[level] * pixelsPerUnit > LOD_PIXEL_ERROR * (1.0f + LOD_HYSTERESIS) ){
+		level--;
+	}
+	while( level + 1 < LOD_LEVELS && levelErrors[level + 1] * pixelsPerUnit < LOD_PIXEL_ERROR * (1.0f - LOD_HYSTERESIS) ){
+		level++;
+	}
+	return level;
+}
+
 // float Model::xMax(){
 // 	return xmax;
 // }
@@ -2,9 +2,20 @@
 #define MODEL_HPP
 
 #include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <glm/glm.hpp>
 
 #include "tiny_obj_loader.h"
+#include "TexturePool.hpp"
+#include "ShaderProgram.hpp"
+#include "Frustum.hpp"
+#include "MeshOptimiser.hpp"
+#include "ShapeStream.hpp"
+#include "Camera.hpp"
 
 
 /**
@@ -17,34 +28,195 @@
  * Children of the model class can implement their own rules for generating a VAO
  * as well as rendering. The render method is virtual, so children can take advantage
  * of polymorphism.
+ * The OBJ file is loaded on a background thread. Shapes are handed over to
+ * the GL thread as they finish loading and are uploaded by update(), so a
+ * Model can be rendered while it is still loading.
+ * All shapes share one VAO, vertex buffer and index buffer. Each shape's
+ * faces are grouped by material, and the resulting ranges are drawn with
+ * base-vertex draws, sorted by texture and material so that each is set
+ * once per render.
+ * renderInstanced draws many copies of the model at once, taking each
+ * copy's modelview matrix from a per-instance attribute.
+ * Programs declaring the Draw block (see ShaderProgram) get the modelview,
+ * material and vertex decoding of each draw through the DynamicRing, and
+ * instance matrices are streamed through it too.
+ * Each shape has a bounding sphere. cull() tests the model and its shapes
+ * against a frustum, and only shapes marked visible are drawn.
+ * A compressed model stores its vertices in the 16 byte
+ * tinyobj::compact_vertex_t format instead of 32 bytes of floats. Shaders
+ * decode them with three uniforms, which are set for every model:
+ * 		uniform vec3 position_scale;     // a_vertex arrives as 0..1 of the shape's box
+ * 		uniform vec3 position_offset;
+ * 		uniform bool octahedral_normals; // a_normal.xy is then -32767..32767
+ * 		vec3 vertex = position_offset + position_scale * a_vertex;
+ * 		vec3 decodeNormal(vec3 n){
+ * 			if( !octahedral_normals ) return n;
+ * 			vec2 e = max(n.xy / 32767.0, -1.0);
+ * 			vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+ * 			if( v.z < 0.0 ) v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+ * 			return normalize(v);
+ * 		}
+ * Texcoords are half floats, which need no decoding.
+ * On loading, each submesh's triangles are reordered for the vertex cache
+ * and each shape's vertices for fetch order (see MeshOptimiser). Shapes
+ * of fewer than 65536 vertices store 16 bit indices.
+ * Each shape also has coarser levels of detail (tinyobj::GenerateLods),
+ * stored as further index ranges over its vertices. Shapes that cannot be
+ * reduced LOD_LEVELS - 1 times repeat their coarsest level. selectLevel
+ * picks the coarsest level whose error covers about a pixel, at the size
+ * of the model's bounding sphere on screen.
+ * Shapes can be drawn conditionally on occlusion queries (see
+ * OcclusionCuller), which tests each shape's bounding box.
  */
 
 class Model{
+	friend class IndirectRenderer;
+	friend class OcclusionCuller;
 protected:
-	std::vector<unsigned int> VAOs;
-	unsigned int *texIDs;
+	// Shared vertex and index buffers, grown as shapes arrive
+	unsigned int VAO;
+	unsigned int vertexBuffer, indexBuffer;
+	size_t vertexBytes, vertexCapacity;
+	size_t indexBytes, indexCapacity;
+	tinyobj::vertex_layout_t layout;
 
-	static unsigned int nextTexUnit;
+	// A submesh's place in the shared buffers, in render order
+	struct DrawRange{
+		unsigned int level;
+		unsigned int shape;
+		int materialID;
+		unsigned int count;
+		unsigned int indexType;
+		size_t indexOffset;
+		int baseVertex;
+	};
+	std::vector<DrawRange> drawRanges;
+
+	// Draw ranges of each level of detail start at levelFirst[level]
+	size_t levelFirst[LOD_LEVELS + 1];
+
+	// Largest error of each level over all shapes, in model space, and the
+	// triangles of each level
+	float levelErrors[LOD_LEVELS];
+	size_t levelTriangles[LOD_LEVELS];
+
+	// Modelview matrices of the instances drawn by renderInstanced, when
+	// the DynamicRing is not in use
+	unsigned int instanceBuffer;
+	size_t instanceCapacity;
+
+	// Per-draw uniforms, in the std140 layout of the Draw block (see
+	// ShaderProgram)
+	struct DrawBlock{
+		glm::mat4 modelview;
+		glm::vec4 normal[3];
+		glm::vec3 ambient;
+		float padding0;
+		glm::vec3 diffuse;
+		float padding1;
+		glm::vec3 specular;
+		float shininess;
+		glm::vec3 positionScale;
+		float padding2;
+		glm::vec3 positionOffset;
+		unsigned int octahedralNormals;
+	};
+
+	// Texture of each material; materials share textures by file name
+	std::vector<unsigned int> texIDs;
+	std::map<std::string, unsigned int> texturesByName;
+	unsigned int defaultTexture;
+	TexturePool::DecodeQueue textureQueue;
+	tinyobj::material_t defaultMaterial;
 
 	// Model data
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
+	std::string objPath;
 	std::string objDir;
 
 	// Bound
 	float extremum;
 
-	void generateVAOs();
-	void genTextures();
-	void loadTexture(std::string texpath);
+	// Bounding spheres of the model and of each shape, in model space, and
+	// the bounding box of each shape
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 centre;
+	float radius;
+	BoundingSpheres shapeBounds;
+	std::vector<glm::vec3> shapeLower, shapeUpper;
+
+	// Shapes visible to any transform culled since resetVisibility
+	std::vector<unsigned char> shapeVisible;
+	std::vector<unsigned char> cullScratch;
+
+	// Occlusion query each shape's draws are conditional on, 0 for none;
+	// empty unless an OcclusionCuller is drawing the model
+	std::vector<unsigned int> shapeConditions;
+
+	// Compact vertices, with the quantisation of each shape
+	bool compressed;
+	std::vector<tinyobj::compression_t> compression;
+
+	// Vertex cache behaviour of all shapes before and after optimisation,
+	// the shapes with 16 bit indices, and the indices of all levels
+	MeshOptimiser::CacheStats cacheBefore, cacheAfter;
+	size_t shortIndexShapes;
+	size_t indexCount;
+
+	// Streaming: filled on the loader thread, drained by update()
+	class ShapeReceiver : public tinyobj::ShapeConsumer{
+	public:
+		Model *model;
+		size_t materialsSent;
+		ShapeReceiver(Model *model) : model(model), materialsSent(0) {}
+		void operator()(const tinyobj::shape_t &shape, const std::vector<tinyobj::material_t> &materials);
+	};
+	std::thread loader;
+	std::mutex pendingMutex;
+	std::vector<tinyobj::shape_t> pendingShapes;
+	std::vector<ShapeStream> pendingStreams;
+	std::vector<tinyobj::material_t> pendingMaterials;
+	std::string loadError;
+	bool loadFailed;
+	std::atomic<bool> loaderDone;
+	bool loading;
+
+	void load(std::string objPath);
+	void uploadShapes(size_t first, std::vector<ShapeStream> &streams);
+	void attachBuffers();
+	void sortDrawRanges();
+	void uploadInstances(const std::vector<glm::mat4> &modelviews);
+	void attachInstances(unsigned int buffer, size_t offset);
+	void drawSubmeshes(const glm::mat4 &projection, const glm::mat4 &modelview, const glm::mat4 &view, const ShaderProgram &shader, int instances, int level);
+	unsigned int materialTexture(int materialID);
+	void printBufferStats();
+	void genTextures(size_t first = 0);
+	void uploadTextures();
+	void uploadTexture(TexturePool::Image &image);
 	void loadDefaultTexture();
 public:
-	Model(std::string objPath);
-	virtual void render(glm::mat4 projection, glm::mat4 modelview, glm::mat4 view, unsigned int PID);
+	Model(std::string objPath, bool compressed = false);
+	virtual ~Model();
+	virtual void render(const glm::mat4 &projection, const glm::mat4 &modelview, const glm::mat4 &view, const ShaderProgram &shader, int level = 0);
+	virtual void renderInstanced(const glm::mat4 &projection, const glm::mat4 &view, const std::vector<glm::mat4> &modelviews, const ShaderProgram &shader, int level = 0);
+
+	// Streaming
+	void update();
+	bool isLoading();
 
 	// Bounds
-	void calculateExtremum();
+	void calculateExtremum(size_t first = 0);
 	float getExtremum();
+	void calculateBounds(size_t first = 0);
+
+	// Culling
+	void resetVisibility();
+	int cull(const Frustum &frustum, const glm::mat4 &transform);
+	size_t getShapeCount();
+
+	// Levels of detail
+	int selectLevel(const glm::mat4 &transform, Camera &camera, int current);
 };
 
 #endif
\ No newline at end of file
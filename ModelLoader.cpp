@@ -3,30 +3,56 @@
 #include <algorithm>
 #include <iostream>
 #include <chrono>
+#include <fstream>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 int main(int argc, char **argv){
 	if( argc < 2){
-		std::cout << "Usage: assign2 [-c] pathToObj" << std::endl;
+		std::cout << "Usage: assign2 [-c] [-i] [-o] [-q] [-t timings.csv] [-H] [-f frames] [-v views] [-p prefix] pathToObj..." << std::endl;
+		return 1;
 	}
 	ModelLoader ml;
-	if( argc==3 ){
-		if( !strcmp(argv[1],"-c") ){
-			ml.setCharacter(true);
-		}else if( !strcmp(argv[2], "-c") ){
+	std::vector<std::string> paths;
+	for( int i=1; i<argc; i++ ){
+		if( !strcmp(argv[i], "-c") ){
 			ml.setCharacter(true);
-			argc--;
+		}else if( !strcmp(argv[i], "-i") ){
+			// Multi-draw indirect, if GL 4.3 is available
+			ml.setIndirect(true);
+		}else if( !strcmp(argv[i], "-o") ){
+			// Occlusion culling, when drawing entities one at a time
+			ml.setOcclusion(true);
+		}else if( !strcmp(argv[i], "-t") && i + 1 < argc ){
+			// CSV log of every frame's phase times
+			if( !ml.setFrameLog(argv[++i]) ){
+				std::cout << "Could not open " << argv[i] << std::endl;
+				return 1;
+			}
+		}else if( !strcmp(argv[i], "-q") ){
+			// Compact (quantised) vertices
+			ml.setCompressed(true);
+		}else if( !strcmp(argv[i], "-H") ){
+			// Headless: render offscreen, without a window or vsync
+			ml.setHeadless(true);
+		}else if( !strcmp(argv[i], "-f") && i + 1 < argc ){
+			// Exit after this many frames once loaded
+			ml.setFrames(atoi(argv[++i]));
+		}else if( !strcmp(argv[i], "-v") && i + 1 < argc ){
+			// Orbit the camera through this many views, one per frame
+			ml.setViews(atoi(argv[++i]));
+		}else if( !strcmp(argv[i], "-p") && i + 1 < argc ){
+			// Write each headless frame to prefixNNNN.ppm
+			ml.setFramePrefix(argv[++i]);
 		}else{
-			std::cout << "Usage: assign2 [-c] pathToObj" << std::endl;
+			paths.push_back(argv[i]);
 		}
 	}
-	std::vector<std::string> paths;
-	// for( int i=1; i<argc; i++ ){
-	// 	std::string path = argv[i];
-	// 	paths.push_back(path);
-	// }
-	paths.push_back(argv[argc-1]);
+	if( paths.empty() ){
+		std::cout << "No model given" << std::endl;
+		return 1;
+	}
 
 	ml.initialise(paths);
 	// Print usage guide
@@ -51,6 +77,11 @@ bool ModelLoader::leftMouseDown = false;
 bool ModelLoader::rightMouseDown = false;
 bool ModelLoader::debug = false;
 bool ModelLoader::character = false;
+bool ModelLoader::compressed = false;
+bool ModelLoader::headless = false;
+int ModelLoader::frames = 0;
+int ModelLoader::views = 0;
+std::string ModelLoader::framePrefix;
 double ModelLoader::xprev, ModelLoader::yprev;
 int ModelLoader::windowX, ModelLoader::windowY;
 int ModelLoader::nextShaderMode = 1;
@@ -63,22 +94,101 @@ ModelLoader::ModelLoader(){
 	windowY = 700;
 }
 
+ModelLoader::~ModelLoader(){
+	unloadModels();
+}
+
 void ModelLoader::setCharacter(bool c){
 	character = c;
 }
 
+void ModelLoader::setIndirect(bool i){
+	graphics.setIndirect(i);
+}
+
+void ModelLoader::setOcclusion(bool o){
+	graphics.setOcclusion(o);
+}
+
+bool ModelLoader::setFrameLog(std::string path){
+	return graphics.setFrameLog(path);
+}
+
+void ModelLoader::setCompressed(bool c){
+	compressed = c;
+}
+
+/**
+ * setHeadless renders without a window, into an offscreen framebuffer.
+ * Unless a frame count or views are set, one frame is rendered once the
+ * models have loaded.
+ */
+void ModelLoader::setHeadless(bool h){
+	headless = h;
+	graphics.setHeadless(h);
+}
+
+// Frames to render once the models have loaded before exiting; 0 to run
+// until the window is closed
+void ModelLoader::setFrames(int f){
+	frames = std::max(f, 0);
+}
+
+// Views the camera orbits through, one per frame; the frame count
+// defaults to one turn
+void ModelLoader::setViews(int v){
+	views = std::max(v, 0);
+}
+
+void ModelLoader::setFramePrefix(std::string prefix){
+	framePrefix = prefix;
+}
+
 void ModelLoader::loadModel(std::string path){
+	models.push_back(new Model(path, compressed));
+	entities.push_back(Entity(models.back()));
+	fitted.push_back(false);
+}
+
+/**
+ * unloadModels deletes the models and their entities. Deleting a model
+ * waits for its loader thread, so no thread outlives the ModelLoader.
+ */
+void ModelLoader::unloadModels(){
+	entities.clear();
+	for( int i=0; i<models.size(); i++ ){
+		delete models[i];
+	}
+	models.clear();
+	fitted.clear();
+}
+
+/**
+ * fitEntities scales each entity s.t. the extremum of its model == max.
+ * Extremums grow while models are still streaming in, so this runs every
+ * frame until each model has finished loading.
+ */
+void ModelLoader::fitEntities(){
 	float max = 1.2f;//camera.maxX();
-	models.push_back(Model(path));
-	entities.push_back(Entity(&models.back()));
-	float extremum = models.back().getExtremum();
-	std::cout <<"Max view " << max << " Extremum " << extremum << std::endl;
-	// Scale s.t. extremum == max
-	if( extremum!=0 ){
-		entities.back().resize(max/extremum);
+	for( int i=0; i<models.size(); i++ ){
+		if( fitted[i] ){
+			continue;
+		}
+		float extremum = models[i]->getExtremum();
+		if( extremum!=0 ){
+			entities[i].resize(max/extremum);
+		}
+		if( !models[i]->isLoading() ){
+			std::cout <<"Max view " << max << " Extremum " << extremum << std::endl;
+			fitted[i] = true;
+		}
 	}
 }
 
+bool ModelLoader::allFitted(){
+	return std::find(fitted.begin(), fitted.end(), false) == fitted.end();
+}
+
 void ModelLoader::initCamera(){
 	camera.reposition(glm::vec3(0.0f, 2.0f, 6.0f));
 	camera.fixedLookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -88,6 +198,7 @@ void ModelLoader::initialise(std::vector<std::string> paths){
 	graphics.initWindow();
 	window = graphics.getWindow();
 	initCamera();
+	loadStart = std::chrono::system_clock::now();
 	for( int i=0; i<paths.size(); i++ ){
 		loadModel(paths[i]);
 	}
@@ -235,28 +346,112 @@ void ModelLoader::registerCallbacks(){
 	glfwSetFramebufferSizeCallback(window, window_resize_callback);
 }
 
+/**
+ * printFrameStats prints the median (and 99th percentile) CPU and GPU
+ * times of each phase of recent frames, and of whole frames.
+ */
+void ModelLoader::printFrameStats(){
+	FrameStats stats = graphics.getFrameStats();
+	std::cout << "Frame times over " << stats.frames << " frames, median (p99) ms: CPU " << stats.cpuFrame.median
+		<< " (" << stats.cpuFrame.p99 << "), GPU " << stats.gpuFrame.median << " (" << stats.gpuFrame.p99 << ");";
+	for( int i=0; i<N_PHASES; i++ ){
+		std::cout << " " << FrameTimer::phaseName(i) << " " << stats.cpu[i].median << "/" << stats.gpu[i].median;
+	}
+	std::cout << " (CPU/GPU)" << std::endl;
+}
+
+/**
+ * writeFrame writes the last headless frame to framePrefix, numbered, as
+ * a binary PPM.
+ * @return Whether there was a frame and it could be written
+ */
+bool ModelLoader::writeFrame(int frame){
+	std::vector<unsigned char> rgb;
+	int width, height;
+	if( !graphics.readFrame(rgb, width, height) ){
+		return false;
+	}
+	char number[16];
+	snprintf(number, sizeof(number), "%04d", frame);
+	std::string path = framePrefix + number + ".ppm";
+	std::ofstream file(path.c_str(), std::ios::binary);
+	if( !file.is_open() ){
+		std::cout << "Could not write " << path << std::endl;
+		return false;
+	}
+	file << "P6\n" << width << " " << height << "\n255\n";
+	file.write((const char*)&rgb[0], rgb.size());
+	return true;
+}
+
+/**
+ * start renders until the window is closed or, with a frame count or
+ * views set (or headless), until that many frames have been rendered
+ * after loading, then reports model and frame throughput.
+ */
 void ModelLoader::start(){
-	registerCallbacks();
+	if( window ){
+		registerCallbacks();
+	}
+	if( frames == 0 ){
+		frames = views ? views : (headless ? 1 : 0);
+	}
 	std::chrono::time_point<std::chrono::system_clock> t0 = std::chrono::system_clock::now();
+	std::chrono::time_point<std::chrono::system_clock> renderStart;
 	std::chrono::duration<float> t;
-	while( !glfwWindowShouldClose(window) ){
+	float nextReport = 1.0f;
+	bool loaded = false;
+	int rendered = 0;
+	while( headless || !glfwWindowShouldClose(window) ){
 		t = std::chrono::system_clock::now() - t0;
+		fitEntities();
+		if( !loaded && allFitted() ){
+			// Everything is uploaded: frames from here on are counted
+			renderStart = std::chrono::system_clock::now();
+			std::chrono::duration<float> loadTime = renderStart - loadStart;
+			std::cout << "Loaded " << models.size() << " models in " << loadTime.count() << " s ("
+				<< models.size() / loadTime.count() << " models/s)" << std::endl;
+			loaded = true;
+		}
 		graphics.renderFrame(t.count());
+		if( loaded ){
+			if( !framePrefix.empty() ){
+				writeFrame(rendered);
+			}
+			rendered++;
+			if( views ){
+				camera.orbit(0.0f, 2 * M_PI / views);
+			}
+			if( frames && rendered >= frames ){
+				break;
+			}
+		}
+
+		// Culling of the last frame, once a second
+		if( t.count() >= nextReport ){
+			CullStats stats = graphics.getCullStats();
+			std::cout << "Culling: " << stats.entitiesVisible << " entities visible, " << stats.entitiesCulled << " culled; "
+				<< stats.shapesVisible << " shapes visible, " << stats.shapesCulled << " culled" << std::endl;
+			printFrameStats();
+			if( graphics.isOcclusionCulling() ){
+				OcclusionStats occlusion = graphics.getOcclusionStats();
+				std::cout << "Occlusion: " << occlusion.shapesOccluded << " of " << occlusion.shapesTested << " shapes tested occluded, "
+					<< occlusion.entitiesOccluded << " entities; " << occlusion.trianglesOccluded << " of "
+					<< occlusion.trianglesDrawn + occlusion.trianglesOccluded << " triangles skipped; GPU "
+					<< occlusion.drawMs << " ms drawing, " << occlusion.queryMs << " ms in queries, about "
+					<< occlusion.savedMs << " ms saved" << std::endl;
+			}
+			nextReport = t.count() + 1.0f;
+		}
+	}
+	if( rendered ){
+		// Frames are only flushed; wait for the last to be drawn
+		graphics.finish();
+		std::chrono::duration<float> renderTime = std::chrono::system_clock::now() - renderStart;
+		std::cout << "Rendered " << rendered << " frames in " << renderTime.count() << " s ("
+			<< rendered / renderTime.count() << " frames/s)" << std::endl;
+		printFrameStats();
 	}
-	glfwDestroyWindow(window);
-    glfwTerminate();
+	unloadModels();
+	graphics.destroyWindow();
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
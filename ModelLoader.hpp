@@ -1,4 +1,6 @@
 #include <vector>
+#include <string>
+#include <chrono>
 
 #include "Entity.hpp"
 #include "Model.hpp"
@@ -18,17 +20,28 @@ class ModelLoader{
 	static bool rightMouseDown;
 	static bool debug;
 	static bool character;
+	static bool compressed;
+	static bool headless;
+	static int frames, views;
+	static std::string framePrefix;
 	static double xprev, yprev;
 	static int nextShaderMode;
 	static int nextLightingMode;
 	
 	// Data
 	std::vector<Entity> entities;
-	std::vector<Model> models;
+	std::vector<Model*> models;
+	std::vector<bool> fitted;
+	std::chrono::time_point<std::chrono::system_clock> loadStart;
 	float xmax, ymax, zmax;
 	float xmin, ymin, zmin;
 
 	void loadModel(std::string path);
+	void unloadModels();
+	void fitEntities();
+	bool allFitted();
+	bool writeFrame(int frame);
+	void printFrameStats();
 	void registerCallbacks();
 	static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 	static void click_callback(GLFWwindow *window, int button, int action, int mods);
@@ -37,10 +50,19 @@ class ModelLoader{
 public:
 	// Loading models
 	ModelLoader();
+	~ModelLoader();
 	void initialise(std::vector<std::string> paths);
 	void start();
 
 	static void setCharacter(bool c);
+	static void setIndirect(bool i);
+	static void setOcclusion(bool o);
+	static bool setFrameLog(std::string path);
+	static void setCompressed(bool c);
+	static void setHeadless(bool h);
+	static void setFrames(int f);
+	static void setViews(int v);
+	static void setFramePrefix(std::string prefix);
 	// Camera controls
 	void initCamera();
 };
\ No newline at end of file
@@ -0,0 +1,359 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <GL/glew.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Follows the attribute locations of Model
+#define POSITION_ATTRIB 0
+
+// Boxes are grown by this fraction of the model's radius, so flat shapes
+// still cover pixels
+#define OCCLUSION_BOX_PADDING 0.01f
+
+// Shapes found visible are tested again every this many frames, in turn
+#define OCCLUSION_RETEST_FRAMES 4
+
+// Timestamps taken around the passes of a frame
+#define TIMESTAMP_START 0
+#define TIMESTAMP_DRAWN 1
+#define TIMESTAMP_TESTED 2
+#define TIMESTAMP_END 3
+
+OcclusionCuller::OcclusionCuller(){
+	boxVAO = boxVertexBuffer = boxIndexBuffer = 0;
+	for( int i=0; i<OCCLUSION_QUERY_FRAMES; i++ ){
+		timed[i] = 0;
+	}
+	frame = 0;
+}
+
+/**
+ * initialise creates the unit cube boxes are drawn with, and the timer
+ * queries. Must be called on the GL thread. The culler stays disabled if
+ * the box program failed to compile.
+ */
+void OcclusionCuller::initialise(const ShaderProgram &boxShader){
+	this->boxShader = boxShader;
+	if( boxShader.getPID() == 0 ){
+		return;
+	}
+
+	float corners[] = {
+		0.0f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f,  1.0f, 1.0f, 0.0f,
+		0.0f, 0.0f, 1.0f,  1.0f, 0.0f, 1.0f,  0.0f, 1.0f, 1.0f,  1.0f, 1.0f, 1.0f
+	};
+	unsigned char faces[] = {
+		0, 2, 1,  1, 2, 3,  4, 5, 6,  5, 7, 6,
+		0, 1, 4,  1, 5, 4,  2, 6, 3,  3, 6, 7,
+		0, 4, 2,  2, 4, 6,  1, 3, 5,  3, 7, 5
+	};
+	glGenVertexArrays(1, &boxVAO);
+	glBindVertexArray(boxVAO);
+	glGenBuffers(1, &boxVertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, boxVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(POSITION_ATTRIB);
+	glVertexAttribPointer(POSITION_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	glGenBuffers(1, &boxIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenQueries(OCCLUSION_QUERY_FRAMES * 4, &timestamps[0][0]);
+}
+
+bool OcclusionCuller::isEnabled(){
+	return boxVAO != 0;
+}
+
+/**
+ * render draws every entity with the given program, in the three passes
+ * described in the header.
+ * @param entities Entities to draw
+ * @param camera Camera the entities are seen by, and levels of detail chosen for
+ * @param frustum World-space view frustum entities and shapes are culled against
+ * @param shader Program the entities are drawn with
+ * @param stats Visible and culled counts, added to
+ */
+void OcclusionCuller::render(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, const ShaderProgram &shader, CullStats &stats){
+	frame++;
+	readTimestamps();
+	occlusionStats.shapesTested = 0;
+	occlusionStats.shapesOccluded = 0;
+	occlusionStats.entitiesOccluded = 0;
+	occlusionStats.trianglesDrawn = 0;
+	occlusionStats.trianglesOccluded = 0;
+
+	for( size_t i=entities.size(); i<records.size(); i++ ){
+		if( !records[i].queries.empty() ){
+			glDeleteQueries(records[i].queries.size(), &records[i].queries[0]);
+		}
+	}
+	records.resize(entities.size());
+
+	glm::mat4 projection = camera.getProjection();
+	glm::mat4 view = camera.getView();
+
+	// Shapes in view and visible by their latest results
+	timestamp(TIMESTAMP_START);
+	for( size_t i=0; i<entities.size(); i++ ){
+		Entity &entity = entities[i];
+		Model *model = entity.getModel();
+		Record &record = records[i];
+		model->resetVisibility();
+		int visible = model->cull(frustum, entity.getTransform());
+		stats.add(model->getShapeCount(), visible);
+		sync(record, model);
+		readResults(record);
+		size_t shapes = record.inFrustum.size();
+		std::copy(model->shapeVisible.begin(), model->shapeVisible.begin() + shapes, record.inFrustum.begin());
+		if( visible == 0 ){
+			std::fill(record.tested.begin(), record.tested.end(), 0);
+			continue;
+		}
+		entity.setLevel(model->selectLevel(entity.getTransform(), camera, entity.getLevel()));
+
+		glm::mat4 transform = projection * view * entity.getTransform();
+		bool drawn = false;
+		for( size_t s=0; s<shapes; s++ ){
+			bool testable = record.inFrustum[s] && !reachesNearPlane(transform * boxTransform(model, s));
+			if( !testable ){
+				record.occluded[s] = 0;
+			}
+			record.tested[s] = testable && (record.occluded[s] || (frame + s) % OCCLUSION_RETEST_FRAMES == 0);
+			model->shapeVisible[s] = record.inFrustum[s] && !record.occluded[s];
+			drawn |= model->shapeVisible[s] != 0;
+			occlusionStats.shapesTested += record.tested[s];
+			occlusionStats.shapesOccluded += record.inFrustum[s] && record.occluded[s];
+		}
+		countTriangles(record, entity.getLevel());
+		if( drawn ){
+			entity.render(projection, view, shader);
+		}else{
+			occlusionStats.entitiesOccluded++;
+		}
+	}
+	timestamp(TIMESTAMP_DRAWN);
+
+	drawBoxes(projection, view, entities);
+	timestamp(TIMESTAMP_TESTED);
+
+	// Shapes occluded by their latest results, if this frame's query passes
+	size_t slot = frame % OCCLUSION_QUERY_FRAMES;
+	for( size_t i=0; i<entities.size(); i++ ){
+		Entity &entity = entities[i];
+		Model *model = entity.getModel();
+		Record &record = records[i];
+		bool conditional = false;
+		model->resetVisibility();
+		model->shapeConditions.assign(record.inFrustum.size(), 0);
+		for( size_t s=0; s<record.inFrustum.size(); s++ ){
+			if( record.tested[s] && record.occluded[s] ){
+				model->shapeVisible[s] = 1;
+				model->shapeConditions[s] = record.queries[s * OCCLUSION_QUERY_FRAMES + slot];
+				conditional = true;
+			}
+		}
+		if( conditional ){
+			entity.render(projection, view, shader);
+		}
+		model->shapeConditions.clear();
+	}
+	timestamp(TIMESTAMP_END);
+
+	if( occlusionStats.trianglesDrawn > 0 ){
+		float perTriangle = occlusionStats.drawMs / occlusionStats.trianglesDrawn;
+		occlusionStats.savedMs = perTriangle * occlusionStats.trianglesOccluded - occlusionStats.queryMs;
+	}
+}
+
+OcclusionStats OcclusionCuller::getStats(){
+	return occlusionStats;
+}
+
+/**
+ * sync points a record at the entity's model, replacing its queries if
+ * the model has changed, and adds queries for shapes that have loaded.
+ */
+void OcclusionCuller::sync(Record &record, Model *model){
+	if( record.model != model ){
+		if( !record.queries.empty() ){
+			glDeleteQueries(record.queries.size(), &record.queries[0]);
+		}
+		record = Record();
+		record.model = model;
+	}
+	size_t shapes = model->shapes.size();
+	size_t queries = shapes * OCCLUSION_QUERY_FRAMES;
+	if( record.queries.size() < queries ){
+		size_t first = record.queries.size();
+		record.queries.resize(queries);
+		glGenQueries(queries - first, &record.queries[first]);
+		record.issued.resize(queries, 0);
+		record.inFrustum.resize(shapes, 0);
+		record.tested.resize(shapes, 0);
+		record.occluded.resize(shapes, 0);
+	}
+}
+
+/**
+ * readResults updates each shape's occlusion from its most recent query
+ * whose result is available, without waiting for any. That query and
+ * older ones of the shape are then discarded.
+ */
+void OcclusionCuller::readResults(Record &record){
+	for( size_t s=0; s<record.occluded.size(); s++ ){
+		for( unsigned long age=1; age<OCCLUSION_QUERY_FRAMES && age<frame; age++ ){
+			size_t query = s * OCCLUSION_QUERY_FRAMES + (frame - age) % OCCLUSION_QUERY_FRAMES;
+			if( record.issued[query] != frame - age ){
+				continue;
+			}
+			unsigned int available = 0;
+			glGetQueryObjectuiv(record.queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+			if( !available ){
+				continue;
+			}
+			unsigned int passed = 0;
+			glGetQueryObjectuiv(record.queries[query], GL_QUERY_RESULT, &passed);
+			record.occluded[s] = passed == 0;
+			// Newer queries still pending are kept for the next frames
+			for( int i=0; i<OCCLUSION_QUERY_FRAMES; i++ ){
+				unsigned long &issued = record.issued[s * OCCLUSION_QUERY_FRAMES + i];
+				if( issued <= frame - age ){
+					issued = 0;
+				}
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * readTimestamps takes the pass times of the most recent frame whose
+ * timestamps are available, without waiting for any.
+ */
+void OcclusionCuller::readTimestamps(){
+	if( !isEnabled() ){
+		return;
+	}
+	for( unsigned long age=1; age<OCCLUSION_QUERY_FRAMES && age<frame; age++ ){
+		size_t slot = (frame - age) % OCCLUSION_QUERY_FRAMES;
+		if( timed[slot] != frame - age ){
+			continue;
+		}
+		unsigned int available = 0;
+		glGetQueryObjectuiv(timestamps[slot][TIMESTAMP_END], GL_QUERY_RESULT_AVAILABLE, &available);
+		if( !available ){
+			continue;
+		}
+		GLuint64 t[4];
+		for( int i=0; i<4; i++ ){
+			glGetQueryObjectui64v(timestamps[slot][i], GL_QUERY_RESULT, &t[i]);
+		}
+		occlusionStats.drawMs = ((t[TIMESTAMP_DRAWN] - t[TIMESTAMP_START]) + (t[TIMESTAMP_END] - t[TIMESTAMP_TESTED])) / 1.0e6f;
+		occlusionStats.queryMs = (t[TIMESTAMP_TESTED] - t[TIMESTAMP_DRAWN]) / 1.0e6f;
+		for( int i=0; i<OCCLUSION_QUERY_FRAMES; i++ ){
+			timed[i] = 0;
+		}
+		break;
+	}
+}
+
+void OcclusionCuller::timestamp(int pass){
+	size_t slot = frame % OCCLUSION_QUERY_FRAMES;
+	glQueryCounter(timestamps[slot][pass], GL_TIMESTAMP);
+	if( pass == TIMESTAMP_END ){
+		timed[slot] = frame;
+	}
+}
+
+/**
+ * boxTransform maps the unit cube onto a shape's padded bounding box, in
+ * model space.
+ */
+glm::mat4 OcclusionCuller::boxTransform(Model *model, size_t shape){
+	glm::vec3 padding(OCCLUSION_BOX_PADDING * model->radius);
+	glm::vec3 lower = model->shapeLower[shape] - padding;
+	glm::vec3 upper = model->shapeUpper[shape] + padding;
+	return glm::scale(glm::translate(glm::mat4(), lower), upper - lower);
+}
+
+/**
+ * reachesNearPlane tells whether any corner of a box, given by the clip
+ * space transform of the unit cube, is in front of the near plane. Such a
+ * box would be clipped, and could fail its query while visible.
+ */
+bool OcclusionCuller::reachesNearPlane(const glm::mat4 &boxTransform){
+	for( int i=0; i<8; i++ ){
+		glm::vec4 corner = boxTransform * glm::vec4(i & 1, (i >> 1) & 1, (i >> 2) & 1, 1.0f);
+		if( corner.z < -corner.w ){
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * countTriangles adds the triangles of the shapes in view at a level of
+ * detail to the drawn or occluded count.
+ */
+void OcclusionCuller::countTriangles(Record &record, int level){
+	Model *model = record.model;
+	level = std::max(0, std::min(level, LOD_LEVELS - 1));
+	for( size_t i=model->levelFirst[level]; i<model->levelFirst[level + 1]; i++ ){
+		const Model::DrawRange &range = model->drawRanges[i];
+		if( range.shape >= record.inFrustum.size() || !record.inFrustum[range.shape] ){
+			continue;
+		}
+		if( record.occluded[range.shape] ){
+			occlusionStats.trianglesOccluded += range.count / 3;
+		}else{
+			occlusionStats.trianglesDrawn += range.count / 3;
+		}
+	}
+}
+
+/**
+ * drawBoxes draws the box of every shape tested this frame in a query,
+ * against the depth the entities have drawn, leaving colour and depth
+ * unchanged.
+ */
+void OcclusionCuller::drawBoxes(const glm::mat4 &projection, const glm::mat4 &view, std::vector<Entity> &entities){
+	glUseProgram(boxShader.getPID());
+	if( !boxShader.hasBlock(BLOCK_CAMERA) ){
+		glUniformMatrix4fv(boxShader.uniform(UNIFORM_PROJECTION_MATRIX), 1, GL_FALSE, glm::value_ptr(projection));
+	}
+	int polygonMode[2];
+	glGetIntegerv(GL_POLYGON_MODE, polygonMode);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glBindVertexArray(boxVAO);
+
+	size_t slot = frame % OCCLUSION_QUERY_FRAMES;
+	for( size_t i=0; i<entities.size(); i++ ){
+		Record &record = records[i];
+		glm::mat4 modelview = view * entities[i].getTransform();
+		for( size_t s=0; s<record.tested.size(); s++ ){
+			if( !record.tested[s] ){
+				continue;
+			}
+			size_t query = s * OCCLUSION_QUERY_FRAMES + slot;
+			glm::mat4 boxModelview = modelview * boxTransform(record.model, s);
+			glUniformMatrix4fv(boxShader.uniform(UNIFORM_MODELVIEW_MATRIX), 1, GL_FALSE, glm::value_ptr(boxModelview));
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, record.queries[query]);
+			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, 0);
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+			record.issued[query] = frame;
+		}
+	}
+
+	glBindVertexArray(0);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glPolygonMode(GL_FRONT_AND_BACK, polygonMode[0]);
+}
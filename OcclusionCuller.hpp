@@ -0,0 +1,99 @@
+#ifndef OCCLUSION_CULLER_HPP
+#define OCCLUSION_CULLER_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Entity.hpp"
+#include "ShaderProgram.hpp"
+#include "Frustum.hpp"
+#include "Camera.hpp"
+
+// Frames a query may take to return before its slot is reused
+#define OCCLUSION_QUERY_FRAMES 3
+
+// Occlusion of the shapes in view, as of the latest query results
+struct OcclusionStats{
+	int shapesTested;
+	int shapesOccluded;
+	int entitiesOccluded;
+	size_t trianglesDrawn;
+	size_t trianglesOccluded;
+
+	// GPU time of drawing the entities and of the box queries, and the
+	// time the occluded triangles would have taken at the rate drawn ones
+	// did, less that of the queries
+	float drawMs;
+	float queryMs;
+	float savedMs;
+
+	OcclusionStats() : shapesTested(0), shapesOccluded(0), entitiesOccluded(0), trianglesDrawn(0), trianglesOccluded(0),
+		drawMs(0.0f), queryMs(0.0f), savedMs(0.0f) {}
+};
+
+/**
+ * The OcclusionCuller class draws entities with the shapes hidden behind
+ * others skipped, using GL_ANY_SAMPLES_PASSED queries on the bounding box
+ * of every shape in view. Each frame:
+ * 		shapes visible by their latest query result are drawn, filling the
+ * 			depth buffer with the likely occluders
+ * 		the box of every shape in view is drawn, without writing colour or
+ * 			depth, in a query
+ * 		shapes occluded by their latest result are drawn conditionally on
+ * 			this frame's query, so one that comes into view is not missed
+ * Results are read back only once available, typically a frame late, so
+ * the CPU never waits on the GPU; the GPU waits on its own queries.
+ * Occluded shapes are tested every frame, visible ones only every few
+ * frames, staggered. Shapes whose box reaches the near plane are always
+ * drawn, untested.
+ * The box program declares:
+ * 		layout(location = 0) in vec3 a_vertex;  // unit cube
+ * 		uniform mat4 modelview_matrix;
+ * along with the Camera uniform block (or projection_matrix), and need
+ * not write any colour.
+ * Draws entities one at a time, so is used in place of the per-entity
+ * path of Graphics, with programs that are not instanced.
+ */
+class OcclusionCuller{
+public:
+	OcclusionCuller();
+	void initialise(const ShaderProgram &boxShader);
+	bool isEnabled();
+	void render(std::vector<Entity> &entities, Camera &camera, const Frustum &frustum, const ShaderProgram &shader, CullStats &stats);
+	OcclusionStats getStats();
+private:
+	// Queries of the shapes of one entity, OCCLUSION_QUERY_FRAMES per
+	// shape, and the state of each shape this frame
+	struct Record{
+		Model *model;
+		std::vector<unsigned int> queries;
+		std::vector<unsigned long> issued;
+		std::vector<unsigned char> inFrustum;
+		std::vector<unsigned char> tested;
+		std::vector<unsigned char> occluded;
+
+		Record() : model(NULL) {}
+	};
+	std::vector<Record> records;
+
+	ShaderProgram boxShader;
+	unsigned int boxVAO, boxVertexBuffer, boxIndexBuffer;
+
+	// GPU timestamps around the passes of each of the last frames
+	unsigned int timestamps[OCCLUSION_QUERY_FRAMES][4];
+	unsigned long timed[OCCLUSION_QUERY_FRAMES];
+
+	unsigned long frame;
+	OcclusionStats occlusionStats;
+
+	void sync(Record &record, Model *model);
+	void readResults(Record &record);
+	void readTimestamps();
+	bool reachesNearPlane(const glm::mat4 &boxTransform);
+	glm::mat4 boxTransform(Model *model, size_t shape);
+	void countTriangles(Record &record, int level);
+	void drawBoxes(const glm::mat4 &projection, const glm::mat4 &view, std::vector<Entity> &entities);
+	void timestamp(int pass);
+};
+
+#endif
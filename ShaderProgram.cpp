@@ -0,0 +1,133 @@
+#include "ShaderProgram.hpp"
+
+#include <GL/glew.h>
+
+// GLSL names of the shader_uniform handles, in enum order
+static const char *uniformNames[N_UNIFORMS] = {
+	"view_matrix",
+	"modelview_matrix",
+	"normal_matrix",
+	"projection_matrix",
+	"ambient",
+	"diffuse",
+	"specular",
+	"shininess",
+	"diffmap",
+	"light_position",
+	"light_ambient",
+	"light_diffuse",
+	"light_specular",
+	"position_scale",
+	"position_offset",
+	"octahedral_normals"
+};
+
+// GLSL names of the shader_block uniform blocks, in enum order
+static const char *blockNames[N_BLOCKS] = {
+	"Camera",
+	"Lights",
+	"Draw"
+};
+
+ShaderProgram::ShaderProgram(unsigned int PID){
+	this->PID = PID;
+	for( int i=0; i<N_UNIFORMS; i++ ){
+		uniformHandles[i] = -1;
+	}
+	for( int i=0; i<N_BLOCKS; i++ ){
+		blockIndices[i] = -1;
+	}
+	instanced = false;
+	if( PID != 0 ){
+		reflect();
+	}
+}
+
+/**
+ * reflect queries the active uniforms and attributes of the program
+ * and resolves the shader_uniform handles, then binds the shader_block
+ * uniform blocks the program declares and notes whether it is instanced.
+ * Array variables are reported by GL as "name[0]"; they are stored under
+ * both that name and the plain name.
+ */
+void ShaderProgram::reflect(){
+	GLint count, maxLength;
+	std::vector<char> buffer;
+
+	glGetProgramiv(PID, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(PID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	buffer.resize(maxLength + 1);
+	for( int i=0; i<count; i++ ){
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		glGetActiveUniform(PID, i, buffer.size(), &length, &size, &type, &buffer[0]);
+
+		Variable uniform;
+		uniform.name = std::string(&buffer[0], length);
+		uniform.location = glGetUniformLocation(PID, uniform.name.c_str());
+		uniform.type = type;
+		uniform.size = size;
+		uniforms.push_back(uniform);
+
+		uniformLocations[uniform.name] = uniform.location;
+		size_t bracket = uniform.name.find("[0]");
+		if( bracket != std::string::npos ){
+			uniformLocations[uniform.name.substr(0, bracket)] = uniform.location;
+		}
+	}
+
+	glGetProgramiv(PID, GL_ACTIVE_ATTRIBUTES, &count);
+	glGetProgramiv(PID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	buffer.resize(maxLength + 1);
+	for( int i=0; i<count; i++ ){
+		GLsizei length;
+		GLint size;
+		GLenum type;
+		glGetActiveAttrib(PID, i, buffer.size(), &length, &size, &type, &buffer[0]);
+
+		Variable attribute;
+		attribute.name = std::string(&buffer[0], length);
+		attribute.location = glGetAttribLocation(PID, attribute.name.c_str());
+		attribute.type = type;
+		attribute.size = size;
+		attributes.push_back(attribute);
+
+		attribLocations[attribute.name] = attribute.location;
+	}
+
+	for( int i=0; i<N_UNIFORMS; i++ ){
+		uniformHandles[i] = uniformLocation(uniformNames[i]);
+	}
+	instanced = attribLocation("instance_modelview") >= 0;
+
+	for( int i=0; i<N_BLOCKS; i++ ){
+		GLuint index = glGetUniformBlockIndex(PID, blockNames[i]);
+		if( index != GL_INVALID_INDEX ){
+			glUniformBlockBinding(PID, index, i);
+			blockIndices[i] = index;
+		}
+	}
+}
+
+unsigned int ShaderProgram::getPID() const{
+	return PID;
+}
+
+int ShaderProgram::uniformLocation(const std::string &name) const{
+	std::map<std::string, int>::const_iterator it = uniformLocations.find(name);
+	return (it != uniformLocations.end()) ? it->second : -1;
+}
+
+int ShaderProgram::attribLocation(const std::string &name) const{
+	std::map<std::string, int>::const_iterator it = attribLocations.find(name);
+	return (it != attribLocations.end()) ? it->second : -1;
+}
+
+const std::vector<ShaderProgram::Variable> &ShaderProgram::getUniforms() const{
+	return uniforms;
+}
+
+const std::vector<ShaderProgram::Variable> &ShaderProgram::getAttributes() const{
+	return attributes;
+}
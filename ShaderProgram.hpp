@@ -0,0 +1,116 @@
+#ifndef SHADER_PROGRAM_HPP
+#define SHADER_PROGRAM_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// Uniforms used by the renderer, with handles resolved once per program
+enum shader_uniform{
+	UNIFORM_VIEW_MATRIX,
+	UNIFORM_MODELVIEW_MATRIX,
+	UNIFORM_NORMAL_MATRIX,
+	UNIFORM_PROJECTION_MATRIX,
+	UNIFORM_AMBIENT,
+	UNIFORM_DIFFUSE,
+	UNIFORM_SPECULAR,
+	UNIFORM_SHININESS,
+	UNIFORM_DIFFMAP,
+	UNIFORM_LIGHT_POSITION,
+	UNIFORM_LIGHT_AMBIENT,
+	UNIFORM_LIGHT_DIFFUSE,
+	UNIFORM_LIGHT_SPECULAR,
+	UNIFORM_POSITION_SCALE,
+	UNIFORM_POSITION_OFFSET,
+	UNIFORM_OCTAHEDRAL_NORMALS,
+	N_UNIFORMS
+};
+
+/**
+ * Uniform blocks shared by all programs. The value of each is also its
+ * binding point, so one buffer per block serves every program.
+ * Programs declare them with the std140 layout:
+ * 		layout(std140) uniform Camera{
+ * 			mat4 view_matrix;
+ * 			mat4 projection_matrix;
+ * 		};
+ * 		layout(std140) uniform Lights{
+ * 			vec4 light_position;
+ * 			vec3 light_ambient;
+ * 			vec3 light_diffuse;
+ * 			vec3 light_specular;
+ * 		};
+ * The Draw block holds the per-draw uniforms of Model, written to the
+ * DynamicRing and bound as a range for each draw:
+ * 		layout(std140) uniform Draw{
+ * 			mat4 modelview_matrix;
+ * 			mat3 normal_matrix;
+ * 			vec3 ambient;
+ * 			vec3 diffuse;
+ * 			vec3 specular;
+ * 			float shininess;
+ * 			vec3 position_scale;
+ * 			vec3 position_offset;
+ * 			bool octahedral_normals;
+ * 		};
+ */
+enum shader_block{
+	BLOCK_CAMERA,
+	BLOCK_LIGHTS,
+	BLOCK_DRAW,
+	N_BLOCKS
+};
+
+/**
+ * The ShaderProgram class wraps a linked shader program.
+ * On construction it reflects the program's active uniforms and attributes
+ * once, so looking up a location never goes to the driver:
+ * 		uniform() returns the precomputed handle of a shader_uniform
+ * 		uniformLocation() and attribLocation() look up any other active name
+ * Locations of names that are not active in the program are -1, which
+ * glUniform* calls silently ignore.
+ * Any shader_block the program declares is bound to its binding point;
+ * hasBlock() tells whether the program reads the block or still expects
+ * the plain uniforms.
+ * A program that declares the per-instance modelview attribute
+ * 		layout(location = 4) in mat4 instance_modelview;
+ * in place of the modelview_matrix and normal_matrix uniforms is instanced:
+ * Graphics draws all entities of a model with one instanced draw per range.
+ * Its normal matrix is mat3(instance_modelview), as for the uniform.
+ */
+class ShaderProgram{
+public:
+	// An active uniform or attribute
+	struct Variable{
+		std::string name;
+		int location;
+		unsigned int type;
+		int size;
+	};
+
+	ShaderProgram(unsigned int PID = 0);
+
+	unsigned int getPID() const;
+	int uniform(shader_uniform name) const { return uniformHandles[name]; }
+	int uniformLocation(const std::string &name) const;
+	int attribLocation(const std::string &name) const;
+	bool hasBlock(shader_block block) const { return blockIndices[block] >= 0; }
+	bool isInstanced() const { return instanced; }
+
+	const std::vector<Variable> &getUniforms() const;
+	const std::vector<Variable> &getAttributes() const;
+private:
+	unsigned int PID;
+
+	std::vector<Variable> uniforms;
+	std::vector<Variable> attributes;
+	std::map<std::string, int> uniformLocations;
+	std::map<std::string, int> attribLocations;
+	int uniformHandles[N_UNIFORMS];
+	int blockIndices[N_BLOCKS];
+	bool instanced;
+
+	void reflect();
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "ShapeStream.hpp"
+
+#include <algorithm>
+#include <stddef.h>
+
+#define VALS_PER_VERT 3
+
+/**
+ * prepare splits the mesh's faces, and those of its levels of detail, by
+ * material, optimises them for the vertex cache and fetch order, appends
+ * the levels' indices and interleaves (or compresses) the vertices in the
+ * layout shared by all shapes. The mesh's indices and vertices are
+ * reordered to match, and its levels of detail are moved into the stream.
+ */
+void ShapeStream::prepare(tinyobj::mesh_t &mesh, bool compressed){
+	splitLevels(mesh, *this);
+	optimiseMesh(mesh, submeshes, cacheBefore, cacheAfter);
+	appendLevels(mesh, *this);
+	if( compressed ){
+		tinyobj::CompressMesh(mesh, compact, compression);
+		layout.stride = sizeof(tinyobj::compact_vertex_t);
+		layout.position_offset = offsetof(tinyobj::compact_vertex_t, position);
+		layout.normal_offset = offsetof(tinyobj::compact_vertex_t, normal);
+		layout.texcoord_offset = offsetof(tinyobj::compact_vertex_t, texcoord);
+	}else{
+		tinyobj::InterleaveMesh(mesh, vertices, layout, true);
+	}
+	if( mesh.positions.size() / VALS_PER_VERT < 65536 ){
+		shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+		shortIndices.insert(shortIndices.end(), lodIndices.begin(), lodIndices.end());
+	}
+}
+
+/**
+ * splitByMaterial reorders the faces of a mesh so that the faces of each
+ * material are contiguous, keeping their order within a material, and
+ * lists the index range of each material (in material order) in submeshes.
+ * @param mesh Mesh whose indices, num_vertices and material_ids are reordered
+ * @param submeshes Output, one per material used by the mesh
+ */
+void ShapeStream::splitByMaterial(tinyobj::mesh_t &mesh, std::vector<SubMesh> &submeshes){
+	submeshes.clear();
+	size_t numFaces = mesh.material_ids.size();
+	if( numFaces == 0 ){
+		return;
+	}
+
+	// Most shapes use a single material and are left as they are
+	int lowest = mesh.material_ids[0];
+	int highest = mesh.material_ids[0];
+	for( int f=1; f<numFaces; f++ ){
+		lowest = std::min(lowest, mesh.material_ids[f]);
+		highest = std::max(highest, mesh.material_ids[f]);
+	}
+	if( lowest == highest ){
+		SubMesh submesh = {lowest, 0, (unsigned int)mesh.indices.size(), 0};
+		submeshes.push_back(submesh);
+		return;
+	}
+
+	// Count the faces and indices of each material, then turn the counts
+	// into the position of each material's first face and index
+	std::vector<size_t> faceStart(highest - lowest + 1, 0);
+	std::vector<unsigned int> indexStart(highest - lowest + 1, 0);
+	for( int f=0; f<numFaces; f++ ){
+		faceStart[mesh.material_ids[f] - lowest]++;
+		indexStart[mesh.material_ids[f] - lowest] += mesh.num_vertices[f];
+	}
+	size_t face = 0;
+	unsigned int index = 0;
+	for( int m=0; m<faceStart.size(); m++ ){
+		if( faceStart[m] > 0 ){
+			SubMesh submesh = {lowest + m, index, indexStart[m], 0};
+			submeshes.push_back(submesh);
+		}
+		size_t faces = faceStart[m];
+		unsigned int indices = indexStart[m];
+		faceStart[m] = face;
+		indexStart[m] = index;
+		face += faces;
+		index += indices;
+	}
+
+	// Scatter each face to its material's range
+	std::vector<unsigned int> indices(mesh.indices.size());
+	std::vector<unsigned char> numVertices(numFaces);
+	std::vector<int> materialIDs(numFaces);
+	unsigned int from = 0;
+	for( int f=0; f<numFaces; f++ ){
+		int m = mesh.material_ids[f] - lowest;
+		unsigned int n = mesh.num_vertices[f];
+		std::copy(mesh.indices.begin() + from, mesh.indices.begin() + from + n, indices.begin() + indexStart[m]);
+		numVertices[faceStart[m]] = n;
+		materialIDs[faceStart[m]] = mesh.material_ids[f];
+		indexStart[m] += n;
+		faceStart[m]++;
+		from += n;
+	}
+	mesh.indices.swap(indices);
+	mesh.num_vertices.swap(numVertices);
+	mesh.material_ids.swap(materialIDs);
+}
+
+/**
+ * splitLevels splits the full mesh and each of its levels of detail by
+ * material. The submeshes of level l > 0 index mesh.lods[l - 1].indices
+ * until appendLevels moves them.
+ */
+void ShapeStream::splitLevels(tinyobj::mesh_t &mesh, ShapeStream &stream){
+	splitByMaterial(mesh, stream.submeshes);
+	for( int l=0; l<mesh.lods.size(); l++ ){
+		tinyobj::mesh_t lod;
+		lod.indices.swap(mesh.lods[l].indices);
+		lod.material_ids.swap(mesh.lods[l].material_ids);
+		lod.num_vertices.assign(lod.material_ids.size(), 3);
+		std::vector<SubMesh> submeshes;
+		splitByMaterial(lod, submeshes);
+		for( int j=0; j<submeshes.size(); j++ ){
+			submeshes[j].level = l + 1;
+			stream.submeshes.push_back(submeshes[j]);
+		}
+		mesh.lods[l].indices.swap(lod.indices);
+		mesh.lods[l].material_ids.swap(lod.material_ids);
+	}
+}
+
+/**
+ * optimiseMesh reorders the triangles of each submesh for the vertex
+ * cache, keeping them within their submesh, then renumbers the mesh's
+ * vertices in the order the reordered triangles of the full mesh use
+ * them. Meshes with faces that are not triangles are left as they are.
+ * @param mesh Mesh, split by material, whose indices and vertices are reordered
+ * @param submeshes Index ranges of the mesh's materials at each level
+ * @param before Output, cache statistics of the mesh as it was
+ * @param after Output, cache statistics of the optimised mesh
+ */
+void ShapeStream::optimiseMesh(tinyobj::mesh_t &mesh, const std::vector<SubMesh> &submeshes, MeshOptimiser::CacheStats &before, MeshOptimiser::CacheStats &after){
+	size_t vertexCount = mesh.positions.size() / VALS_PER_VERT;
+	before = MeshOptimiser::simulateCache(mesh.indices.data(), mesh.indices.size(), vertexCount);
+	after = before;
+	for( int f=0; f<mesh.num_vertices.size(); f++ ){
+		if( mesh.num_vertices[f] != 3 ){
+			return;
+		}
+	}
+	for( int i=0; i<submeshes.size(); i++ ){
+		unsigned int level = submeshes[i].level;
+		std::vector<unsigned int> &indices = (level == 0) ? mesh.indices : mesh.lods[level - 1].indices;
+		MeshOptimiser::optimiseTriangles(&indices[submeshes[i].firstIndex], submeshes[i].count, vertexCount);
+	}
+	MeshOptimiser::optimiseVertexFetch(mesh);
+	after = MeshOptimiser::simulateCache(mesh.indices.data(), mesh.indices.size(), vertexCount);
+}
+
+/**
+ * appendLevels moves the indices of the levels of detail into
+ * stream.lodIndices, to follow the full mesh's indices, and points their
+ * submeshes there. Levels the mesh lacks repeat the submeshes of its
+ * coarsest level. The mesh's error at each level goes in stream.levelErrors.
+ */
+void ShapeStream::appendLevels(tinyobj::mesh_t &mesh, ShapeStream &stream){
+	if( mesh.lods.size() >= LOD_LEVELS ){
+		mesh.lods.resize(LOD_LEVELS - 1);
+	}
+	unsigned int levelStart[LOD_LEVELS] = {0};
+	stream.levelErrors[0] = 0.0f;
+	stream.lodIndices.clear();
+	for( int l=0; l<mesh.lods.size(); l++ ){
+		levelStart[l + 1] = mesh.indices.size() + stream.lodIndices.size();
+		stream.levelErrors[l + 1] = mesh.lods[l].error;
+		stream.lodIndices.insert(stream.lodIndices.end(), mesh.lods[l].indices.begin(), mesh.lods[l].indices.end());
+	}
+	size_t count = stream.submeshes.size();
+	for( int i=0; i<count; i++ ){
+		stream.submeshes[i].firstIndex += levelStart[stream.submeshes[i].level];
+	}
+
+	unsigned int coarsest = mesh.lods.size();
+	for( unsigned int level=coarsest + 1; level<LOD_LEVELS; level++ ){
+		for( int i=0; i<count; i++ ){
+			if( stream.submeshes[i].level == coarsest ){
+				SubMesh submesh = stream.submeshes[i];
+				submesh.level = level;
+				stream.submeshes.push_back(submesh);
+			}
+		}
+		stream.levelErrors[level] = stream.levelErrors[coarsest];
+	}
+	std::vector<tinyobj::mesh_lod_t>().swap(mesh.lods);
+}
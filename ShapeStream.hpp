@@ -0,0 +1,53 @@
+#ifndef SHAPE_STREAM_HPP
+#define SHAPE_STREAM_HPP
+
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "MeshOptimiser.hpp"
+
+// Levels of detail of every shape, the full mesh first
+#define LOD_LEVELS 5
+
+/**
+ * The ShapeStream class holds a loaded shape ready for upload: its
+ * interleaved vertex stream (floats, or compact vertices if the model is
+ * compressed), indices of the coarser levels, all indices in 16 bits if it
+ * has few enough vertices, submeshes, level errors and cache statistics.
+ * prepare() makes it from a shape's mesh, as Model's loader thread does for
+ * each shape it receives. It needs no GL, so benchmarks can run the same
+ * steps.
+ */
+class ShapeStream{
+public:
+	// Faces of a shape using one material at one level of detail, as a
+	// range of its indices
+	struct SubMesh{
+		int materialID;
+		unsigned int firstIndex;
+		unsigned int count;
+		unsigned int level;
+	};
+
+	std::vector<float> vertices;
+	std::vector<tinyobj::compact_vertex_t> compact;
+	tinyobj::compression_t compression;
+	tinyobj::vertex_layout_t layout;
+	std::vector<unsigned int> lodIndices;
+	std::vector<unsigned short> shortIndices;
+	std::vector<SubMesh> submeshes;
+	float levelErrors[LOD_LEVELS];
+	MeshOptimiser::CacheStats cacheBefore, cacheAfter;
+
+	void prepare(tinyobj::mesh_t &mesh, bool compressed);
+
+	size_t bytes() const { return vertices.size() * sizeof(float) + compact.size() * sizeof(tinyobj::compact_vertex_t); }
+	const void *data() const { return compact.empty() ? (const void*)vertices.data() : (const void*)compact.data(); }
+private:
+	static void splitByMaterial(tinyobj::mesh_t &mesh, std::vector<SubMesh> &submeshes);
+	static void splitLevels(tinyobj::mesh_t &mesh, ShapeStream &stream);
+	static void optimiseMesh(tinyobj::mesh_t &mesh, const std::vector<SubMesh> &submeshes, MeshOptimiser::CacheStats &before, MeshOptimiser::CacheStats &after);
+	static void appendLevels(tinyobj::mesh_t &mesh, ShapeStream &stream);
+};
+
+#endif
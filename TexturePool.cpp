@@ -0,0 +1,138 @@
+#include "TexturePool.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "stb_image.h"
+
+TexturePool::DecodeQueue::DecodeQueue(){
+	outstanding = 0;
+}
+
+/**
+ * Waits for any decodes still in flight, as they hold a pointer to
+ * this queue, then frees the images that were never taken.
+ */
+TexturePool::DecodeQueue::~DecodeQueue(){
+	std::unique_lock<std::mutex> lock(mutex);
+	while( outstanding > 0 ){
+		finished.wait(lock);
+	}
+	for( int i=0; i<decoded.size(); i++ ){
+		release(decoded[i]);
+	}
+}
+
+void TexturePool::DecodeQueue::push(const Image &image){
+	std::lock_guard<std::mutex> lock(mutex);
+	decoded.push_back(image);
+	outstanding--;
+	finished.notify_all();
+}
+
+/**
+ * take moves the images decoded since the last call into images.
+ * The caller owns their pixels and frees them with release().
+ */
+void TexturePool::DecodeQueue::take(std::vector<Image> &images){
+	std::lock_guard<std::mutex> lock(mutex);
+	images.insert(images.end(), decoded.begin(), decoded.end());
+	decoded.clear();
+}
+
+// True if every requested image has been decoded and taken
+bool TexturePool::DecodeQueue::idle(){
+	std::lock_guard<std::mutex> lock(mutex);
+	return outstanding == 0 && decoded.empty();
+}
+
+/**
+ * TexturePool constructor starts numThreads workers,
+ * or one per hardware thread if numThreads is 0.
+ */
+TexturePool::TexturePool(unsigned int numThreads){
+	stopping = false;
+	if( numThreads == 0 ){
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for( int i=0; i<numThreads; i++ ){
+		workers.push_back(std::thread(&TexturePool::work, this));
+	}
+}
+
+TexturePool::~TexturePool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAdded.notify_all();
+	for( int i=0; i<workers.size(); i++ ){
+		workers[i].join();
+	}
+}
+
+// The pool shared by all models
+TexturePool &TexturePool::shared(){
+	static TexturePool pool;
+	return pool;
+}
+
+/**
+ * decode queues the image file at path for decoding into RGB.
+ * The result is delivered to queue, tagged with texID and texUnit.
+ */
+void TexturePool::decode(DecodeQueue &queue, std::string path, unsigned int texID, unsigned int texUnit){
+	Job job;
+	job.queue = &queue;
+	job.image.texID = texID;
+	job.image.texUnit = texUnit;
+	job.image.path = path;
+	job.image.width = 0;
+	job.image.height = 0;
+	job.image.data = NULL;
+	job.image.decodeMs = 0.0;
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.outstanding++;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	jobAdded.notify_one();
+}
+
+void TexturePool::release(Image &image){
+	if( image.data ){
+		stbi_image_free(image.data);
+		image.data = NULL;
+	}
+}
+
+void TexturePool::work(){
+	while( true ){
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while( jobs.empty() && !stopping ){
+				jobAdded.wait(lock);
+			}
+			if( jobs.empty() ){
+				return;
+			}
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		int n;
+		job.image.data = stbi_load(job.image.path.c_str(), &job.image.width, &job.image.height, &n, 3);
+		std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now() - t0;
+		job.image.decodeMs = t.count();
+		if( !job.image.data ){
+			job.image.error = stbi_failure_reason();
+		}
+
+		job.queue->push(job.image);
+	}
+}
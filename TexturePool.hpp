@@ -0,0 +1,73 @@
+#ifndef TEXTURE_POOL_HPP
+#define TEXTURE_POOL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * The TexturePool class decodes texture image files on a pool of worker
+ * threads, keeping JPEG/PNG decoding off the GL thread.
+ * Decoded images are delivered to the DecodeQueue they were requested
+ * through. Its owner (e.g. a Model) takes them on the GL thread and uploads
+ * them as they complete.
+ */
+class TexturePool{
+public:
+	// A texture image to decode and, once decoded, its pixels
+	struct Image{
+		unsigned int texID;
+		unsigned int texUnit;
+		std::string path;
+
+		// Filled in by the decode, data is NULL if it failed
+		int width, height;
+		unsigned char *data;
+		std::string error;
+		double decodeMs;
+	};
+
+	// Collects the decoded images of one owner
+	class DecodeQueue{
+		friend class TexturePool;
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::vector<Image> decoded;
+		int outstanding;
+
+		void push(const Image &image);
+	public:
+		DecodeQueue();
+		~DecodeQueue();
+
+		void take(std::vector<Image> &images);
+		bool idle();
+	};
+
+	TexturePool(unsigned int numThreads = 0);
+	~TexturePool();
+
+	static TexturePool &shared();
+
+	void decode(DecodeQueue &queue, std::string path, unsigned int texID, unsigned int texUnit);
+	static void release(Image &image);
+private:
+	struct Job{
+		DecodeQueue *queue;
+		Image image;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::deque<Job> jobs;
+	bool stopping;
+
+	void work();
+};
+
+#endif
@@ -0,0 +1,276 @@
+/**
+ * bench_obj_load measures the OBJ loading pipeline without a GL context.
+ * For each OBJ file it times:
+ * 		LoadObj          - the istream loader
+ * 		LoadObjParallel  - the mapped, multi-threaded loader
+ * 		LoadObjCached    - a warm load from the binary mesh cache, with the
+ * 		                   levels of detail Model asks for
+ * 		model_cpu        - the CPU half of Model construction, from a warm
+ * 		                   cache: streaming load with LOD_LEVELS - 1 levels
+ * 		                   of detail, each shape's ShapeStream (as Model's
+ * 		                   loader thread prepares it) and the extremum
+ * 		model_cpu_cold   - model_cpu without the cache, so including parsing
+ * 		                   and level of detail generation
+ * The cache cases share the .tobjcache Model reads. With -q, shapes are
+ * prepared as a compressed Model's are. -j sets LoadObjParallel's threads,
+ * one per hardware thread by default.
+ * Each case runs once to warm up and then for the given number of iterations.
+ * Results are printed to stdout as JSON: median and p95 time, MB/s, faces/s,
+ * allocations and peak RSS per case.
+ *
+ * Build:
+ * 		g++ -O2 -std=c++11 -pthread bench_obj_load.cpp ShapeStream.cpp MeshOptimiser.cpp tiny_obj_loader.cc -o bench_obj_load
+ * Usage:
+ * 		bench_obj_load [-n iterations] [-q] [-j threads] file.obj [file.obj ...]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "tiny_obj_loader.h"
+#include "ShapeStream.hpp"
+
+// Model's vertex format, -q for compact vertices
+static bool compressed = false;
+
+// Threads for LoadObjParallel, 0 for one per hardware thread
+static unsigned int threads = 0;
+
+// Allocation counting
+static std::atomic<unsigned long long> allocations(0);
+
+void *operator new(size_t size){
+	allocations++;
+	void *p = malloc(size ? size : 1);
+	if( !p ){
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void *operator new[](size_t size){
+	return operator new(size);
+}
+
+void operator delete(void *p) noexcept{
+	free(p);
+}
+
+void operator delete[](void *p) noexcept{
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept{
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept{
+	free(p);
+}
+
+/**
+ * resetPeakRSS restarts peak RSS tracking, so each case reports its own peak.
+ * Only supported on Linux; elsewhere the process-wide peak is reported.
+ */
+static void resetPeakRSS(){
+#if defined(__linux__)
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+#endif
+}
+
+// Peak resident set size in kB since the last resetPeakRSS
+static long peakRSS(){
+#if defined(__linux__)
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while( std::getline(status, line) ){
+		if( line.compare(0, 6, "VmHWM:") == 0 ){
+			return atol(line.c_str() + 6);
+		}
+	}
+#endif
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Output of a single load
+struct LoadResult{
+	bool ok;
+	size_t shapes;
+	size_t faces;
+	size_t vertices;
+};
+
+static LoadResult summarise(bool ok, const std::vector<tinyobj::shape_t> &shapes){
+	LoadResult result;
+	result.ok = ok;
+	result.shapes = shapes.size();
+	result.faces = 0;
+	result.vertices = 0;
+	for( int i=0; i<shapes.size(); i++ ){
+		result.faces += shapes[i].mesh.num_vertices.size();
+		result.vertices += shapes[i].mesh.positions.size() / 3;
+	}
+	return result;
+}
+
+static LoadResult loadObj(const std::string &path, const std::string &dir){
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string error;
+	bool ok = tinyobj::LoadObj(shapes, materials, error, path.c_str(), dir.c_str());
+	return summarise(ok, shapes);
+}
+
+static LoadResult loadObjParallel(const std::string &path, const std::string &dir){
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string error;
+	bool ok = tinyobj::LoadObjParallel(shapes, materials, error, path.c_str(), dir.c_str(), true, threads);
+	return summarise(ok, shapes);
+}
+
+static LoadResult loadObjCached(const std::string &path, const std::string &dir){
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string error;
+	bool ok = tinyobj::LoadObjCached(shapes, materials, error, path.c_str(), dir.c_str(), true, NULL, LOD_LEVELS - 1);
+	return summarise(ok, shapes);
+}
+
+/**
+ * ModelShapes does for each shape what Model's loader thread and
+ * Model::update do on the CPU: keep the shape, prepare its ShapeStream
+ * (split by material, optimise, append the levels of detail, interleave
+ * or compress, pack 16 bit indices) and grow the extremum.
+ */
+class ModelShapes : public tinyobj::ShapeConsumer{
+public:
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<ShapeStream> streams;
+	float extremum;
+
+	ModelShapes() : extremum(0.0f) {}
+	void operator()(const tinyobj::shape_t &shape, const std::vector<tinyobj::material_t> &materials){
+		shapes.push_back(shape);
+		streams.push_back(ShapeStream());
+		streams.back().prepare(shapes.back().mesh, compressed);
+		const std::vector<float> &positions = shapes.back().mesh.positions;
+		for( int j=0; j<positions.size(); j++ ){
+			extremum = std::max(extremum, std::abs(positions[j]));
+		}
+	}
+};
+
+// Loads as Model::load does, with its levels of detail and cache
+static LoadResult modelCPU(const std::string &path, const std::string &dir){
+	ModelShapes model;
+	std::vector<tinyobj::material_t> materials;
+	std::string error;
+	bool ok = tinyobj::LoadObjStreaming(model, materials, error, path.c_str(), dir.c_str(), true, NULL, LOD_LEVELS - 1);
+	return summarise(ok, model.shapes);
+}
+
+// A first load of the model: the cache is removed, so the file is parsed
+// and its levels of detail generated before the cache is written again
+static LoadResult modelCPUCold(const std::string &path, const std::string &dir){
+	remove((path + ".tobjcache").c_str());
+	return modelCPU(path, dir);
+}
+
+// Percentile p (0-100) of sorted samples, nearest rank
+static double percentile(const std::vector<double> &sorted, double p){
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+/**
+ * runCase times iterations loads of path with load (after one warm-up load)
+ * and prints the JSON object for the case.
+ */
+static void runCase(const char *name, LoadResult (*load)(const std::string &, const std::string &),
+		const std::string &path, const std::string &dir, double megabytes, int iterations, bool last){
+	load(path, dir);
+
+	std::vector<double> seconds;
+	unsigned long long allocs = 0;
+	long rss = 0;
+	LoadResult result = LoadResult();
+	for( int i=0; i<iterations; i++ ){
+		resetPeakRSS();
+		unsigned long long allocs0 = allocations;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		result = load(path, dir);
+		std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+		seconds.push_back(t.count());
+		allocs = allocations - allocs0;
+		rss = std::max(rss, peakRSS());
+	}
+	std::sort(seconds.begin(), seconds.end());
+	double median = percentile(seconds, 50);
+
+	printf("        \"%s\": {\"ok\": %s, \"shapes\": %zu, \"faces\": %zu, \"vertices\": %zu, "
+		"\"median_s\": %.6f, \"p95_s\": %.6f, \"mb_per_s\": %.2f, \"faces_per_s\": %.0f, "
+		"\"allocations\": %llu, \"peak_rss_kb\": %ld}%s\n",
+		name, result.ok ? "true" : "false", result.shapes, result.faces, result.vertices,
+		median, percentile(seconds, 95), megabytes / median, result.faces / median,
+		allocs, rss, last ? "" : ",");
+}
+
+int main(int argc, char **argv){
+	int iterations = 5;
+	std::vector<std::string> paths;
+	for( int i=1; i<argc; i++ ){
+		if( !strcmp(argv[i], "-n") && i + 1 < argc ){
+			iterations = std::max(1, atoi(argv[++i]));
+		}else if( !strcmp(argv[i], "-q") ){
+			compressed = true;
+		}else if( !strcmp(argv[i], "-j") && i + 1 < argc ){
+			threads = (unsigned int)std::max(0, atoi(argv[++i]));
+		}else{
+			paths.push_back(argv[i]);
+		}
+	}
+	if( paths.empty() ){
+		std::cerr << "Usage: bench_obj_load [-n iterations] [-q] [-j threads] file.obj [file.obj ...]" << std::endl;
+		return 1;
+	}
+
+	printf("{\n  \"iterations\": %d,\n  \"files\": [\n", iterations);
+	for( int i=0; i<paths.size(); i++ ){
+		std::string path = paths[i];
+		int pos = path.rfind("/");
+		std::string dir = (pos != std::string::npos) ? path.substr(0, pos + 1) : "";
+
+		struct stat sb;
+		double megabytes = 0.0;
+		if( stat(path.c_str(), &sb) == 0 ){
+			megabytes = sb.st_size / (1024.0 * 1024.0);
+		}
+
+		printf("    {\n      \"path\": \"%s\",\n      \"megabytes\": %.3f,\n      \"cases\": {\n", path.c_str(), megabytes);
+		runCase("LoadObj", loadObj, path, dir, megabytes, iterations, false);
+		runCase("LoadObjParallel", loadObjParallel, path, dir, megabytes, iterations, false);
+		runCase("LoadObjCached", loadObjCached, path, dir, megabytes, iterations, false);
+		runCase("model_cpu", modelCPU, path, dir, megabytes, iterations, false);
+		runCase("model_cpu_cold", modelCPUCold, path, dir, megabytes, iterations, true);
+		printf("      }\n    }%s\n", i + 1 < paths.size() ? "," : "");
+	}
+	printf("  ]\n}\n");
+	return 0;
+}
@@ -0,0 +1,263 @@
+/**
+ * bench_weld measures vertex welding, the step of exportFaces that maps
+ * each face corner (a position/texcoord/normal index triple) to a mesh
+ * vertex, in isolation from parsing. For each input it times:
+ * 		map_weld     - welding with a std::map<vertex_index, unsigned int>,
+ * 		               as the loader did before vertex_cache
+ * 		table_weld   - welding with the loader's vertex_cache
+ * 		exportFaces  - the loader's whole export of the faces into a mesh
+ * The faces of an OBJ file are welded as one group. Without files, a grid
+ * of -g quads a side is generated in memory; the default of 1300 gives
+ * 10.1M triangle corners. Both welds are checked to give the same vertices.
+ * Each case runs once to warm up and then for the given number of
+ * iterations. Results are printed to stdout as JSON: median and p95 time,
+ * corners/s and the table's speedup over the map.
+ *
+ * Build:
+ * 		g++ -O2 -std=c++11 -pthread bench_weld.cpp -o bench_weld
+ * Usage:
+ * 		bench_weld [-n iterations] [-g gridSize] [file.obj ...]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// exportFaces and vertex_cache are static to the loader, so it is compiled
+// in here rather than linked from tiny_obj_loader.cc
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+using tinyobj::vertex_index;
+
+// Faces to weld and the attributes they index
+struct WeldInput{
+	std::string name;
+	std::vector<float> positions, normals, texcoords;
+	tinyobj::face_group faces;
+};
+
+// The ordering the std::map welder used
+struct VertexIndexLess{
+	bool operator()(const vertex_index &a, const vertex_index &b) const{
+		if( a.v_idx != b.v_idx ){
+			return a.v_idx < b.v_idx;
+		}
+		if( a.vn_idx != b.vn_idx ){
+			return a.vn_idx < b.vn_idx;
+		}
+		return a.vt_idx < b.vt_idx;
+	}
+};
+
+/**
+ * readObj reads the v, vt, vn and f lines of an OBJ file, parsed as the
+ * loader parses them, into a single group.
+ */
+static bool readObj(const std::string &path, WeldInput &input){
+	std::ifstream file(path.c_str());
+	if( !file.is_open() ){
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	input.name = path;
+	std::string line;
+	while( std::getline(file, line) ){
+		const char *token = line.c_str();
+		token += strspn(token, " \t");
+		if( token[0] == 'v' && (token[1] == ' ' || token[1] == '\t') ){
+			token += 2;
+			float x, y, z;
+			tinyobj::parseFloat3(x, y, z, token);
+			input.positions.push_back(x);
+			input.positions.push_back(y);
+			input.positions.push_back(z);
+		}else if( token[0] == 'v' && token[1] == 'n' && (token[2] == ' ' || token[2] == '\t') ){
+			token += 3;
+			float x, y, z;
+			tinyobj::parseFloat3(x, y, z, token);
+			input.normals.push_back(x);
+			input.normals.push_back(y);
+			input.normals.push_back(z);
+		}else if( token[0] == 'v' && token[1] == 't' && (token[2] == ' ' || token[2] == '\t') ){
+			token += 3;
+			float u, v;
+			tinyobj::parseFloat2(u, v, token);
+			input.texcoords.push_back(u);
+			input.texcoords.push_back(v);
+		}else if( token[0] == 'f' && (token[1] == ' ' || token[1] == '\t') ){
+			token += 2;
+			token += strspn(token, " \t");
+			unsigned int npolys = 0;
+			while( !IS_NEW_LINE(token[0]) ){
+				input.faces.corners.push_back(tinyobj::parseTriple(token, (int)(input.positions.size() / 3),
+					(int)(input.normals.size() / 3), (int)(input.texcoords.size() / 2)));
+				npolys++;
+				token += strspn(token, " \t\r");
+			}
+			input.faces.sizes.push_back(npolys);
+		}
+	}
+	return true;
+}
+
+/**
+ * makeGrid builds a grid of size x size quads, each split into two
+ * triangles, sharing one index for the position, texcoord and normal of
+ * each grid point, as exporters write smooth meshes.
+ */
+static void makeGrid(int size, WeldInput &input){
+	input.name = "grid " + std::to_string(size) + "x" + std::to_string(size);
+	int points = size + 1;
+	for( int y=0; y<points; y++ ){
+		for( int x=0; x<points; x++ ){
+			input.positions.push_back((float)x / size);
+			input.positions.push_back(0.0f);
+			input.positions.push_back((float)y / size);
+			input.normals.push_back(0.0f);
+			input.normals.push_back(1.0f);
+			input.normals.push_back(0.0f);
+			input.texcoords.push_back((float)x / size);
+			input.texcoords.push_back((float)y / size);
+		}
+	}
+	for( int y=0; y<size; y++ ){
+		for( int x=0; x<size; x++ ){
+			int corners[6] = {
+				y * points + x, (y + 1) * points + x, y * points + x + 1,
+				y * points + x + 1, (y + 1) * points + x, (y + 1) * points + x + 1
+			};
+			for( int i=0; i<6; i++ ){
+				input.faces.corners.push_back(vertex_index(corners[i]));
+			}
+			input.faces.sizes.push_back(3);
+			input.faces.sizes.push_back(3);
+		}
+	}
+}
+
+// Welds the corners with a std::map, giving each corner's vertex
+static size_t mapWeld(const WeldInput &input, std::vector<unsigned int> &cornerVertex){
+	std::map<vertex_index, unsigned int, VertexIndexLess> vertices;
+	const std::vector<vertex_index> &corners = input.faces.corners;
+	cornerVertex.resize(corners.size());
+	for( size_t i=0; i<corners.size(); i++ ){
+		unsigned int next = (unsigned int)vertices.size();
+		cornerVertex[i] = vertices.insert(std::make_pair(corners[i], next)).first->second;
+	}
+	return vertices.size();
+}
+
+// Welds the corners with the loader's table, giving each corner's vertex
+static size_t tableWeld(const WeldInput &input, tinyobj::vertex_cache &cache, std::vector<unsigned int> &cornerVertex){
+	const std::vector<vertex_index> &corners = input.faces.corners;
+	cache.reset(corners.size());
+	cornerVertex.resize(corners.size());
+	unsigned int next = 0;
+	for( size_t i=0; i<corners.size(); i++ ){
+		bool found;
+		cornerVertex[i] = cache.findOrInsert(corners[i], next, found);
+		next += !found;
+	}
+	return next;
+}
+
+// Percentile p (0-100) of sorted samples, nearest rank
+static double percentile(const std::vector<double> &sorted, double p){
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+/**
+ * timeCase runs f once to warm up, then iterations times, and returns the
+ * sorted durations in seconds.
+ */
+template<typename F>
+static std::vector<double> timeCase(F f, int iterations){
+	f();
+	std::vector<double> seconds;
+	for( int i=0; i<iterations; i++ ){
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double> t = std::chrono::steady_clock::now() - t0;
+		seconds.push_back(t.count());
+	}
+	std::sort(seconds.begin(), seconds.end());
+	return seconds;
+}
+
+static void printCase(const char *name, const std::vector<double> &seconds, size_t corners, bool last){
+	double median = percentile(seconds, 50);
+	printf("        \"%s\": {\"median_s\": %.6f, \"p95_s\": %.6f, \"corners_per_s\": %.0f}%s\n",
+		name, median, percentile(seconds, 95), corners / median, last ? "" : ",");
+}
+
+/**
+ * runInput times the welds and the export of one input and prints its
+ * JSON object.
+ * @return Whether both welds gave the same vertices
+ */
+static bool runInput(const WeldInput &input, int iterations, bool last){
+	size_t corners = input.faces.corners.size();
+	std::vector<unsigned int> mapVertices, tableVertices;
+	tinyobj::vertex_cache cache;
+	size_t vertices = mapWeld(input, mapVertices);
+	bool match = tableWeld(input, cache, tableVertices) == vertices && mapVertices == tableVertices;
+
+	std::vector<double> mapSeconds = timeCase([&](){ mapWeld(input, mapVertices); }, iterations);
+	std::vector<double> tableSeconds = timeCase([&](){ tableWeld(input, cache, tableVertices); }, iterations);
+	tinyobj::export_scratch scratch;
+	std::vector<double> exportSeconds = timeCase([&](){
+		tinyobj::mesh_t mesh;
+		tinyobj::exportFaces(mesh, scratch, input.positions, input.normals, input.texcoords, input.faces, -1, true);
+	}, iterations);
+
+	printf("    {\n      \"input\": \"%s\",\n      \"corners\": %zu,\n      \"vertices\": %zu,\n      \"welds_match\": %s,\n",
+		input.name.c_str(), corners, vertices, match ? "true" : "false");
+	printf("      \"table_speedup\": %.2f,\n      \"cases\": {\n", percentile(mapSeconds, 50) / percentile(tableSeconds, 50));
+	printCase("map_weld", mapSeconds, corners, false);
+	printCase("table_weld", tableSeconds, corners, false);
+	printCase("exportFaces", exportSeconds, corners, true);
+	printf("      }\n    }%s\n", last ? "" : ",");
+	return match;
+}
+
+int main(int argc, char **argv){
+	int iterations = 5;
+	int grid = 1300;
+	std::vector<std::string> paths;
+	for( int i=1; i<argc; i++ ){
+		if( !strcmp(argv[i], "-n") && i + 1 < argc ){
+			iterations = std::max(1, atoi(argv[++i]));
+		}else if( !strcmp(argv[i], "-g") && i + 1 < argc ){
+			grid = std::max(1, atoi(argv[++i]));
+		}else{
+			paths.push_back(argv[i]);
+		}
+	}
+
+	bool ok = true;
+	printf("{\n  \"iterations\": %d,\n  \"inputs\": [\n", iterations);
+	if( paths.empty() ){
+		WeldInput input;
+		makeGrid(grid, input);
+		ok &= runInput(input, iterations, true);
+	}
+	for( int i=0; i<paths.size(); i++ ){
+		WeldInput input;
+		if( !readObj(paths[i], input) ){
+			return 1;
+		}
+		ok &= runInput(input, iterations, i + 1 == paths.size());
+	}
+	printf("  ]\n}\n");
+	return ok ? 0 : 1;
+}
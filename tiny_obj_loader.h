@@ -81,6 +81,14 @@ typedef struct {
   std::vector<std::string> stringValues;
 } tag_t;
 
+// A coarser version of a mesh, written by GenerateLods. Its triangles use
+// the mesh's own vertices.
+typedef struct {
+  std::vector<unsigned int> indices; // triangles
+  std::vector<int> material_ids;     // per-triangle material ID
+  float error; // bound on the distance of the surface from the original
+} mesh_lod_t;
+
 typedef struct {
   std::vector<float> positions;
   std::vector<float> normals;
@@ -90,6 +98,7 @@ typedef struct {
       num_vertices;              // The number of vertices per face. Up to 255.
   std::vector<int> material_ids; // per-face material ID
   std::vector<tag_t> tags;       // SubD tag
+  std::vector<mesh_lod_t> lods;  // levels of detail, finest first
 } mesh_t;
 
 typedef struct {
@@ -97,6 +106,36 @@ typedef struct {
   mesh_t mesh;
 } shape_t;
 
+// Layout of an interleaved vertex stream written by InterleaveMesh.
+// Offsets are in bytes from the start of a vertex, -1 if the attribute is
+// absent. Positions are always present.
+typedef struct {
+  unsigned int stride; // bytes from one vertex to the next
+  int position_offset; // 3 floats
+  int normal_offset;   // 3 floats
+  int texcoord_offset; // 2 floats
+} vertex_layout_t;
+
+// A 16 byte vertex written by CompressMesh.
+typedef struct {
+  unsigned short position[4]; // x, y, z as fractions of the mesh's bounding
+                              // box (0 to 65535), then padding
+  short normal[2];            // octahedral encoding of the unit normal,
+                              // each component -32767 to 32767
+  unsigned short texcoord[2]; // half floats
+} compact_vertex_t;
+
+// How CompressMesh quantised a mesh, and the largest errors it introduced.
+typedef struct {
+  // position = position_offset + position_scale * (stored / 65535)
+  float position_scale[3];
+  float position_offset[3];
+  float position_error; // distance from a decoded position to the original
+  float normal_error;   // angle in degrees between a decoded unit normal
+                        // and the original direction
+  float texcoord_error; // difference of a decoded texcoord component
+} compression_t;
+
 class MaterialReader {
 public:
   MaterialReader() {}
@@ -121,6 +160,44 @@ private:
   std::string m_mtlBasePath;
 };
 
+/// Receives shapes from LoadObjStreaming as soon as each one is complete.
+class ShapeConsumer {
+public:
+  ShapeConsumer() {}
+  virtual ~ShapeConsumer();
+
+  /// Called once per shape, in file order, on the loading thread.
+  /// `materials` holds every material loaded so far.
+  virtual void operator()(const shape_t &shape,
+                          const std::vector<material_t> &materials) = 0;
+};
+
+/// Writes the positions, normals and texcoords of `mesh` into one interleaved
+/// stream, ready for a single vertex buffer, and describes it in `layout`.
+/// Normals and texcoords are only included if every vertex has one, unless
+/// `all_attributes` is set: then every vertex has all three, with zeros for
+/// the ones the mesh lacks, so streams of different meshes share one layout.
+void InterleaveMesh(const mesh_t &mesh,
+                    std::vector<float> &vertices, // [output]
+                    vertex_layout_t &layout,      // [output]
+                    bool all_attributes = false);
+
+/// Writes the vertices of `mesh` in the compact 16 byte format, half the
+/// size of the InterleaveMesh stream with all attributes. Missing normals
+/// and texcoords are written as zeros. `compression` receives the
+/// dequantisation of the positions and the largest error of each attribute.
+void CompressMesh(const mesh_t &mesh,
+                  std::vector<compact_vertex_t> &vertices, // [output]
+                  compression_t &compression);             // [output]
+
+/// Fills `mesh.lods` with up to `levels` levels of detail, each with about
+/// half the triangles of the one before, by quadric error metric edge
+/// collapse (Garland and Heckbert). Vertices on a border, an attribute seam
+/// or between materials never move, so levels keep their outline and their
+/// materials. Levels stop early once a mesh cannot be reduced any further,
+/// and a mesh with faces that are not triangles gets none.
+void GenerateLods(mesh_t &mesh, unsigned int levels);
+
 /// Loads .obj from a file.
 /// 'shapes' will be filled with parsed shape data
 /// The function returns error string.
@@ -145,19 +222,88 @@ bool LoadObj(std::vector<shape_t> &shapes,       // [output]
              std::istream &inStream, MaterialReader &readMatFn,
              bool triangulate = true);
 
+/// Loads .obj from a memory-mapped file.
+/// Lines are tokenized in place over the mapped bytes, so no per-line copy is
+/// made. .mtl files referenced by `mtllib` are mapped the same way.
+/// Produces the same output as LoadObj(filename).
+bool LoadObjMapped(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err,                   // [output]
+                   const char *filename, const char *mtl_basepath = NULL,
+                   bool triangulate = true);
+
+/// Loads .obj from a memory-mapped file on `num_threads` threads (0 uses one
+/// per hardware thread). The file is split into chunks at line boundaries and
+/// the chunks are parsed concurrently, then indices and group/material
+/// boundaries are stitched together in order. Shapes are exported in
+/// parallel, and the vertices of large face groups are welded in parallel.
+/// Produces the same output as LoadObj(filename).
+/// Define TINYOBJLOADER_NO_THREADS to fall back to LoadObjMapped.
+bool LoadObjParallel(std::vector<shape_t> &shapes,       // [output]
+                     std::vector<material_t> &materials, // [output]
+                     std::string &err,                   // [output]
+                     const char *filename, const char *mtl_basepath = NULL,
+                     bool triangulate = true, unsigned int num_threads = 0);
+
+/// Loads .obj through an on-disk binary cache of the parsed shapes and
+/// materials, stored at `cache_path` (NULL puts it next to the .obj, as
+/// "<filename>.tobjcache"). The cache is keyed by the .obj path, size, mtime
+/// and content hash, and by the size and mtime of every .mtl it read. A
+/// missing, stale or corrupt cache is rebuilt with LoadObjParallel.
+/// With `lod_levels`, every shape also gets that many levels of detail
+/// (see GenerateLods), which are cached with it.
+/// Every array in the cache is 16 byte aligned, so a mapping of it can be
+/// handed to glBufferData as is.
+/// Produces the same output as LoadObj(filename).
+bool LoadObjCached(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err,                   // [output]
+                   const char *filename, const char *mtl_basepath = NULL,
+                   bool triangulate = true, const char *cache_path = NULL,
+                   unsigned int lod_levels = 0);
+
+/// Like LoadObjCached, but hands each shape to `consumer` as soon as it is
+/// complete instead of returning them all at the end. Without a usable cache
+/// the file is parsed on one thread, so the first shape arrives once it has
+/// been parsed rather than once the whole file has.
+bool LoadObjStreaming(ShapeConsumer &consumer,
+                      std::vector<material_t> &materials, // [output]
+                      std::string &err,                   // [output]
+                      const char *filename, const char *mtl_basepath = NULL,
+                      bool triangulate = true, const char *cache_path = NULL,
+                      unsigned int lod_levels = 0);
+
+/// Loads .obj from `len` bytes at `buf`. `buf` need not be null terminated.
+/// Returns true when loading .obj become success.
+/// Returns warning and error message into `err`
+bool LoadObjFromMemory(std::vector<shape_t> &shapes,       // [output]
+                       std::vector<material_t> &materials, // [output]
+                       std::string &err,                   // [output]
+                       const char *buf, size_t len,
+                       MaterialReader &readMatFn, bool triangulate = true);
+
 /// Loads materials into std::map
 void LoadMtl(std::map<std::string, int> &material_map, // [output]
              std::vector<material_t> &materials,       // [output]
              std::istream &inStream);
+
+/// Loads materials from `len` bytes at `buf` into std::map
+void LoadMtl(std::map<std::string, int> &material_map, // [output]
+             std::vector<material_t> &materials,       // [output]
+             const char *buf, size_t len);
 }
 
 #ifdef TINYOBJLOADER_IMPLEMENTATION
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cctype>
+#include <cfloat>
+
+#include <cstdio>
 
 #include <string>
 #include <vector>
@@ -165,13 +311,137 @@ void LoadMtl(std::map<std::string, int> &material_map, // [output]
 #include <fstream>
 #include <sstream>
 
+#ifndef TINYOBJLOADER_NO_THREADS
+#include <atomic>
+#include <thread>
+#endif
+
+#if defined(_WIN32)
+#include <iterator>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "tiny_obj_loader.h"
 
 namespace tinyobj {
 
 MaterialReader::~MaterialReader() {}
 
-#define TINYOBJ_SSCANF_BUFFER_SIZE (4096)
+ShapeConsumer::~ShapeConsumer() {}
+
+// Read-only view of a whole file.
+// Uses mmap where available, otherwise the file is read into memory.
+class mapped_file {
+public:
+  mapped_file() : data_(NULL), size_(0) {}
+  ~mapped_file() { close(); }
+
+  bool open(const char *filename) {
+    close();
+#if defined(_WIN32)
+    std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+    if (!ifs) {
+      return false;
+    }
+    buf_.assign(std::istreambuf_iterator<char>(ifs),
+                std::istreambuf_iterator<char>());
+    data_ = buf_.empty() ? NULL : &buf_[0];
+    size_ = buf_.size();
+    return true;
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(sb.st_size);
+    if (size_ > 0) {
+      void *p = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      madvise(p, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char *>(p);
+    }
+    ::close(fd); // The mapping stays valid after close.
+    return true;
+#endif
+  }
+
+  void close() {
+#if defined(_WIN32)
+    buf_.clear();
+#else
+    if (data_) {
+      munmap(const_cast<char *>(data_), size_);
+    }
+#endif
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  const char *data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  mapped_file(const mapped_file &);
+  mapped_file &operator=(const mapped_file &);
+
+  const char *data_;
+  size_t size_;
+#if defined(_WIN32)
+  std::vector<char> buf_;
+#endif
+};
+
+// Splits a buffer into lines without copying them.
+// A line ending in '\n' is returned in place; the parse helpers all stop at
+// '\r', '\n' or '\0', so the buffer is never read past the line end. Only an
+// unterminated last line is copied, to give it a terminating '\0'.
+class line_reader {
+public:
+  line_reader(const char *buf, size_t len) : p_(buf), end_(buf + len) {}
+
+  // Returns the next line as [line, lineEnd) with any trailing '\r' removed.
+  bool next(const char *&line, const char *&lineEnd) {
+    if (p_ >= end_) {
+      return false;
+    }
+    const char *nl = static_cast<const char *>(
+        memchr(p_, '\n', static_cast<size_t>(end_ - p_)));
+    if (nl) {
+      line = p_;
+      lineEnd = nl;
+      p_ = nl + 1;
+    } else {
+      tail_.assign(p_, end_);
+      line = tail_.c_str();
+      lineEnd = line + tail_.size();
+      p_ = end_;
+    }
+    if (lineEnd > line && lineEnd[-1] == '\r') {
+      lineEnd--;
+    }
+    return true;
+  }
+
+private:
+  const char *p_;
+  const char *end_;
+  std::string tail_;
+};
 
 struct vertex_index {
   int v_idx, vt_idx, vn_idx;
@@ -188,17 +458,70 @@ struct tag_sizes {
   int num_strings;
 };
 
-// for std::map
-static inline bool operator<(const vertex_index &a, const vertex_index &b) {
-  if (a.v_idx != b.v_idx)
-    return (a.v_idx < b.v_idx);
-  if (a.vn_idx != b.vn_idx)
-    return (a.vn_idx < b.vn_idx);
-  if (a.vt_idx != b.vt_idx)
-    return (a.vt_idx < b.vt_idx);
+// Open-addressing hash table from a vertex_index to the mesh vertex it was
+// welded into. Sized up front from the number of face corners, so it never
+// grows while a group is exported. reset() is O(1): slots left over from
+// earlier groups are told apart by their generation.
+class vertex_cache {
+public:
+  vertex_cache() : mask_(0), generation_(0) {}
 
-  return false;
-}
+  // Empties the table and makes room for `n` distinct keys.
+  void reset(size_t n) {
+    size_t capacity = 16;
+    while (capacity < 2 * n) {
+      capacity <<= 1;
+    }
+    generation_++;
+    if (capacity > slots_.size() || generation_ == 0) {
+      slots_.assign(capacity, slot());
+      generation_ = 1;
+    }
+    mask_ = slots_.size() - 1;
+  }
+
+  // Returns the value stored for `key`, or inserts `value` and returns it.
+  unsigned int findOrInsert(const vertex_index &key, unsigned int value,
+                            bool &found) {
+    size_t i = hash(key) & mask_;
+    for (;;) {
+      slot &s = slots_[i];
+      if (s.generation != generation_) {
+        s.key = key;
+        s.value = value;
+        s.generation = generation_;
+        found = false;
+        return value;
+      }
+      if (s.key.v_idx == key.v_idx && s.key.vt_idx == key.vt_idx &&
+          s.key.vn_idx == key.vn_idx) {
+        found = true;
+        return s.value;
+      }
+      i = (i + 1) & mask_;
+    }
+  }
+
+private:
+  struct slot {
+    slot() : value(0), generation(0) {}
+    vertex_index key;
+    unsigned int value;
+    unsigned int generation;
+  };
+
+  static size_t hash(const vertex_index &k) {
+    unsigned int h = static_cast<unsigned int>(k.v_idx) * 0x9E3779B1u;
+    h ^= static_cast<unsigned int>(k.vt_idx) * 0x85EBCA77u;
+    h ^= static_cast<unsigned int>(k.vn_idx) * 0xC2B2AE3Du;
+    h ^= h >> 15;
+    return h;
+  }
+
+  std::vector<slot> slots_;
+  size_t mask_;
+  unsigned int generation_;
+};
 
 struct obj_shape {
   std::vector<float> v;
@@ -222,19 +545,36 @@ static inline int fixIndex(int idx, int n) {
 static inline std::string parseString(const char *&token) {
   std::string s;
   token += strspn(token, " \t");
-  size_t e = strcspn(token, " \t\r");
+  size_t e = strcspn(token, " \t\r\n");
   s = std::string(token, &token[e]);
   token += e;
   return s;
 }
 
+// atoi() for the digits at `s`, without atoi's locale and whitespace
+// handling.
+static inline int parseDigits(const char *s) {
+  bool negative = false;
+  if (*s == '+' || *s == '-') {
+    negative = (*s == '-');
+    s++;
+  }
+  int i = 0;
+  while (IS_DIGIT(*s)) {
+    i = i * 10 + (*s - '0');
+    s++;
+  }
+  return negative ? -i : i;
+}
+
 static inline int parseInt(const char *&token) {
   token += strspn(token, " \t");
-  int i = atoi(token);
-  token += strcspn(token, " \t\r");
+  int i = parseDigits(token);
+  token += strcspn(token, " \t\r\n");
   return i;
 }
 
+#if defined(TINY_OBJ_LOADER_DOUBLE_FLOAT_PARSER)
 // Tries to parse a floating point number located at s.
 //
 // s_end should be a location in the string where reading should absolutely
@@ -366,17 +706,420 @@ assemble:
 fail:
   return false;
 }
+#elif !defined(TINY_OBJ_LOADER_OLD_FLOAT_PARSER)
+// 128-bit truncated powers of five, 5^-65 to 5^38, normalized so the top bit
+// is set. Negative powers are rounded up. Covers every decimal exponent that
+// yields a finite, non-zero float from a 19 digit significand.
+#define TINYOBJ_POW5_MIN (-65)
+#define TINYOBJ_POW5_MAX (38)
+static const unsigned long long kPowersOfFive[][2] = {
+    {0x86ccbb52ea94baeaULL, 0x98e947129fc2b4e9ULL}, // 5^-65
+    {0xa87fea27a539e9a5ULL, 0x3f2398d747b36224ULL}, // 5^-64
+    {0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aadULL}, // 5^-63
+    {0x83a3eeeef9153e89ULL, 0x1953cf68300424acULL}, // 5^-62
+    {0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd7ULL}, // 5^-61
+    {0xcdb02555653131b6ULL, 0x3792f412cb06794dULL}, // 5^-60
+    {0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd0ULL}, // 5^-59
+    {0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec4ULL}, // 5^-58
+    {0xc8de047564d20a8bULL, 0xf245825a5a445275ULL}, // 5^-57
+    {0xfb158592be068d2eULL, 0xeed6e2f0f0d56712ULL}, // 5^-56
+    {0x9ced737bb6c4183dULL, 0x55464dd69685606bULL}, // 5^-55
+    {0xc428d05aa4751e4cULL, 0xaa97e14c3c26b886ULL}, // 5^-54
+    {0xf53304714d9265dfULL, 0xd53dd99f4b3066a8ULL}, // 5^-53
+    {0x993fe2c6d07b7fabULL, 0xe546a8038efe4029ULL}, // 5^-52
+    {0xbf8fdb78849a5f96ULL, 0xde98520472bdd033ULL}, // 5^-51
+    {0xef73d256a5c0f77cULL, 0x963e66858f6d4440ULL}, // 5^-50
+    {0x95a8637627989aadULL, 0xdde7001379a44aa8ULL}, // 5^-49
+    {0xbb127c53b17ec159ULL, 0x5560c018580d5d52ULL}, // 5^-48
+    {0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a6ULL}, // 5^-47
+    {0x9226712162ab070dULL, 0xcab3961304ca70e8ULL}, // 5^-46
+    {0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d22ULL}, // 5^-45
+    {0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506aULL}, // 5^-44
+    {0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb242ULL}, // 5^-43
+    {0xb267ed1940f1c61cULL, 0x55f038b237591ed3ULL}, // 5^-42
+    {0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6688ULL}, // 5^-41
+    {0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da015ULL}, // 5^-40
+    {0xae397d8aa96c1b77ULL, 0xabec975e0a0d081aULL}, // 5^-39
+    {0xd9c7dced53c72255ULL, 0x96e7bd358c904a21ULL}, // 5^-38
+    {0x881cea14545c7575ULL, 0x7e50d64177da2e54ULL}, // 5^-37
+    {0xaa242499697392d2ULL, 0xdde50bd1d5d0b9e9ULL}, // 5^-36
+    {0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e864ULL}, // 5^-35
+    {0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113eULL}, // 5^-34
+    {0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58eULL}, // 5^-33
+    {0xcfb11ead453994baULL, 0x67de18eda5814af2ULL}, // 5^-32
+    {0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced7ULL}, // 5^-31
+    {0xa2425ff75e14fc31ULL, 0xa1258379a94d028dULL}, // 5^-30
+    {0xcad2f7f5359a3b3eULL, 0x096ee45813a04330ULL}, // 5^-29
+    {0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fcULL}, // 5^-28
+    {0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL}, // 5^-27
+    {0xc612062576589ddaULL, 0x95364afe032a819eULL}, // 5^-26
+    {0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL}, // 5^-25
+    {0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL}, // 5^-24
+    {0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL}, // 5^-23
+    {0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL}, // 5^-22
+    {0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL}, // 5^-21
+    {0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL}, // 5^-20
+    {0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL}, // 5^-19
+    {0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL}, // 5^-18
+    {0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL}, // 5^-17
+    {0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL}, // 5^-16
+    {0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL}, // 5^-15
+    {0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL}, // 5^-14
+    {0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL}, // 5^-13
+    {0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL}, // 5^-12
+    {0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL}, // 5^-11
+    {0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL}, // 5^-10
+    {0x89705f4136b4a597ULL, 0x31680a88f8953031ULL}, // 5^-9
+    {0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL}, // 5^-8
+    {0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL}, // 5^-7
+    {0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL}, // 5^-6
+    {0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL}, // 5^-5
+    {0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL}, // 5^-4
+    {0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL}, // 5^-3
+    {0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL}, // 5^-2
+    {0xccccccccccccccccULL, 0xcccccccccccccccdULL}, // 5^-1
+    {0x8000000000000000ULL, 0x0000000000000000ULL}, // 5^0
+    {0xa000000000000000ULL, 0x0000000000000000ULL}, // 5^1
+    {0xc800000000000000ULL, 0x0000000000000000ULL}, // 5^2
+    {0xfa00000000000000ULL, 0x0000000000000000ULL}, // 5^3
+    {0x9c40000000000000ULL, 0x0000000000000000ULL}, // 5^4
+    {0xc350000000000000ULL, 0x0000000000000000ULL}, // 5^5
+    {0xf424000000000000ULL, 0x0000000000000000ULL}, // 5^6
+    {0x9896800000000000ULL, 0x0000000000000000ULL}, // 5^7
+    {0xbebc200000000000ULL, 0x0000000000000000ULL}, // 5^8
+    {0xee6b280000000000ULL, 0x0000000000000000ULL}, // 5^9
+    {0x9502f90000000000ULL, 0x0000000000000000ULL}, // 5^10
+    {0xba43b74000000000ULL, 0x0000000000000000ULL}, // 5^11
+    {0xe8d4a51000000000ULL, 0x0000000000000000ULL}, // 5^12
+    {0x9184e72a00000000ULL, 0x0000000000000000ULL}, // 5^13
+    {0xb5e620f480000000ULL, 0x0000000000000000ULL}, // 5^14
+    {0xe35fa931a0000000ULL, 0x0000000000000000ULL}, // 5^15
+    {0x8e1bc9bf04000000ULL, 0x0000000000000000ULL}, // 5^16
+    {0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL}, // 5^17
+    {0xde0b6b3a76400000ULL, 0x0000000000000000ULL}, // 5^18
+    {0x8ac7230489e80000ULL, 0x0000000000000000ULL}, // 5^19
+    {0xad78ebc5ac620000ULL, 0x0000000000000000ULL}, // 5^20
+    {0xd8d726b7177a8000ULL, 0x0000000000000000ULL}, // 5^21
+    {0x878678326eac9000ULL, 0x0000000000000000ULL}, // 5^22
+    {0xa968163f0a57b400ULL, 0x0000000000000000ULL}, // 5^23
+    {0xd3c21bcecceda100ULL, 0x0000000000000000ULL}, // 5^24
+    {0x84595161401484a0ULL, 0x0000000000000000ULL}, // 5^25
+    {0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL}, // 5^26
+    {0xcecb8f27f4200f3aULL, 0x0000000000000000ULL}, // 5^27
+    {0x813f3978f8940984ULL, 0x4000000000000000ULL}, // 5^28
+    {0xa18f07d736b90be5ULL, 0x5000000000000000ULL}, // 5^29
+    {0xc9f2c9cd04674edeULL, 0xa400000000000000ULL}, // 5^30
+    {0xfc6f7c4045812296ULL, 0x4d00000000000000ULL}, // 5^31
+    {0x9dc5ada82b70b59dULL, 0xf020000000000000ULL}, // 5^32
+    {0xc5371912364ce305ULL, 0x6c28000000000000ULL}, // 5^33
+    {0xf684df56c3e01bc6ULL, 0xc732000000000000ULL}, // 5^34
+    {0x9a130b963a6c115cULL, 0x3c7f400000000000ULL}, // 5^35
+    {0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL}, // 5^36
+    {0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL}, // 5^37
+    {0x96769950b50d88f4ULL, 0x1314448000000000ULL}, // 5^38
+};
+
+// 64x64 -> 128 bit multiply.
+static inline void mul64(unsigned long long a, unsigned long long b,
+                         unsigned long long *hi, unsigned long long *lo) {
+#if defined(__SIZEOF_INT128__)
+  unsigned __int128 r = static_cast<unsigned __int128>(a) * b;
+  *hi = static_cast<unsigned long long>(r >> 64);
+  *lo = static_cast<unsigned long long>(r);
+#else
+  unsigned long long a_lo = a & 0xFFFFFFFFULL, a_hi = a >> 32;
+  unsigned long long b_lo = b & 0xFFFFFFFFULL, b_hi = b >> 32;
+  unsigned long long ll = a_lo * b_lo, lh = a_lo * b_hi;
+  unsigned long long hl = a_hi * b_lo, hh = a_hi * b_hi;
+  unsigned long long mid = (ll >> 32) + (lh & 0xFFFFFFFFULL) + (hl & 0xFFFFFFFFULL);
+  *lo = (mid << 32) | (ll & 0xFFFFFFFFULL);
+  *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+#endif
+}
+
+static inline int leadingZeros64(unsigned long long x) {
+#if defined(__GNUC__)
+  return __builtin_clzll(x);
+#else
+  int n = 0;
+  while (!(x & 0x8000000000000000ULL)) {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+// Eisel-Lemire: converts w * 10^q (w != 0) to the bits of the nearest float.
+// Returns false in the rare cases it cannot decide the rounding.
+static bool eiselLemireFloat(unsigned long long w, int q, unsigned int *bits) {
+  const int mantissaBits = 23;
+  if (q < TINYOBJ_POW5_MIN) {
+    *bits = 0;
+    return true;
+  }
+  if (q > TINYOBJ_POW5_MAX) {
+    *bits = 0x7F800000u; // inf
+    return true;
+  }
+
+  int lz = leadingZeros64(w);
+  w <<= lz;
+
+  // Product with the high half of 5^q; the low half is only needed when the
+  // bits below the mantissa are all ones and a carry could still reach it.
+  const unsigned long long *pow5 = kPowersOfFive[q - TINYOBJ_POW5_MIN];
+  unsigned long long hi, lo;
+  mul64(w, pow5[0], &hi, &lo);
+  const unsigned long long precisionMask =
+      0xFFFFFFFFFFFFFFFFULL >> (mantissaBits + 3);
+  if ((hi & precisionMask) == precisionMask) {
+    unsigned long long hi2, lo2;
+    mul64(w, pow5[1], &hi2, &lo2);
+    lo += hi2;
+    if (hi2 > lo) {
+      hi++;
+    }
+  }
+  if (lo == 0xFFFFFFFFFFFFFFFFULL && (q < -27 || q > 55)) {
+    return false;
+  }
+
+  int upperbit = static_cast<int>(hi >> 63);
+  int shift = upperbit + 64 - mantissaBits - 3;
+  unsigned long long mantissa = hi >> shift;
+  int power2 = (((152170 + 65536) * q) >> 16) + 63 + upperbit - lz + 127;
+
+  if (power2 <= 0) {
+    // Subnormal.
+    if (-power2 + 1 >= 64) {
+      *bits = 0;
+      return true;
+    }
+    mantissa >>= -power2 + 1;
+    mantissa += (mantissa & 1);
+    mantissa >>= 1;
+    power2 = (mantissa < (1ULL << mantissaBits)) ? 0 : 1;
+    *bits = static_cast<unsigned int>(mantissa) |
+            (static_cast<unsigned int>(power2) << mantissaBits);
+    return true;
+  }
+
+  // Exactly halfway: round to even rather than up.
+  if (lo <= 1 && q >= -17 && q <= 10 && (mantissa & 3) == 1 &&
+      (mantissa << shift) == hi) {
+    mantissa &= ~1ULL;
+  }
+  mantissa += (mantissa & 1);
+  mantissa >>= 1;
+  if (mantissa >= (2ULL << mantissaBits)) {
+    mantissa = 1ULL << mantissaBits;
+    power2++;
+  }
+  mantissa &= ~(1ULL << mantissaBits);
+  if (power2 >= 0xFF) {
+    *bits = 0x7F800000u; // inf
+    return true;
+  }
+  *bits = static_cast<unsigned int>(mantissa) |
+          (static_cast<unsigned int>(power2) << mantissaBits);
+  return true;
+}
+
+// True if the 8 bytes at p are all ASCII digits.
+static inline bool isEightDigits(const char *p) {
+  unsigned long long val;
+  memcpy(&val, p, 8);
+  return (((val & 0xF0F0F0F0F0F0F0F0ULL) |
+           (((val + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+          0x3333333333333333ULL);
+}
+
+// Value of the 8 ASCII digits at p, converted in parallel (SWAR).
+static inline unsigned int parseEightDigits(const char *p) {
+  unsigned long long val;
+  memcpy(&val, p, 8);
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  val = __builtin_bswap64(val);
+#endif
+  val -= 0x3030303030303030ULL;
+  val = (val * 10) + (val >> 8);
+  val = (((val & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+         (((val >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >>
+        32;
+  return static_cast<unsigned int>(val);
+}
+
+// Parses a decimal floating point number located at [s, s_end) straight to a
+// float, correctly rounded (to nearest, ties to even) like strtof.
+//
+// The significand is gathered into a 64-bit integer, eight fraction digits
+// at a time where possible. Short significands with small exponents are
+// exact in float arithmetic (Clinger's fast path); the rest go through the
+// Eisel-Lemire algorithm. Inputs neither can decide (more than 19
+// significant digits, inf/nan, hex floats) are handed to strtof.
+//
+// Returns false if no number could be parsed.
+static bool tryParseFloat(const char *s, const char *s_end, float *result) {
+  if (s >= s_end) {
+    return false;
+  }
+
+  const char *curr = s;
+  bool negative = false;
+  if (*curr == '+' || *curr == '-') {
+    negative = (*curr == '-');
+    curr++;
+  }
+
+  unsigned long long w = 0;
+  int digits = 0;   // significant digits held in w
+  int exponent = 0; // value = w * 10^exponent
+  bool truncated = false;
+  bool seen = false;
+
+  // Integer part.
+  while (curr != s_end && *curr == '0') {
+    curr++;
+    seen = true;
+  }
+  while (curr != s_end && IS_DIGIT(*curr)) {
+    if (digits < 19) {
+      w = w * 10 + static_cast<unsigned int>(*curr - '0');
+      digits++;
+    } else {
+      exponent++;
+      truncated |= (*curr != '0');
+    }
+    curr++;
+    seen = true;
+  }
+
+  // Fraction part.
+  if (curr != s_end && *curr == '.') {
+    curr++;
+    if (digits == 0) {
+      while (curr != s_end && *curr == '0') {
+        exponent--;
+        curr++;
+        seen = true;
+      }
+    }
+    while (digits + 8 <= 19 && s_end - curr >= 8 && isEightDigits(curr)) {
+      w = w * 100000000 + parseEightDigits(curr);
+      digits += 8;
+      exponent -= 8;
+      curr += 8;
+      seen = true;
+    }
+    while (curr != s_end && IS_DIGIT(*curr)) {
+      if (digits < 19) {
+        w = w * 10 + static_cast<unsigned int>(*curr - '0');
+        digits++;
+        exponent--;
+      } else {
+        truncated |= (*curr != '0');
+      }
+      curr++;
+      seen = true;
+    }
+  }
+
+  // Hex floats ("0x...") are left to strtof.
+  if (!seen || (curr != s_end && (*curr == 'x' || *curr == 'X'))) {
+    goto fallback;
+  }
+
+  // Exponent part. Like strtof, a malformed exponent is not consumed.
+  if (curr != s_end && (*curr == 'e' || *curr == 'E')) {
+    const char *e = curr + 1;
+    bool expNegative = false;
+    if (e != s_end && (*e == '+' || *e == '-')) {
+      expNegative = (*e == '-');
+      e++;
+    }
+    if (e != s_end && IS_DIGIT(*e)) {
+      int exp = 0;
+      while (e != s_end && IS_DIGIT(*e)) {
+        if (exp < 10000) {
+          exp = exp * 10 + (*e - '0');
+        }
+        e++;
+      }
+      exponent += expNegative ? -exp : exp;
+    }
+  }
+
+  if (truncated) {
+    goto fallback;
+  }
+
+  if (w == 0) {
+    *result = negative ? -0.0f : 0.0f;
+    return true;
+  }
+
+#if defined(FLT_EVAL_METHOD) && (FLT_EVAL_METHOD == 0)
+  // w and 10^|exponent| are exact floats, so one operation rounds correctly.
+  if (w <= (1ULL << 24) && exponent >= -10 && exponent <= 10) {
+    static const float kPowersOfTen[] = {1e0f, 1e1f, 1e2f, 1e3f,
+                                         1e4f, 1e5f, 1e6f, 1e7f,
+                                         1e8f, 1e9f, 1e10f};
+    float f = static_cast<float>(w);
+    if (exponent < 0) {
+      f /= kPowersOfTen[-exponent];
+    } else {
+      f *= kPowersOfTen[exponent];
+    }
+    *result = negative ? -f : f;
+    return true;
+  }
+#endif
+
+  {
+    unsigned int bits;
+    if (eiselLemireFloat(w, exponent, &bits)) {
+      if (negative) {
+        bits |= 0x80000000u;
+      }
+      memcpy(result, &bits, sizeof(float));
+      return true;
+    }
+  }
+
+fallback:
+  // strtof stops at the first character that is not part of a number, so it
+  // cannot run past the end of the line.
+  char *end;
+  float f = strtof(s, &end);
+  if (end == s) {
+    return false;
+  }
+  *result = f;
+  return true;
+}
+#endif
+
+// Parses the float at `token` and moves past it.
+// Define TINY_OBJ_LOADER_OLD_FLOAT_PARSER to use atof, or
+// TINY_OBJ_LOADER_DOUBLE_FLOAT_PARSER to parse through tryParseDouble.
+// By default tryParseFloat is used.
 static inline float parseFloat(const char *&token) {
   token += strspn(token, " \t");
-#ifdef TINY_OBJ_LOADER_OLD_FLOAT_PARSER
+#if defined(TINY_OBJ_LOADER_OLD_FLOAT_PARSER)
   float f = (float)atof(token);
-  token += strcspn(token, " \t\r");
-#else
-  const char *end = token + strcspn(token, " \t\r");
+  token += strcspn(token, " \t\r\n");
+#elif defined(TINY_OBJ_LOADER_DOUBLE_FLOAT_PARSER)
+  const char *end = token + strcspn(token, " \t\r\n");
   double val = 0.0;
   tryParseDouble(token, end, &val);
   float f = static_cast<float>(val);
   token = end;
+#else
+  const char *end = token + strcspn(token, " \t\r\n");
+  float f = 0.0f;
+  tryParseFloat(token, end, &f);
+  token = end;
 #endif
   return f;
 }
@@ -397,21 +1140,21 @@ static tag_sizes parseTagTriple(const char *&token) {
   tag_sizes ts;
 
   ts.num_ints = atoi(token);
-  token += strcspn(token, "/ \t\r");
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return ts;
   }
   token++;
 
   ts.num_floats = atoi(token);
-  token += strcspn(token, "/ \t\r");
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return ts;
   }
   token++;
 
   ts.num_strings = atoi(token);
-  token += strcspn(token, "/ \t\r") + 1;
+  token += strcspn(token, "/ \t\r\n") + 1;
 
   return ts;
 }
@@ -421,8 +1164,8 @@ static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
                                 int vtsize) {
   vertex_index vi(-1);
 
-  vi.v_idx = fixIndex(atoi(token), vsize);
-  token += strcspn(token, "/ \t\r");
+  vi.v_idx = fixIndex(parseDigits(token), vsize);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
@@ -431,64 +1174,25 @@ static vertex_index parseTriple(const char *&token, int vsize, int vnsize,
   // i//k
   if (token[0] == '/') {
     token++;
-    vi.vn_idx = fixIndex(atoi(token), vnsize);
-    token += strcspn(token, "/ \t\r");
+    vi.vn_idx = fixIndex(parseDigits(token), vnsize);
+    token += strcspn(token, "/ \t\r\n");
     return vi;
   }
 
   // i/j/k or i/j
-  vi.vt_idx = fixIndex(atoi(token), vtsize);
-  token += strcspn(token, "/ \t\r");
+  vi.vt_idx = fixIndex(parseDigits(token), vtsize);
+  token += strcspn(token, "/ \t\r\n");
   if (token[0] != '/') {
     return vi;
   }
 
   // i/j/k
   token++; // skip '/'
-  vi.vn_idx = fixIndex(atoi(token), vnsize);
-  token += strcspn(token, "/ \t\r");
+  vi.vn_idx = fixIndex(parseDigits(token), vnsize);
+  token += strcspn(token, "/ \t\r\n");
   return vi;
 }
 
-static unsigned int
-updateVertex(std::map<vertex_index, unsigned int> &vertexCache,
-             std::vector<float> &positions, std::vector<float> &normals,
-             std::vector<float> &texcoords,
-             const std::vector<float> &in_positions,
-             const std::vector<float> &in_normals,
-             const std::vector<float> &in_texcoords, const vertex_index &i) {
-  const std::map<vertex_index, unsigned int>::iterator it = vertexCache.find(i);
-
-  if (it != vertexCache.end()) {
-    // found cache
-    return it->second;
-  }
-
-  assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
-
-  positions.push_back(in_positions[3 * static_cast<size_t>(i.v_idx) + 0]);
-  positions.push_back(in_positions[3 * static_cast<size_t>(i.v_idx) + 1]);
-  positions.push_back(in_positions[3 * static_cast<size_t>(i.v_idx) + 2]);
-
-  if ((i.vn_idx >= 0) &&
-      (static_cast<size_t>(i.vn_idx * 3 + 2) < in_normals.size())) {
-    normals.push_back(in_normals[3 * static_cast<size_t>(i.vn_idx) + 0]);
-    normals.push_back(in_normals[3 * static_cast<size_t>(i.vn_idx) + 1]);
-    normals.push_back(in_normals[3 * static_cast<size_t>(i.vn_idx) + 2]);
-  }
-
-  if ((i.vt_idx >= 0) &&
-      (static_cast<size_t>(i.vt_idx * 2 + 1) < in_texcoords.size())) {
-    texcoords.push_back(in_texcoords[2 * static_cast<size_t>(i.vt_idx) + 0]);
-    texcoords.push_back(in_texcoords[2 * static_cast<size_t>(i.vt_idx) + 1]);
-  }
-
-  unsigned int idx = static_cast<unsigned int>(positions.size() / 3 - 1);
-  vertexCache[i] = idx;
-
-  return idx;
-}
-
 static void InitMaterial(material_t &material) {
   material.name = "";
   material.ambient_texname = "";
@@ -512,298 +1216,422 @@ static void InitMaterial(material_t &material) {
   material.unknown_parameter.clear();
 }
 
-static bool exportFaceGroupToShape(
-    shape_t &shape, std::map<vertex_index, unsigned int> vertexCache,
-    const std::vector<float> &in_positions,
-    const std::vector<float> &in_normals,
-    const std::vector<float> &in_texcoords,
-    const std::vector<std::vector<vertex_index> > &faceGroup,
-    std::vector<tag_t> &tags, const int material_id, const std::string &name,
-    bool clearCache, bool triangulate) {
-  if (faceGroup.empty()) {
-    return false;
+// Faces of one group, stored back to back.
+struct face_group {
+  std::vector<vertex_index> corners;
+  std::vector<unsigned int> sizes; // number of corners in each face
+
+  bool empty() const { return sizes.empty(); }
+  void clear() {
+    corners.clear();
+    sizes.clear();
+  }
+  void swap(face_group &other) {
+    corners.swap(other.corners);
+    sizes.swap(other.sizes);
   }
+};
 
-  // Flatten vertices and indices
-  for (size_t i = 0; i < faceGroup.size(); i++) {
-    const std::vector<vertex_index> &face = faceGroup[i];
+// Scratch space for exportFaces. It is kept from one group to the next, so
+// once it has grown to fit, exporting a group allocates only the mesh itself.
+struct export_scratch {
+  vertex_cache vertexCache;
+  std::vector<unsigned int> cornerVertex; // mesh vertex of each face corner
+  std::vector<vertex_index> vertices;     // indices of each new mesh vertex
+};
 
-    vertex_index i0 = face[0];
-    vertex_index i1(-1);
-    vertex_index i2 = face[1];
+static inline bool hasNormal(const vertex_index &i,
+                             const std::vector<float> &in_normals) {
+  return (i.vn_idx >= 0) &&
+         (static_cast<size_t>(i.vn_idx * 3 + 2) < in_normals.size());
+}
 
-    size_t npolys = face.size();
+static inline bool hasTexcoord(const vertex_index &i,
+                               const std::vector<float> &in_texcoords) {
+  return (i.vt_idx >= 0) &&
+         (static_cast<size_t>(i.vt_idx * 2 + 1) < in_texcoords.size());
+}
 
+// Flattens the vertices and indices of `faceGroup` into `mesh`.
+// Vertices are welded within the group only; the vertex cache is reset first.
+// The first pass welds the corners and counts what the mesh needs, so every
+// mesh array is grown exactly once; the second pass fills them in.
+static void exportFaces(mesh_t &mesh, export_scratch &scratch,
+                        const std::vector<float> &in_positions,
+                        const std::vector<float> &in_normals,
+                        const std::vector<float> &in_texcoords,
+                        const face_group &faceGroup, const int material_id,
+                        bool triangulate) {
+  const size_t numCorners = faceGroup.corners.size();
+  const unsigned int base =
+      static_cast<unsigned int>(mesh.positions.size() / 3);
+
+  scratch.vertexCache.reset(numCorners);
+  scratch.cornerVertex.resize(numCorners);
+  scratch.vertices.clear();
+
+  // Weld. A face of fewer than three corners is dropped when triangulating,
+  // so its corners must not create vertices.
+  size_t numNormals = 0, numTexcoords = 0;
+  size_t numFaces = 0, numIndices = 0;
+  size_t offset = 0;
+  for (size_t i = 0; i < faceGroup.sizes.size(); i++) {
+    size_t npolys = faceGroup.sizes[i];
     if (triangulate) {
+      if (npolys < 3) {
+        offset += npolys;
+        continue;
+      }
+      numFaces += npolys - 2;
+      numIndices += 3 * (npolys - 2);
+    } else {
+      numFaces++;
+      numIndices += npolys;
+    }
+
+    for (size_t k = offset; k < offset + npolys; k++) {
+      const vertex_index &vi = faceGroup.corners[k];
+      bool found;
+      scratch.cornerVertex[k] = scratch.vertexCache.findOrInsert(
+          vi, base + static_cast<unsigned int>(scratch.vertices.size()),
+          found);
+      if (!found) {
+        scratch.vertices.push_back(vi);
+        numNormals += hasNormal(vi, in_normals);
+        numTexcoords += hasTexcoord(vi, in_texcoords);
+      }
+    }
+    offset += npolys;
+  }
+
+  // Vertex attributes.
+  size_t numVertices = scratch.vertices.size();
+  size_t pos = mesh.positions.size();
+  size_t nrm = mesh.normals.size();
+  size_t tex = mesh.texcoords.size();
+  mesh.positions.resize(pos + 3 * numVertices);
+  mesh.normals.resize(nrm + 3 * numNormals);
+  mesh.texcoords.resize(tex + 2 * numTexcoords);
+  for (size_t v = 0; v < numVertices; v++) {
+    const vertex_index &i = scratch.vertices[v];
+    assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
+
+    const float *p = &in_positions[3 * static_cast<size_t>(i.v_idx)];
+    mesh.positions[pos++] = p[0];
+    mesh.positions[pos++] = p[1];
+    mesh.positions[pos++] = p[2];
+
+    if (hasNormal(i, in_normals)) {
+      const float *n = &in_normals[3 * static_cast<size_t>(i.vn_idx)];
+      mesh.normals[nrm++] = n[0];
+      mesh.normals[nrm++] = n[1];
+      mesh.normals[nrm++] = n[2];
+    }
+
+    if (hasTexcoord(i, in_texcoords)) {
+      const float *t = &in_texcoords[2 * static_cast<size_t>(i.vt_idx)];
+      mesh.texcoords[tex++] = t[0];
+      mesh.texcoords[tex++] = t[1];
+    }
+  }
 
+  // Indices and per-face data.
+  size_t idx = mesh.indices.size();
+  size_t face = mesh.num_vertices.size();
+  mesh.indices.resize(idx + numIndices);
+  mesh.num_vertices.resize(face + numFaces);
+  mesh.material_ids.resize(face + numFaces, material_id);
+
+  const unsigned int *corner = scratch.cornerVertex.data();
+  for (size_t i = 0; i < faceGroup.sizes.size(); i++) {
+    size_t npolys = faceGroup.sizes[i];
+
+    if (triangulate) {
       // Polygon -> triangle fan conversion
       for (size_t k = 2; k < npolys; k++) {
-        i1 = i2;
-        i2 = face[k];
-
-        unsigned int v0 = updateVertex(
-            vertexCache, shape.mesh.positions, shape.mesh.normals,
-            shape.mesh.texcoords, in_positions, in_normals, in_texcoords, i0);
-        unsigned int v1 = updateVertex(
-            vertexCache, shape.mesh.positions, shape.mesh.normals,
-            shape.mesh.texcoords, in_positions, in_normals, in_texcoords, i1);
-        unsigned int v2 = updateVertex(
-            vertexCache, shape.mesh.positions, shape.mesh.normals,
-            shape.mesh.texcoords, in_positions, in_normals, in_texcoords, i2);
-
-        shape.mesh.indices.push_back(v0);
-        shape.mesh.indices.push_back(v1);
-        shape.mesh.indices.push_back(v2);
-
-        shape.mesh.num_vertices.push_back(3);
-        shape.mesh.material_ids.push_back(material_id);
+        mesh.indices[idx++] = corner[0];
+        mesh.indices[idx++] = corner[k - 1];
+        mesh.indices[idx++] = corner[k];
+        mesh.num_vertices[face++] = 3;
       }
     } else {
-
       for (size_t k = 0; k < npolys; k++) {
-        unsigned int v =
-            updateVertex(vertexCache, shape.mesh.positions, shape.mesh.normals,
-                         shape.mesh.texcoords, in_positions, in_normals,
-                         in_texcoords, face[k]);
-
-        shape.mesh.indices.push_back(v);
+        mesh.indices[idx++] = corner[k];
       }
-
-      shape.mesh.num_vertices.push_back(static_cast<unsigned char>(npolys));
-      shape.mesh.material_ids.push_back(material_id); // per face
+      mesh.num_vertices[face++] = static_cast<unsigned char>(npolys);
     }
+    corner += npolys;
+  }
+}
+
+static bool exportFaceGroupToShape(
+    shape_t &shape, export_scratch &scratch,
+    const std::vector<float> &in_positions,
+    const std::vector<float> &in_normals,
+    const std::vector<float> &in_texcoords, const face_group &faceGroup,
+    std::vector<tag_t> &tags, const int material_id, const std::string &name,
+    bool triangulate) {
+  if (faceGroup.empty()) {
+    return false;
   }
 
+  exportFaces(shape.mesh, scratch, in_positions, in_normals, in_texcoords,
+              faceGroup, material_id, triangulate);
+
   shape.name = name;
   shape.mesh.tags.swap(tags);
 
-  if (clearCache)
-    vertexCache.clear();
-
   return true;
 }
 
-void LoadMtl(std::map<std::string, int> &material_map,
-             std::vector<material_t> &materials, std::istream &inStream) {
-
-  // Create a default material anyway.
-  material_t material;
-  InitMaterial(material);
+// Parses a single line of a .mtl file into `material`.
+// [token, lineEnd) is the line without its newline.
+static void parseMtlLine(const char *token, const char *lineEnd,
+                         material_t &material,
+                         std::map<std::string, int> &material_map,
+                         std::vector<material_t> &materials) {
+  // Skip leading space.
+  token += strspn(token, " \t");
 
-  size_t maxchars = 8192;          // Alloc enough size.
-  std::vector<char> buf(maxchars); // Alloc enough size.
-  while (inStream.peek() != -1) {
-    inStream.getline(&buf[0], static_cast<std::streamsize>(maxchars));
+  assert(token);
+  if (IS_NEW_LINE(token[0]))
+    return; // empty line
 
-    std::string linebuf(&buf[0]);
+  if (token[0] == '#')
+    return; // comment line
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
-    }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+  // new mtl
+  if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
+    // flush previous material.
+    if (!material.name.empty()) {
+      material_map.insert(std::pair<std::string, int>(
+          material.name, static_cast<int>(materials.size())));
+      materials.push_back(material);
     }
 
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
-    }
+    // initial temporary material
+    InitMaterial(material);
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+    // set new mtl name
+    token += 7;
+    material.name = parseString(token);
+    return;
+  }
 
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+  // ambient
+  if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.ambient[0] = r;
+    material.ambient[1] = g;
+    material.ambient[2] = b;
+    return;
+  }
 
-    if (token[0] == '#')
-      continue; // comment line
+  // diffuse
+  if (token[0] == 'K' && token[1] == 'd' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.diffuse[0] = r;
+    material.diffuse[1] = g;
+    material.diffuse[2] = b;
+    return;
+  }
 
-    // new mtl
-    if ((0 == strncmp(token, "newmtl", 6)) && IS_SPACE((token[6]))) {
-      // flush previous material.
-      if (!material.name.empty()) {
-        material_map.insert(std::pair<std::string, int>(
-            material.name, static_cast<int>(materials.size())));
-        materials.push_back(material);
-      }
+  // specular
+  if (token[0] == 'K' && token[1] == 's' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.specular[0] = r;
+    material.specular[1] = g;
+    material.specular[2] = b;
+    return;
+  }
 
-      // initial temporary material
-      InitMaterial(material);
+  // transmittance
+  if (token[0] == 'K' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.transmittance[0] = r;
+    material.transmittance[1] = g;
+    material.transmittance[2] = b;
+    return;
+  }
 
-      // set new mtl name
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-      material.name = namebuf;
-      continue;
-    }
+  // ior(index of refraction)
+  if (token[0] == 'N' && token[1] == 'i' && IS_SPACE((token[2]))) {
+    token += 2;
+    material.ior = parseFloat(token);
+    return;
+  }
 
-    // ambient
-    if (token[0] == 'K' && token[1] == 'a' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.ambient[0] = r;
-      material.ambient[1] = g;
-      material.ambient[2] = b;
-      continue;
-    }
+  // emission
+  if (token[0] == 'K' && token[1] == 'e' && IS_SPACE(token[2])) {
+    token += 2;
+    float r, g, b;
+    parseFloat3(r, g, b, token);
+    material.emission[0] = r;
+    material.emission[1] = g;
+    material.emission[2] = b;
+    return;
+  }
 
-    // diffuse
-    if (token[0] == 'K' && token[1] == 'd' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.diffuse[0] = r;
-      material.diffuse[1] = g;
-      material.diffuse[2] = b;
-      continue;
-    }
+  // shininess
+  if (token[0] == 'N' && token[1] == 's' && IS_SPACE(token[2])) {
+    token += 2;
+    material.shininess = parseFloat(token);
+    return;
+  }
 
-    // specular
-    if (token[0] == 'K' && token[1] == 's' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.specular[0] = r;
-      material.specular[1] = g;
-      material.specular[2] = b;
-      continue;
-    }
+  // illum model
+  if (0 == strncmp(token, "illum", 5) && IS_SPACE(token[5])) {
+    token += 6;
+    material.illum = parseInt(token);
+    return;
+  }
 
-    // transmittance
-    if (token[0] == 'K' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.transmittance[0] = r;
-      material.transmittance[1] = g;
-      material.transmittance[2] = b;
-      continue;
-    }
+  // dissolve
+  if ((token[0] == 'd' && IS_SPACE(token[1]))) {
+    token += 1;
+    material.dissolve = parseFloat(token);
+    return;
+  }
+  if (token[0] == 'T' && token[1] == 'r' && IS_SPACE(token[2])) {
+    token += 2;
+    // Invert value of Tr(assume Tr is in range [0, 1])
+    material.dissolve = 1.0f - parseFloat(token);
+    return;
+  }
 
-    // ior(index of refraction)
-    if (token[0] == 'N' && token[1] == 'i' && IS_SPACE((token[2]))) {
-      token += 2;
-      material.ior = parseFloat(token);
-      continue;
-    }
+  // ambient texture
+  if ((0 == strncmp(token, "map_Ka", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.ambient_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // emission
-    if (token[0] == 'K' && token[1] == 'e' && IS_SPACE(token[2])) {
-      token += 2;
-      float r, g, b;
-      parseFloat3(r, g, b, token);
-      material.emission[0] = r;
-      material.emission[1] = g;
-      material.emission[2] = b;
-      continue;
-    }
+  // diffuse texture
+  if ((0 == strncmp(token, "map_Kd", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.diffuse_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // shininess
-    if (token[0] == 'N' && token[1] == 's' && IS_SPACE(token[2])) {
-      token += 2;
-      material.shininess = parseFloat(token);
-      continue;
-    }
+  // specular texture
+  if ((0 == strncmp(token, "map_Ks", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.specular_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // illum model
-    if (0 == strncmp(token, "illum", 5) && IS_SPACE(token[5])) {
-      token += 6;
-      material.illum = parseInt(token);
-      continue;
-    }
+  // specular highlight texture
+  if ((0 == strncmp(token, "map_Ns", 6)) && IS_SPACE(token[6])) {
+    token += 7;
+    material.specular_highlight_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // dissolve
-    if ((token[0] == 'd' && IS_SPACE(token[1]))) {
-      token += 1;
-      material.dissolve = parseFloat(token);
-      continue;
-    }
-    if (token[0] == 'T' && token[1] == 'r' && IS_SPACE(token[2])) {
-      token += 2;
-      // Invert value of Tr(assume Tr is in range [0, 1])
-      material.dissolve = 1.0f - parseFloat(token);
-      continue;
-    }
+  // bump texture
+  if ((0 == strncmp(token, "map_bump", 8)) && IS_SPACE(token[8])) {
+    token += 9;
+    material.bump_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // ambient texture
-    if ((0 == strncmp(token, "map_Ka", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.ambient_texname = token;
-      continue;
-    }
+  // alpha texture
+  if ((0 == strncmp(token, "map_d", 5)) && IS_SPACE(token[5])) {
+    token += 6;
+    material.alpha_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // diffuse texture
-    if ((0 == strncmp(token, "map_Kd", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.diffuse_texname = token;
-      continue;
-    }
+  // bump texture
+  if ((0 == strncmp(token, "bump", 4)) && IS_SPACE(token[4])) {
+    token += 5;
+    material.bump_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // specular texture
-    if ((0 == strncmp(token, "map_Ks", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.specular_texname = token;
-      continue;
-    }
+  // displacement texture
+  if ((0 == strncmp(token, "disp", 4)) && IS_SPACE(token[4])) {
+    token += 5;
+    material.displacement_texname.assign(token, lineEnd);
+    return;
+  }
 
-    // specular highlight texture
-    if ((0 == strncmp(token, "map_Ns", 6)) && IS_SPACE(token[6])) {
-      token += 7;
-      material.specular_highlight_texname = token;
-      continue;
-    }
+  // unknown parameter
+  const char *_space = token + strcspn(token, " \r\n");
+  if (*_space != ' ') {
+    _space = token + strcspn(token, "\t\r\n");
+  }
+  if (IS_SPACE(*_space)) {
+    std::ptrdiff_t len = _space - token;
+    std::string key(token, static_cast<size_t>(len));
+    std::string value(_space + 1, lineEnd);
+    material.unknown_parameter.insert(
+        std::pair<std::string, std::string>(key, value));
+  }
+}
 
-    // bump texture
-    if ((0 == strncmp(token, "map_bump", 8)) && IS_SPACE(token[8])) {
-      token += 9;
-      material.bump_texname = token;
-      continue;
-    }
+void LoadMtl(std::map<std::string, int> &material_map,
+             std::vector<material_t> &materials, std::istream &inStream) {
 
-    // alpha texture
-    if ((0 == strncmp(token, "map_d", 5)) && IS_SPACE(token[5])) {
-      token += 6;
-      material.alpha_texname = token;
-      continue;
+  // Create a default material anyway.
+  material_t material;
+  InitMaterial(material);
+
+  size_t maxchars = 8192;          // Alloc enough size.
+  std::vector<char> buf(maxchars); // Alloc enough size.
+  while (inStream.peek() != -1) {
+    inStream.getline(&buf[0], static_cast<std::streamsize>(maxchars));
+
+    std::string linebuf(&buf[0]);
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
     }
 
-    // bump texture
-    if ((0 == strncmp(token, "bump", 4)) && IS_SPACE(token[4])) {
-      token += 5;
-      material.bump_texname = token;
+    // Skip if empty line.
+    if (linebuf.empty()) {
       continue;
     }
 
-    // displacement texture
-    if ((0 == strncmp(token, "disp", 4)) && IS_SPACE(token[4])) {
-      token += 5;
-      material.displacement_texname = token;
+    parseMtlLine(linebuf.c_str(), linebuf.c_str() + linebuf.size(), material,
+                 material_map, materials);
+  }
+  // flush last material.
+  material_map.insert(std::pair<std::string, int>(
+      material.name, static_cast<int>(materials.size())));
+  materials.push_back(material);
+}
+
+void LoadMtl(std::map<std::string, int> &material_map,
+             std::vector<material_t> &materials, const char *buf,
+             size_t len) {
+
+  // Create a default material anyway.
+  material_t material;
+  InitMaterial(material);
+
+  line_reader reader(buf, len);
+  const char *line, *lineEnd;
+  while (reader.next(line, lineEnd)) {
+    // Skip if empty line.
+    if (line == lineEnd) {
       continue;
     }
 
-    // unknown parameter
-    const char *_space = strchr(token, ' ');
-    if (!_space) {
-      _space = strchr(token, '\t');
-    }
-    if (_space) {
-      std::ptrdiff_t len = _space - token;
-      std::string key(token, static_cast<size_t>(len));
-      std::string value = _space + 1;
-      material.unknown_parameter.insert(
-          std::pair<std::string, std::string>(key, value));
-    }
+    parseMtlLine(line, lineEnd, material, material_map, materials);
   }
   // flush last material.
   material_map.insert(std::pair<std::string, int>(
@@ -823,9 +1651,10 @@ bool MaterialFileReader::operator()(const std::string &matId,
     filepath = matId;
   }
 
-  std::ifstream matIStream(filepath.c_str());
-  LoadMtl(matMap, materials, matIStream);
-  if (!matIStream) {
+  mapped_file matFile;
+  bool found = matFile.open(filepath.c_str());
+  LoadMtl(matMap, materials, matFile.data(), matFile.size());
+  if (!found) {
     std::stringstream ss;
     ss << "WARN: Material file [ " << filepath
        << " ] not found. Created a default material.";
@@ -834,305 +1663,2155 @@ bool MaterialFileReader::operator()(const std::string &matId,
   return true;
 }
 
-bool LoadObj(std::vector<shape_t> &shapes,       // [output]
-             std::vector<material_t> &materials, // [output]
-             std::string &err, const char *filename, const char *mtl_basepath,
-             bool trianglulate) {
-
-  shapes.clear();
-
-  std::stringstream errss;
-
-  std::ifstream ifs(filename);
-  if (!ifs) {
-    errss << "Cannot open file [" << filename << "]" << std::endl;
-    err = errss.str();
-    return false;
-  }
-
-  std::string basePath;
-  if (mtl_basepath) {
-    basePath = mtl_basepath;
-  }
-  MaterialFileReader matFileReader(basePath);
+// Faces in every run of this many in a chunk parsed by LoadObjParallel have
+// their first corner recorded, so runs of faces can be split without walking
+// them.
+static const size_t kFaceMark = 4096;
+
+// Faces [face, lastFace) of a chunk parsed by LoadObjParallel, whose corners
+// are [corner, lastCorner). `marks` holds the first corner of every
+// kFaceMark-th face of the chunk.
+struct face_span {
+  const face_group *faces;
+  const std::vector<size_t> *marks;
+  size_t face, lastFace;
+  size_t corner, lastCorner;
+};
 
-  return LoadObj(shapes, materials, err, ifs, matFileReader, trianglulate);
-}
+// A face group whose export LoadObjParallel has deferred. Its faces are left
+// in the chunks they were parsed into.
+struct deferred_export {
+  std::vector<face_span> spans;
+  int material_id;
+};
 
-bool LoadObj(std::vector<shape_t> &shapes,       // [output]
-             std::vector<material_t> &materials, // [output]
-             std::string &err, std::istream &inStream,
-             MaterialReader &readMatFn, bool triangulate) {
-  std::stringstream errss;
+// Parser state carried between the lines of an .obj file.
+struct obj_reader {
+  obj_reader()
+      : material(-1), deferExport(false), consumer(NULL),
+        loadedMaterials(NULL), lodLevels(0) {}
 
   std::vector<float> v;
   std::vector<float> vn;
   std::vector<float> vt;
   std::vector<tag_t> tags;
-  std::vector<std::vector<vertex_index> > faceGroup;
+  face_group faceGroup;
   std::string name;
 
   // material
   std::map<std::string, int> material_map;
-  std::map<vertex_index, unsigned int> vertexCache;
-  int material = -1;
+  export_scratch exportScratch;
+  int material;
 
   shape_t shape;
 
-  int maxchars = 8192;                                  // Alloc enough size.
-  std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size.
-  while (inStream.peek() != -1) {
-    inStream.getline(&buf[0], maxchars);
+  // When set, face groups are queued instead of exported, so that
+  // LoadObjParallel can export each shape on its own thread.
+  // `exports[i]` holds the queued face groups of shapes[i], and `spans` the
+  // faces of the current group.
+  bool deferExport;
+  std::vector<face_span> spans;
+  std::vector<deferred_export> pending;
+  std::vector<std::vector<deferred_export> > exports;
+
+  // When set, every shape is also handed to `consumer` as it is flushed,
+  // along with the materials loaded so far.
+  ShapeConsumer *consumer;
+  const std::vector<material_t> *loadedMaterials;
+
+  // Levels of detail to generate for each shape as it is flushed, unless
+  // its export is deferred.
+  unsigned int lodLevels;
+};
 
-    std::string linebuf(&buf[0]);
+// Exports the current face group into the current shape.
+// Returns false if there was nothing to export.
+static bool flushFaceGroup(obj_reader &r, bool triangulate) {
+  if (!r.deferExport) {
+    return exportFaceGroupToShape(r.shape, r.exportScratch, r.v, r.vn, r.vt,
+                                  r.faceGroup, r.tags, r.material, r.name,
+                                  triangulate);
+  }
 
-    // Trim newline '\r\n' or '\n'
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\n')
-        linebuf.erase(linebuf.size() - 1);
+  if (r.spans.empty()) {
+    return false;
+  }
+  r.pending.push_back(deferred_export());
+  r.pending.back().spans.swap(r.spans);
+  r.pending.back().material_id = r.material;
+  r.shape.name = r.name;
+  r.shape.mesh.tags.swap(r.tags);
+  return true;
+}
+
+// Appends the current shape to `shapes` if `flushed`, then starts a new one.
+static void flushShape(obj_reader &r, std::vector<shape_t> &shapes,
+                       bool flushed) {
+  if (flushed) {
+    shapes.push_back(shape_t());
+    std::swap(shapes.back(), r.shape);
+    if (r.lodLevels > 0 && !r.deferExport) {
+      GenerateLods(shapes.back().mesh, r.lodLevels);
     }
-    if (linebuf.size() > 0) {
-      if (linebuf[linebuf.size() - 1] == '\r')
-        linebuf.erase(linebuf.size() - 1);
+    if (r.consumer) {
+      (*r.consumer)(shapes.back(), *r.loadedMaterials);
     }
-
-    // Skip if empty line.
-    if (linebuf.empty()) {
-      continue;
+    if (r.deferExport) {
+      r.exports.push_back(std::vector<deferred_export>());
+      r.exports.back().swap(r.pending);
     }
+  }
+  r.pending.clear();
+  r.shape = shape_t();
+}
 
-    // Skip leading space.
-    const char *token = linebuf.c_str();
-    token += strspn(token, " \t");
+// Parses a single line of an .obj file.
+// [token, lineEnd) is the line without its newline.
+// Returns false when loading has to stop.
+static bool parseObjLine(obj_reader &r, const char *token,
+                         const char *lineEnd, std::vector<shape_t> &shapes,
+                         std::vector<material_t> &materials,
+                         std::string &err, MaterialReader &readMatFn,
+                         bool triangulate) {
+  (void)lineEnd;
+
+  // Skip leading space.
+  token += strspn(token, " \t");
 
-    assert(token);
-    if (token[0] == '\0')
-      continue; // empty line
+  assert(token);
+  if (IS_NEW_LINE(token[0]))
+    return true; // empty line
+
+  if (token[0] == '#')
+    return true; // comment line
+
+  // vertex
+  if (token[0] == 'v' && IS_SPACE((token[1]))) {
+    token += 2;
+    float x, y, z;
+    parseFloat3(x, y, z, token);
+    r.v.push_back(x);
+    r.v.push_back(y);
+    r.v.push_back(z);
+    return true;
+  }
 
-    if (token[0] == '#')
-      continue; // comment line
+  // normal
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
+    token += 3;
+    float x, y, z;
+    parseFloat3(x, y, z, token);
+    r.vn.push_back(x);
+    r.vn.push_back(y);
+    r.vn.push_back(z);
+    return true;
+  }
 
-    // vertex
-    if (token[0] == 'v' && IS_SPACE((token[1]))) {
-      token += 2;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      v.push_back(x);
-      v.push_back(y);
-      v.push_back(z);
-      continue;
-    }
+  // texcoord
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
+    token += 3;
+    float x, y;
+    parseFloat2(x, y, token);
+    r.vt.push_back(x);
+    r.vt.push_back(y);
+    return true;
+  }
 
-    // normal
-    if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2]))) {
-      token += 3;
-      float x, y, z;
-      parseFloat3(x, y, z, token);
-      vn.push_back(x);
-      vn.push_back(y);
-      vn.push_back(z);
-      continue;
+  // face
+  if (token[0] == 'f' && IS_SPACE((token[1]))) {
+    token += 2;
+    token += strspn(token, " \t");
+
+    unsigned int npolys = 0;
+
+    while (!IS_NEW_LINE(token[0])) {
+      vertex_index vi = parseTriple(token, static_cast<int>(r.v.size() / 3),
+                                    static_cast<int>(r.vn.size() / 3),
+                                    static_cast<int>(r.vt.size() / 2));
+      r.faceGroup.corners.push_back(vi);
+      npolys++;
+      size_t n = strspn(token, " \t\r");
+      token += n;
     }
 
-    // texcoord
-    if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2]))) {
-      token += 3;
-      float x, y;
-      parseFloat2(x, y, token);
-      vt.push_back(x);
-      vt.push_back(y);
-      continue;
+    r.faceGroup.sizes.push_back(npolys);
+
+    return true;
+  }
+
+  // use mtl
+  if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+    token += 7;
+    std::string namebuf = parseString(token);
+
+    int newMaterialId = -1;
+    if (r.material_map.find(namebuf) != r.material_map.end()) {
+      newMaterialId = r.material_map[namebuf];
+    } else {
+      // { error!! material not found }
     }
 
-    // face
-    if (token[0] == 'f' && IS_SPACE((token[1]))) {
-      token += 2;
-      token += strspn(token, " \t");
+    if (newMaterialId != r.material) {
+      // Create per-face material
+      flushFaceGroup(r, triangulate);
+      r.faceGroup.clear();
+      r.material = newMaterialId;
+    }
 
-      std::vector<vertex_index> face;
-      face.reserve(3);
+    return true;
+  }
 
-      while (!IS_NEW_LINE(token[0])) {
-        vertex_index vi = parseTriple(token, static_cast<int>(v.size() / 3),
-                                      static_cast<int>(vn.size() / 3),
-                                      static_cast<int>(vt.size() / 2));
-        face.push_back(vi);
-        size_t n = strspn(token, " \t\r");
-        token += n;
-      }
+  // load mtl
+  if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
+    token += 7;
+    std::string namebuf = parseString(token);
 
-      // replace with emplace_back + std::move on C++11
-      faceGroup.push_back(std::vector<vertex_index>());
-      faceGroup[faceGroup.size() - 1].swap(face);
+    std::string err_mtl;
+    bool ok = readMatFn(namebuf, materials, r.material_map, err_mtl);
+    err += err_mtl;
 
-      continue;
+    if (!ok) {
+      r.faceGroup.clear(); // for safety
+      return false;
     }
 
-    // use mtl
-    if ((0 == strncmp(token, "usemtl", 6)) && IS_SPACE((token[6]))) {
+    return true;
+  }
 
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
+  // group name
+  if (token[0] == 'g' && IS_SPACE((token[1]))) {
 
-      int newMaterialId = -1;
-      if (material_map.find(namebuf) != material_map.end()) {
-        newMaterialId = material_map[namebuf];
-      } else {
-        // { error!! material not found }
-      }
+    // flush previous face group.
+    bool ret = flushFaceGroup(r, triangulate);
+    flushShape(r, shapes, ret);
 
-      if (newMaterialId != material) {
-        // Create per-face material
-        exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                               material, name, true, triangulate);
-        faceGroup.clear();
-        material = newMaterialId;
-      }
+    // material = -1;
+    r.faceGroup.clear();
 
-      continue;
+    std::vector<std::string> names;
+    names.reserve(2);
+
+    while (!IS_NEW_LINE(token[0])) {
+      std::string str = parseString(token);
+      names.push_back(str);
+      token += strspn(token, " \t\r"); // skip tag
     }
 
-    // load mtl
-    if ((0 == strncmp(token, "mtllib", 6)) && IS_SPACE((token[6]))) {
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 7;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
+    assert(names.size() > 0);
 
-      std::string err_mtl;
-      bool ok = readMatFn(namebuf, materials, material_map, err_mtl);
-      err += err_mtl;
+    // names[0] must be 'g', so skip the 0th element.
+    if (names.size() > 1) {
+      r.name = names[1];
+    } else {
+      r.name = "";
+    }
 
-      if (!ok) {
-        faceGroup.clear(); // for safety
-        return false;
-      }
+    return true;
+  }
 
-      continue;
-    }
+  // object name
+  if (token[0] == 'o' && IS_SPACE((token[1]))) {
 
-    // group name
-    if (token[0] == 'g' && IS_SPACE((token[1]))) {
+    // flush previous face group.
+    bool ret = flushFaceGroup(r, triangulate);
+    flushShape(r, shapes, ret);
 
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, triangulate);
-      if (ret) {
-        shapes.push_back(shape);
-      }
+    // material = -1;
+    r.faceGroup.clear();
 
-      shape = shape_t();
+    // @todo { multiple object name? }
+    token += 2;
+    r.name = parseString(token);
 
-      // material = -1;
-      faceGroup.clear();
+    return true;
+  }
 
-      std::vector<std::string> names;
-      names.reserve(2);
+  if (token[0] == 't' && IS_SPACE(token[1])) {
+    tag_t tag;
 
-      while (!IS_NEW_LINE(token[0])) {
-        std::string str = parseString(token);
-        names.push_back(str);
-        token += strspn(token, " \t\r"); // skip tag
-      }
+    token += 2;
+    const char *tagName = token;
+    tag.name = parseString(token);
 
-      assert(names.size() > 0);
+    token = tagName + tag.name.size() + 1;
 
-      // names[0] must be 'g', so skip the 0th element.
-      if (names.size() > 1) {
-        name = names[1];
-      } else {
-        name = "";
-      }
+    tag_sizes ts = parseTagTriple(token);
 
-      continue;
+    tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
+      tag.intValues[i] = atoi(token);
+      token += strcspn(token, "/ \t\r\n") + 1;
     }
 
-    // object name
-    if (token[0] == 'o' && IS_SPACE((token[1]))) {
+    tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
+      tag.floatValues[i] = parseFloat(token);
+      token += strcspn(token, "/ \t\r\n") + 1;
+    }
 
-      // flush previous face group.
-      bool ret =
-          exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup, tags,
-                                 material, name, true, triangulate);
-      if (ret) {
-        shapes.push_back(shape);
-      }
+    tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
+    for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
+      const char *stringValue = token;
+      tag.stringValues[i] = parseString(token);
+      token = stringValue + tag.stringValues[i].size() + 1;
+    }
 
-      // material = -1;
-      faceGroup.clear();
-      shape = shape_t();
+    r.tags.push_back(tag);
+  }
 
-      // @todo { multiple object name? }
-      char namebuf[TINYOBJ_SSCANF_BUFFER_SIZE];
-      token += 2;
-#ifdef _MSC_VER
-      sscanf_s(token, "%s", namebuf, (unsigned)_countof(namebuf));
-#else
-      sscanf(token, "%s", namebuf);
-#endif
-      name = std::string(namebuf);
+  // Ignore unknown command.
+  return true;
+}
 
-      continue;
-    }
+// Flushes the last face group once every line has been parsed.
+static void finishObj(obj_reader &r, std::vector<shape_t> &shapes,
+                      bool triangulate) {
+  bool ret = flushFaceGroup(r, triangulate);
+  flushShape(r, shapes, ret);
+  r.faceGroup.clear(); // for safety
+}
 
-    if (token[0] == 't' && IS_SPACE(token[1])) {
-      tag_t tag;
+void InterleaveMesh(const mesh_t &mesh, std::vector<float> &vertices,
+                    vertex_layout_t &layout, bool all_attributes) {
+  size_t numVertices = mesh.positions.size() / 3;
+  bool hasNormals = numVertices > 0 && mesh.normals.size() == 3 * numVertices;
+  bool hasTexcoords =
+      numVertices > 0 && mesh.texcoords.size() == 2 * numVertices;
+  bool normals = hasNormals || all_attributes;
+  bool texcoords = hasTexcoords || all_attributes;
+
+  size_t width = 3;
+  layout.position_offset = 0;
+  layout.normal_offset = -1;
+  layout.texcoord_offset = -1;
+  if (normals) {
+    layout.normal_offset = static_cast<int>(width * sizeof(float));
+    width += 3;
+  }
+  if (texcoords) {
+    layout.texcoord_offset = static_cast<int>(width * sizeof(float));
+    width += 2;
+  }
+  layout.stride = static_cast<unsigned int>(width * sizeof(float));
+
+  vertices.resize(width * numVertices);
+  float *out = vertices.data();
+  for (size_t i = 0; i < numVertices; i++) {
+    *out++ = mesh.positions[3 * i + 0];
+    *out++ = mesh.positions[3 * i + 1];
+    *out++ = mesh.positions[3 * i + 2];
+    if (hasNormals) {
+      *out++ = mesh.normals[3 * i + 0];
+      *out++ = mesh.normals[3 * i + 1];
+      *out++ = mesh.normals[3 * i + 2];
+    } else if (normals) {
+      *out++ = 0.0f;
+      *out++ = 0.0f;
+      *out++ = 0.0f;
+    }
+    if (hasTexcoords) {
+      *out++ = mesh.texcoords[2 * i + 0];
+      *out++ = mesh.texcoords[2 * i + 1];
+    } else if (texcoords) {
+      *out++ = 0.0f;
+      *out++ = 0.0f;
+    }
+  }
+}
 
-      char namebuf[4096];
-      token += 2;
-      sscanf(token, "%s", namebuf);
-      tag.name = std::string(namebuf);
+// Converts to IEEE half precision, rounding to nearest even.
+static unsigned short FloatToHalf(float f) {
+  unsigned int x;
+  memcpy(&x, &f, sizeof(x));
+  unsigned int sign = (x >> 16) & 0x8000;
+  unsigned int biased = (x >> 23) & 0xff;
+  unsigned int mantissa = x & 0x7fffff;
+  if (biased == 0xff) { // infinity or NaN
+    return static_cast<unsigned short>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+  }
+  int exponent = static_cast<int>(biased) - 127 + 15;
+  if (exponent >= 31) { // too large, becomes infinity
+    return static_cast<unsigned short>(sign | 0x7c00);
+  }
+  unsigned int shift = 13;
+  unsigned int half = 0;
+  if (exponent <= 0) { // subnormal half, or zero
+    if (exponent < -10) {
+      return static_cast<unsigned short>(sign);
+    }
+    mantissa |= 0x800000;
+    shift = static_cast<unsigned int>(14 - exponent);
+  } else {
+    half = static_cast<unsigned int>(exponent) << 10;
+  }
+  half |= mantissa >> shift;
+  unsigned int rest = mantissa & ((1u << shift) - 1);
+  unsigned int halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) {
+    half++; // may carry into the exponent, which is still correct
+  }
+  return static_cast<unsigned short>(sign | half);
+}
 
-      token += tag.name.size() + 1;
+static float HalfToFloat(unsigned short h) {
+  float sign = (h & 0x8000) ? -1.0f : 1.0f;
+  int exponent = (h >> 10) & 0x1f;
+  int mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    return sign * std::ldexp(static_cast<float>(mantissa), -24);
+  }
+  if (exponent == 31) {
+    return mantissa ? NAN : sign * INFINITY;
+  }
+  return sign * std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+}
 
-      tag_sizes ts = parseTagTriple(token);
+// Encodes a direction onto the octahedron, unfolded onto [-1, 1]^2.
+static void OctahedralEncode(const float n[3], short out[2]) {
+  float l1 = std::fabs(n[0]) + std::fabs(n[1]) + std::fabs(n[2]);
+  float x = 0.0f, y = 0.0f;
+  if (l1 > 0.0f) {
+    x = n[0] / l1;
+    y = n[1] / l1;
+    if (n[2] < 0.0f) {
+      float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+      float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+      x = fx;
+      y = fy;
+    }
+  }
+  out[0] = static_cast<short>(
+      std::floor(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f + 0.5f));
+  out[1] = static_cast<short>(
+      std::floor(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f + 0.5f));
+}
 
-      tag.intValues.resize(static_cast<size_t>(ts.num_ints));
+// Decodes OctahedralEncode output to a unit direction, as shaders do.
+static void OctahedralDecode(const short in[2], float n[3]) {
+  float x = std::max(in[0] / 32767.0f, -1.0f);
+  float y = std::max(in[1] / 32767.0f, -1.0f);
+  float z = 1.0f - std::fabs(x) - std::fabs(y);
+  if (z < 0.0f) {
+    float fx = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+    float fy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+    x = fx;
+    y = fy;
+  }
+  float length = std::sqrt(x * x + y * y + z * z);
+  n[0] = x / length;
+  n[1] = y / length;
+  n[2] = z / length;
+}
 
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_ints); ++i) {
-        tag.intValues[i] = atoi(token);
-        token += strcspn(token, "/ \t\r") + 1;
+void CompressMesh(const mesh_t &mesh, std::vector<compact_vertex_t> &vertices,
+                  compression_t &compression) {
+  size_t numVertices = mesh.positions.size() / 3;
+  bool hasNormals = numVertices > 0 && mesh.normals.size() == 3 * numVertices;
+  bool hasTexcoords =
+      numVertices > 0 && mesh.texcoords.size() == 2 * numVertices;
+
+  // Bounding box of the positions
+  float lower[3] = {0.0f, 0.0f, 0.0f};
+  float upper[3] = {0.0f, 0.0f, 0.0f};
+  for (size_t i = 0; i < numVertices; i++) {
+    for (int k = 0; k < 3; k++) {
+      float p = mesh.positions[3 * i + k];
+      lower[k] = (i == 0) ? p : std::min(lower[k], p);
+      upper[k] = (i == 0) ? p : std::max(upper[k], p);
+    }
+  }
+  for (int k = 0; k < 3; k++) {
+    compression.position_offset[k] = lower[k];
+    compression.position_scale[k] = upper[k] - lower[k];
+  }
+  compression.position_error = 0.0f;
+  compression.normal_error = 0.0f;
+  compression.texcoord_error = 0.0f;
+
+  vertices.resize(numVertices);
+  for (size_t i = 0; i < numVertices; i++) {
+    compact_vertex_t &v = vertices[i];
+
+    float positionError = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      float p = mesh.positions[3 * i + k];
+      float scale = compression.position_scale[k];
+      float q = (scale > 0.0f) ? (p - lower[k]) / scale : 0.0f;
+      v.position[k] = static_cast<unsigned short>(
+          std::floor(std::max(0.0f, std::min(1.0f, q)) * 65535.0f + 0.5f));
+      float decoded = lower[k] + scale * (v.position[k] / 65535.0f);
+      positionError += (decoded - p) * (decoded - p);
+    }
+    v.position[3] = 0;
+    compression.position_error =
+        std::max(compression.position_error, std::sqrt(positionError));
+
+    v.normal[0] = v.normal[1] = 0;
+    if (hasNormals) {
+      const float *n = &mesh.normals[3 * i];
+      OctahedralEncode(n, v.normal);
+      float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      if (length > 0.0f) {
+        float decoded[3];
+        OctahedralDecode(v.normal, decoded);
+        float cosine =
+            (decoded[0] * n[0] + decoded[1] * n[1] + decoded[2] * n[2]) /
+            length;
+        float angle = std::acos(std::max(-1.0f, std::min(1.0f, cosine)));
+        compression.normal_error =
+            std::max(compression.normal_error,
+                     angle * 180.0f / static_cast<float>(M_PI));
       }
+    }
 
-      tag.floatValues.resize(static_cast<size_t>(ts.num_floats));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_floats); ++i) {
-        tag.floatValues[i] = parseFloat(token);
-        token += strcspn(token, "/ \t\r") + 1;
+    v.texcoord[0] = v.texcoord[1] = 0;
+    if (hasTexcoords) {
+      for (int k = 0; k < 2; k++) {
+        float t = mesh.texcoords[2 * i + k];
+        v.texcoord[k] = FloatToHalf(t);
+        compression.texcoord_error =
+            std::max(compression.texcoord_error,
+                     std::fabs(HalfToFloat(v.texcoord[k]) - t));
       }
+    }
+  }
+}
 
-      tag.stringValues.resize(static_cast<size_t>(ts.num_strings));
-      for (size_t i = 0; i < static_cast<size_t>(ts.num_strings); ++i) {
-        char stringValueBuffer[4096];
+// Symmetric 4x4 matrix of a quadric error metric: the sum of the squared
+// distances of a point to a set of planes. Stored as its upper triangle,
+// xx xy xz xw yy yz yw zz zw ww.
+struct quadric {
+  quadric() {
+    for (int i = 0; i < 10; i++) {
+      a[i] = 0.0;
+    }
+  }
 
-        sscanf(token, "%s", stringValueBuffer);
-        tag.stringValues[i] = stringValueBuffer;
-        token += tag.stringValues[i].size() + 1;
-      }
+  void addPlane(double nx, double ny, double nz, double d) {
+    a[0] += nx * nx;
+    a[1] += nx * ny;
+    a[2] += nx * nz;
+    a[3] += nx * d;
+    a[4] += ny * ny;
+    a[5] += ny * nz;
+    a[6] += ny * d;
+    a[7] += nz * nz;
+    a[8] += nz * d;
+    a[9] += d * d;
+  }
 
-      tags.push_back(tag);
+  void add(const quadric &other) {
+    for (int i = 0; i < 10; i++) {
+      a[i] += other.a[i];
     }
-
-    // Ignore unknown command.
   }
 
-  bool ret = exportFaceGroupToShape(shape, vertexCache, v, vn, vt, faceGroup,
-                                    tags, material, name, true, triangulate);
-  if (ret) {
-    shapes.push_back(shape);
+  // Sum of the squared distances of p to the planes, with other's planes.
+  double error(const quadric &other, const float *p) const {
+    double q[10];
+    for (int i = 0; i < 10; i++) {
+      q[i] = a[i] + other.a[i];
+    }
+    double x = p[0], y = p[1], z = p[2];
+    double e = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z +
+               2.0 * q[3] * x + q[4] * y * y + 2.0 * q[5] * y * z +
+               2.0 * q[6] * y + q[7] * z * z + 2.0 * q[8] * z + q[9];
+    return std::max(e, 0.0);
   }
-  faceGroup.clear(); // for safety
 
-  err += errss.str();
-  return true;
+  double a[10];
+};
+
+// Unnormalised normal of the triangle a, b, c.
+static void triangleNormal(const float *a, const float *b, const float *c,
+                           double n[3]) {
+  double u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+  double v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+  n[0] = u[1] * v[2] - u[2] * v[1];
+  n[1] = u[2] * v[0] - u[0] * v[2];
+  n[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// An edge of a triangle, for finding borders.
+struct lod_edge {
+  unsigned int lo, hi;
+  int material;
+
+  bool operator<(const lod_edge &other) const {
+    if (lo != other.lo) {
+      return lo < other.lo;
+    }
+    if (hi != other.hi) {
+      return hi < other.hi;
+    }
+    return material < other.material;
+  }
+};
+
+// A vertex collapse onto a neighbour, and its quadric error.
+struct lod_collapse {
+  double cost;
+  unsigned int from, to;
+
+  bool operator<(const lod_collapse &other) const {
+    return cost < other.cost;
+  }
+};
+
+// Collapses edges of the triangles `indices` (with per-triangle `materials`)
+// until there are at most `target` triangles or no edge can be collapsed.
+// Each pass tries only the cheapest edges, about as many as the collapses
+// still needed, with at most one collapse per neighbourhood so the costs and
+// flip tests of a pass stay valid. Vertices move onto neighbours, never to
+// new positions. `error` is raised to the largest collapse error.
+static void collapseEdges(const float *positions,
+                          std::vector<quadric> &quadrics,
+                          const std::vector<unsigned char> &locked,
+                          std::vector<unsigned int> &indices,
+                          std::vector<int> &materials, size_t target,
+                          float &error) {
+  size_t numVertices = quadrics.size();
+  std::vector<size_t> first(numVertices + 1);
+  std::vector<unsigned int> adjacent;
+  std::vector<lod_collapse> collapses;
+  std::vector<unsigned char> touched;
+
+  while (indices.size() / 3 > target) {
+    size_t numTriangles = indices.size() / 3;
+
+    // Triangles around each vertex, as ranges of one array
+    std::fill(first.begin(), first.end(), 0);
+    for (size_t i = 0; i < indices.size(); i++) {
+      first[indices[i] + 1]++;
+    }
+    for (size_t v = 0; v < numVertices; v++) {
+      first[v + 1] += first[v];
+    }
+    adjacent.resize(indices.size());
+    std::vector<size_t> filled(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) {
+      adjacent[filled[indices[i]]++] = static_cast<unsigned int>(i / 3);
+    }
+
+    // The cheaper direction of every edge that has one
+    collapses.clear();
+    for (size_t i = 0; i < indices.size(); i++) {
+      unsigned int a = indices[i];
+      unsigned int b = indices[i - i % 3 + (i + 1) % 3];
+      if (a > b || (locked[a] && locked[b])) {
+        continue;
+      }
+      lod_collapse c;
+      double ab = locked[a] ? DBL_MAX
+                            : quadrics[a].error(quadrics[b], &positions[3 * b]);
+      double ba = locked[b] ? DBL_MAX
+                            : quadrics[b].error(quadrics[a], &positions[3 * a]);
+      c.cost = std::min(ab, ba);
+      c.from = (ab <= ba) ? a : b;
+      c.to = (ab <= ba) ? b : a;
+      collapses.push_back(c);
+    }
+    // Each collapse removes about two triangles
+    size_t tries = std::min(collapses.size(), (numTriangles - target) / 2 + 1);
+    std::partial_sort(collapses.begin(), collapses.begin() + tries,
+                      collapses.end());
+
+    touched.assign(numVertices, 0);
+    size_t removed = 0;
+    for (size_t i = 0; i < tries && removed < numTriangles - target; i++) {
+      const lod_collapse &c = collapses[i];
+      if (touched[c.from] || touched[c.to]) {
+        continue;
+      }
+
+      // Reject collapses that would turn a triangle over
+      bool flips = false;
+      for (size_t j = first[c.from]; j < first[c.from + 1] && !flips; j++) {
+        const unsigned int *t = &indices[3 * adjacent[j]];
+        if (t[0] == c.to || t[1] == c.to || t[2] == c.to) {
+          continue;
+        }
+        const float *p[3], *q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = &positions[3 * t[k]];
+          q[k] = (t[k] == c.from) ? &positions[3 * c.to] : p[k];
+        }
+        double before[3], after[3];
+        triangleNormal(p[0], p[1], p[2], before);
+        triangleNormal(q[0], q[1], q[2], after);
+        flips = before[0] * after[0] + before[1] * after[1] +
+                    before[2] * after[2] <
+                0.0;
+      }
+      if (flips) {
+        continue;
+      }
+
+      quadrics[c.to].add(quadrics[c.from]);
+      touched[c.from] = touched[c.to] = 1;
+      for (size_t j = first[c.from]; j < first[c.from + 1]; j++) {
+        unsigned int *t = &indices[3 * adjacent[j]];
+        bool collapsed = t[0] == c.to || t[1] == c.to || t[2] == c.to;
+        for (int k = 0; k < 3; k++) {
+          if (t[k] == c.from) {
+            t[k] = c.to;
+          }
+          touched[t[k]] = 1;
+        }
+        removed += collapsed ? 1 : 0;
+      }
+      error = std::max(error, static_cast<float>(std::sqrt(c.cost)));
+    }
+    if (removed == 0) {
+      return;
+    }
+
+    // Drop the triangles that collapsed
+    size_t kept = 0;
+    for (size_t t = 0; t < numTriangles; t++) {
+      const unsigned int *v = &indices[3 * t];
+      if (v[0] == v[1] || v[1] == v[2] || v[2] == v[0]) {
+        continue;
+      }
+      std::copy(v, v + 3, &indices[3 * kept]);
+      materials[kept] = materials[t];
+      kept++;
+    }
+    indices.resize(3 * kept);
+    materials.resize(kept);
+  }
+}
+
+void GenerateLods(mesh_t &mesh, unsigned int levels) {
+  mesh.lods.clear();
+  size_t numFaces = mesh.num_vertices.size();
+  size_t numVertices = mesh.positions.size() / 3;
+  if (levels == 0 || numFaces == 0 || mesh.indices.size() != 3 * numFaces) {
+    return;
+  }
+  for (size_t f = 0; f < numFaces; f++) {
+    if (mesh.num_vertices[f] != 3) {
+      return;
+    }
+  }
+  const float *positions = mesh.positions.data();
+  std::vector<unsigned int> indices(mesh.indices);
+  std::vector<int> materials(mesh.material_ids);
+  materials.resize(numFaces, -1);
+
+  // Quadrics of the planes of the triangles around each vertex
+  std::vector<quadric> quadrics(numVertices);
+  for (size_t f = 0; f < numFaces; f++) {
+    const unsigned int *t = &indices[3 * f];
+    double n[3];
+    triangleNormal(&positions[3 * t[0]], &positions[3 * t[1]],
+                   &positions[3 * t[2]], n);
+    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0) {
+      continue;
+    }
+    for (int k = 0; k < 3; k++) {
+      n[k] /= length;
+    }
+    const float *p = &positions[3 * t[0]];
+    double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+    for (int k = 0; k < 3; k++) {
+      quadrics[t[k]].addPlane(n[0], n[1], n[2], d);
+    }
+  }
+
+  // Lock the ends of every edge that is not shared by exactly two triangles
+  // of one material: borders, seams (where vertices are split) and material
+  // boundaries
+  std::vector<lod_edge> edges(indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    unsigned int a = indices[i];
+    unsigned int b = indices[i - i % 3 + (i + 1) % 3];
+    edges[i].lo = std::min(a, b);
+    edges[i].hi = std::max(a, b);
+    edges[i].material = materials[i / 3];
+  }
+  std::sort(edges.begin(), edges.end());
+  std::vector<unsigned char> locked(numVertices, 0);
+  for (size_t i = 0; i < edges.size();) {
+    size_t j = i + 1;
+    while (j < edges.size() && edges[j].lo == edges[i].lo &&
+           edges[j].hi == edges[i].hi) {
+      j++;
+    }
+    if (j - i != 2 || edges[i].material != edges[i + 1].material) {
+      locked[edges[i].lo] = locked[edges[i].hi] = 1;
+    }
+    i = j;
+  }
+
+  float error = 0.0f;
+  for (unsigned int level = 1; level <= levels; level++) {
+    size_t previous = indices.size() / 3;
+    collapseEdges(positions, quadrics, locked, indices, materials,
+                  numFaces >> level, error);
+    // A level that saves under a tenth of the triangles is not worth
+    // keeping, and one without triangles would make the shape vanish
+    if (indices.size() / 3 * 10 > previous * 9 || indices.empty()) {
+      break;
+    }
+    mesh.lods.push_back(mesh_lod_t());
+    mesh.lods.back().indices = indices;
+    mesh.lods.back().material_ids = materials;
+    mesh.lods.back().error = error;
+  }
+}
+
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, const char *filename, const char *mtl_basepath,
+             bool trianglulate) {
+
+  shapes.clear();
+
+  std::stringstream errss;
+
+  std::ifstream ifs(filename);
+  if (!ifs) {
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
+  }
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
+
+  return LoadObj(shapes, materials, err, ifs, matFileReader, trianglulate);
+}
+
+bool LoadObj(std::vector<shape_t> &shapes,       // [output]
+             std::vector<material_t> &materials, // [output]
+             std::string &err, std::istream &inStream,
+             MaterialReader &readMatFn, bool triangulate) {
+  std::stringstream errss;
+
+  obj_reader reader;
+
+  int maxchars = 8192;                                  // Alloc enough size.
+  std::vector<char> buf(static_cast<size_t>(maxchars)); // Alloc enough size.
+  while (inStream.peek() != -1) {
+    inStream.getline(&buf[0], maxchars);
+
+    std::string linebuf(&buf[0]);
+
+    // Trim newline '\r\n' or '\n'
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\n')
+        linebuf.erase(linebuf.size() - 1);
+    }
+    if (linebuf.size() > 0) {
+      if (linebuf[linebuf.size() - 1] == '\r')
+        linebuf.erase(linebuf.size() - 1);
+    }
+
+    // Skip if empty line.
+    if (linebuf.empty()) {
+      continue;
+    }
+
+    if (!parseObjLine(reader, linebuf.c_str(),
+                      linebuf.c_str() + linebuf.size(), shapes, materials,
+                      err, readMatFn, triangulate)) {
+      return false;
+    }
+  }
+
+  finishObj(reader, shapes, triangulate);
+
+  err += errss.str();
+  return true;
+}
+
+// Record types the sizing pass and the parallel loader tell apart.
+enum obj_record { RECORD_NONE, RECORD_V, RECORD_VN, RECORD_VT, RECORD_F,
+                  RECORD_OTHER };
+
+// Classifies a line the same way parseObjLine dispatches it.
+static obj_record classifyObjLine(const char *token) {
+  token += strspn(token, " \t");
+  if (IS_NEW_LINE(token[0]) || token[0] == '#')
+    return RECORD_NONE;
+  if (token[0] == 'v' && IS_SPACE((token[1])))
+    return RECORD_V;
+  if (token[0] == 'v' && token[1] == 'n' && IS_SPACE((token[2])))
+    return RECORD_VN;
+  if (token[0] == 'v' && token[1] == 't' && IS_SPACE((token[2])))
+    return RECORD_VT;
+  if (token[0] == 'f' && IS_SPACE((token[1])))
+    return RECORD_F;
+  return RECORD_OTHER;
+}
+
+// Counts the v/vn/vt records in `len` bytes of .obj at `buf`, so the
+// vertex arrays can be sized before they are filled.
+static void countObjRecords(const char *buf, size_t len, size_t &num_v,
+                            size_t &num_vn, size_t &num_vt) {
+  line_reader lines(buf, len);
+  const char *line, *lineEnd;
+  while (lines.next(line, lineEnd)) {
+    switch (classifyObjLine(line)) {
+    case RECORD_V:
+      num_v++;
+      break;
+    case RECORD_VN:
+      num_vn++;
+      break;
+    case RECORD_VT:
+      num_vt++;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Parses `len` bytes of .obj at `buf` line by line with `reader`.
+static bool parseObjBuffer(obj_reader &reader, std::vector<shape_t> &shapes,
+                           std::vector<material_t> &materials,
+                           std::string &err, const char *buf, size_t len,
+                           MaterialReader &readMatFn, bool triangulate) {
+  line_reader lines(buf, len);
+  const char *line, *lineEnd;
+  while (lines.next(line, lineEnd)) {
+    // Skip if empty line.
+    if (line == lineEnd) {
+      continue;
+    }
+
+    if (!parseObjLine(reader, line, lineEnd, shapes, materials, err,
+                      readMatFn, triangulate)) {
+      return false;
+    }
+  }
+
+  finishObj(reader, shapes, triangulate);
+  return true;
+}
+
+bool LoadObjFromMemory(std::vector<shape_t> &shapes,       // [output]
+                       std::vector<material_t> &materials, // [output]
+                       std::string &err, const char *buf, size_t len,
+                       MaterialReader &readMatFn, bool triangulate) {
+  // Size the vertex arrays up front rather than growing them line by line.
+  size_t num_v = 0, num_vn = 0, num_vt = 0;
+  countObjRecords(buf, len, num_v, num_vn, num_vt);
+
+  obj_reader reader;
+  reader.v.reserve(3 * num_v);
+  reader.vn.reserve(3 * num_vn);
+  reader.vt.reserve(2 * num_vt);
+  return parseObjBuffer(reader, shapes, materials, err, buf, len, readMatFn,
+                        triangulate);
+}
+
+bool LoadObjMapped(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err, const char *filename,
+                   const char *mtl_basepath, bool triangulate) {
+
+  shapes.clear();
+
+  mapped_file file;
+  if (!file.open(filename)) {
+    std::stringstream errss;
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
+  }
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
+
+  return LoadObjFromMemory(shapes, materials, err, file.data(), file.size(),
+                           matFileReader, triangulate);
+}
+
+#ifndef TINYOBJLOADER_NO_THREADS
+
+// Calls fn(i) for every i in [0, count) on up to `numThreads` threads.
+template <typename Fn>
+static void parallelFor(size_t count, unsigned int numThreads, Fn fn) {
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned int t = 1; t < numThreads && t < count; t++) {
+    workers.push_back(std::thread(work));
+  }
+  work();
+  for (size_t t = 0; t < workers.size(); t++) {
+    workers[t].join();
+  }
+}
+
+// One line-aligned slice of the file, parsed on a worker thread.
+struct obj_chunk {
+  obj_chunk()
+      : begin(NULL), end(NULL), num_v(0), num_vn(0), num_vt(0), v_base(0),
+        vn_base(0), vt_base(0) {}
+
+  const char *begin;
+  const char *end;
+
+  // v/vn/vt records in this chunk, and in all chunks before it.
+  size_t num_v, num_vn, num_vt;
+  size_t v_base, vn_base, vt_base;
+
+  face_group faces;
+
+  // First corner of every kFaceMark-th face.
+  std::vector<size_t> faceMarks;
+
+  // Every other line (g, o, usemtl, mtllib, t, ...), with the number of
+  // faces in this chunk that precede it. These are replayed in order.
+  // `eventCorners` holds the number of corners preceding each.
+  std::vector<std::pair<size_t, std::string> > events;
+  std::vector<size_t> eventCorners;
+};
+
+// First pass: counts the v/vn/vt records of a chunk.
+static void countObjChunk(obj_chunk &chunk) {
+  countObjRecords(chunk.begin, static_cast<size_t>(chunk.end - chunk.begin),
+                  chunk.num_v, chunk.num_vn, chunk.num_vt);
+}
+
+// Second pass: parses the records of a chunk. Vertex data is written
+// straight to its final place in v/vn/vt; faces see the same record counts
+// the serial parser would, so relative indices resolve identically.
+static void parseObjChunk(obj_chunk &chunk, std::vector<float> &v,
+                          std::vector<float> &vn, std::vector<float> &vt) {
+  size_t iv = chunk.v_base, ivn = chunk.vn_base, ivt = chunk.vt_base;
+
+  line_reader lines(chunk.begin, static_cast<size_t>(chunk.end - chunk.begin));
+  const char *line, *lineEnd;
+  while (lines.next(line, lineEnd)) {
+    if (line == lineEnd) {
+      continue;
+    }
+
+    obj_record kind = classifyObjLine(line);
+    const char *token = line + strspn(line, " \t");
+
+    switch (kind) {
+    case RECORD_V:
+      token += 2;
+      parseFloat3(v[3 * iv + 0], v[3 * iv + 1], v[3 * iv + 2], token);
+      iv++;
+      break;
+    case RECORD_VN:
+      token += 3;
+      parseFloat3(vn[3 * ivn + 0], vn[3 * ivn + 1], vn[3 * ivn + 2], token);
+      ivn++;
+      break;
+    case RECORD_VT:
+      token += 3;
+      parseFloat2(vt[2 * ivt + 0], vt[2 * ivt + 1], token);
+      ivt++;
+      break;
+    case RECORD_F: {
+      token += 2;
+      token += strspn(token, " \t");
+
+      if (chunk.faces.sizes.size() % kFaceMark == 0) {
+        chunk.faceMarks.push_back(chunk.faces.corners.size());
+      }
+      unsigned int npolys = 0;
+      while (!IS_NEW_LINE(token[0])) {
+        vertex_index vi =
+            parseTriple(token, static_cast<int>(iv), static_cast<int>(ivn),
+                        static_cast<int>(ivt));
+        chunk.faces.corners.push_back(vi);
+        npolys++;
+        token += strspn(token, " \t\r");
+      }
+      chunk.faces.sizes.push_back(npolys);
+      break;
+    }
+    case RECORD_OTHER:
+      chunk.events.push_back(std::pair<size_t, std::string>(
+          chunk.faces.sizes.size(), std::string(line, lineEnd)));
+      chunk.eventCorners.push_back(chunk.faces.corners.size());
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Adds faces [face, lastFace) of `chunk`, whose corners end at `lastCorner`,
+// to the current group of `r`.
+static void addChunkSpan(obj_reader &r, const obj_chunk &chunk, size_t &face,
+                         size_t &corner, size_t lastFace, size_t lastCorner) {
+  if (lastFace > face) {
+    face_span span = {&chunk.faces, &chunk.faceMarks, face, lastFace,
+                      corner, lastCorner};
+    r.spans.push_back(span);
+  }
+  face = lastFace;
+  corner = lastCorner;
+}
+
+static size_t countCorners(const std::vector<face_span> &spans) {
+  size_t n = 0;
+  for (size_t i = 0; i < spans.size(); i++) {
+    n += spans[i].lastCorner - spans[i].corner;
+  }
+  return n;
+}
+
+// Copies the faces of `spans` into `faceGroup`, for exportFaces.
+static void gatherFaces(face_group &faceGroup,
+                        const std::vector<face_span> &spans) {
+  faceGroup.clear();
+  for (size_t i = 0; i < spans.size(); i++) {
+    const face_span &s = spans[i];
+    faceGroup.sizes.insert(
+        faceGroup.sizes.end(),
+        s.faces->sizes.begin() + static_cast<std::ptrdiff_t>(s.face),
+        s.faces->sizes.begin() + static_cast<std::ptrdiff_t>(s.lastFace));
+    faceGroup.corners.insert(
+        faceGroup.corners.end(),
+        s.faces->corners.begin() + static_cast<std::ptrdiff_t>(s.corner),
+        s.faces->corners.begin() + static_cast<std::ptrdiff_t>(s.lastCorner));
+  }
+}
+
+// Part of a face group that exportFacesParallel welds on its own.
+struct weld_piece {
+  std::vector<face_span> spans;
+  size_t firstCorner; // of the piece within the group
+  size_t numFaces, numIndices;
+  size_t face, index; // first mesh face and index the piece fills
+
+  // Distinct corners of the piece in order of first use, and the mesh
+  // vertex each was merged into.
+  std::vector<vertex_index> vertices;
+  std::vector<unsigned int> vertex;
+};
+
+// Splits the faces of `spans` into about `count` pieces of as many faces,
+// cutting spans only at kFaceMark boundaries.
+static void splitSpans(const std::vector<face_span> &spans, size_t count,
+                       std::vector<weld_piece> &pieces) {
+  size_t numFaces = 0;
+  for (size_t i = 0; i < spans.size(); i++) {
+    numFaces += spans[i].lastFace - spans[i].face;
+  }
+  const size_t perPiece = std::max<size_t>(1, (numFaces + count - 1) / count);
+
+  pieces.assign(1, weld_piece());
+  pieces.back().firstCorner = 0;
+  size_t inPiece = 0, corners = 0;
+  for (size_t i = 0; i < spans.size(); i++) {
+    const face_span &span = spans[i];
+    face_span part = span;
+    while (part.face < span.lastFace) {
+      if (inPiece == perPiece) {
+        pieces.push_back(weld_piece());
+        pieces.back().firstCorner = corners;
+        inPiece = 0;
+      }
+      part.lastFace = span.lastFace;
+      part.lastCorner = span.lastCorner;
+      if (part.lastFace - part.face > perPiece - inPiece) {
+        // The piece may end up to a mark's worth of faces long.
+        size_t cut = (part.face + perPiece - inPiece + kFaceMark - 1) /
+                     kFaceMark * kFaceMark;
+        if (cut < span.lastFace) {
+          part.lastFace = cut;
+          part.lastCorner = (*span.marks)[cut / kFaceMark];
+        }
+      }
+      pieces.back().spans.push_back(part);
+      inPiece = std::min(perPiece, inPiece + part.lastFace - part.face);
+      corners += part.lastCorner - part.corner;
+      part.face = part.lastFace;
+      part.corner = part.lastCorner;
+    }
+  }
+}
+
+// Like exportFaces, for a group too large to export on one thread. The group
+// is cut into a piece per thread, and each piece is welded with its own
+// vertex cache. Merging the pieces' vertices in file order then numbers every
+// vertex where it is first used, as exportFaces does, so the mesh is the
+// same. The mesh arrays are filled in by range of vertices and by piece.
+static void exportFacesParallel(mesh_t &mesh,
+                                const std::vector<float> &in_positions,
+                                const std::vector<float> &in_normals,
+                                const std::vector<float> &in_texcoords,
+                                const std::vector<face_span> &spans,
+                                const int material_id, bool triangulate,
+                                unsigned int numThreads) {
+  std::vector<weld_piece> pieces;
+  splitSpans(spans, numThreads, pieces);
+
+  // Weld each piece. cornerVertex holds each corner's vertex within its
+  // piece; as in exportFaces, corners of dropped faces are left out.
+  std::vector<unsigned int> cornerVertex(countCorners(spans));
+  parallelFor(pieces.size(), numThreads, [&](size_t p) {
+    weld_piece &piece = pieces[p];
+    unsigned int *corner = cornerVertex.data() + piece.firstCorner;
+    vertex_cache cache;
+    cache.reset(countCorners(piece.spans));
+    piece.numFaces = 0;
+    piece.numIndices = 0;
+    for (size_t i = 0; i < piece.spans.size(); i++) {
+      const face_span &s = piece.spans[i];
+      const vertex_index *vi = s.faces->corners.data() + s.corner;
+      for (size_t f = s.face; f < s.lastFace; f++) {
+        size_t npolys = s.faces->sizes[f];
+        if (triangulate) {
+          if (npolys < 3) {
+            vi += npolys;
+            corner += npolys;
+            continue;
+          }
+          piece.numFaces += npolys - 2;
+          piece.numIndices += 3 * (npolys - 2);
+        } else {
+          piece.numFaces++;
+          piece.numIndices += npolys;
+        }
+
+        for (size_t k = 0; k < npolys; k++) {
+          bool found;
+          corner[k] = cache.findOrInsert(
+              vi[k], static_cast<unsigned int>(piece.vertices.size()), found);
+          if (!found) {
+            piece.vertices.push_back(vi[k]);
+          }
+        }
+        vi += npolys;
+        corner += npolys;
+      }
+    }
+  });
+
+  // Merge in file order: a vertex an earlier piece has keeps its number.
+  const unsigned int base =
+      static_cast<unsigned int>(mesh.positions.size() / 3);
+  size_t numPieceVertices = 0;
+  for (size_t p = 0; p < pieces.size(); p++) {
+    numPieceVertices += pieces[p].vertices.size();
+  }
+  vertex_cache cache;
+  cache.reset(numPieceVertices);
+  std::vector<vertex_index> vertices;
+  size_t face = mesh.num_vertices.size();
+  size_t idx = mesh.indices.size();
+  for (size_t p = 0; p < pieces.size(); p++) {
+    weld_piece &piece = pieces[p];
+    piece.vertex.resize(piece.vertices.size());
+    for (size_t v = 0; v < piece.vertices.size(); v++) {
+      bool found;
+      piece.vertex[v] = cache.findOrInsert(
+          piece.vertices[v],
+          base + static_cast<unsigned int>(vertices.size()), found);
+      if (!found) {
+        vertices.push_back(piece.vertices[v]);
+      }
+    }
+    std::vector<vertex_index>().swap(piece.vertices);
+    piece.face = face;
+    piece.index = idx;
+    face += piece.numFaces;
+    idx += piece.numIndices;
+  }
+
+  // Vertex attributes, a range of vertices per task. Only the vertices with
+  // normals or texcoords store them, so each range counts its own first.
+  const size_t numVertices = vertices.size();
+  const size_t numRanges = pieces.size();
+  const size_t perRange = (numVertices + numRanges - 1) / numRanges;
+  std::vector<size_t> rangeNormals(numRanges + 1, 0);
+  std::vector<size_t> rangeTexcoords(numRanges + 1, 0);
+  parallelFor(numRanges, numThreads, [&](size_t r) {
+    size_t normals = 0, texcoords = 0;
+    size_t last = std::min(numVertices, (r + 1) * perRange);
+    for (size_t v = r * perRange; v < last; v++) {
+      normals += hasNormal(vertices[v], in_normals);
+      texcoords += hasTexcoord(vertices[v], in_texcoords);
+    }
+    rangeNormals[r + 1] = normals;
+    rangeTexcoords[r + 1] = texcoords;
+  });
+  for (size_t r = 0; r < numRanges; r++) {
+    rangeNormals[r + 1] += rangeNormals[r];
+    rangeTexcoords[r + 1] += rangeTexcoords[r];
+  }
+
+  const size_t pos0 = mesh.positions.size();
+  const size_t nrm0 = mesh.normals.size();
+  const size_t tex0 = mesh.texcoords.size();
+  mesh.positions.resize(pos0 + 3 * numVertices);
+  mesh.normals.resize(nrm0 + 3 * rangeNormals[numRanges]);
+  mesh.texcoords.resize(tex0 + 2 * rangeTexcoords[numRanges]);
+  parallelFor(numRanges, numThreads, [&](size_t r) {
+    size_t first = std::min(numVertices, r * perRange);
+    size_t last = std::min(numVertices, (r + 1) * perRange);
+    size_t pos = pos0 + 3 * first;
+    size_t nrm = nrm0 + 3 * rangeNormals[r];
+    size_t tex = tex0 + 2 * rangeTexcoords[r];
+    for (size_t v = first; v < last; v++) {
+      const vertex_index &i = vertices[v];
+      assert(in_positions.size() > static_cast<unsigned int>(3 * i.v_idx + 2));
+
+      const float *p = &in_positions[3 * static_cast<size_t>(i.v_idx)];
+      mesh.positions[pos++] = p[0];
+      mesh.positions[pos++] = p[1];
+      mesh.positions[pos++] = p[2];
+
+      if (hasNormal(i, in_normals)) {
+        const float *n = &in_normals[3 * static_cast<size_t>(i.vn_idx)];
+        mesh.normals[nrm++] = n[0];
+        mesh.normals[nrm++] = n[1];
+        mesh.normals[nrm++] = n[2];
+      }
+
+      if (hasTexcoord(i, in_texcoords)) {
+        const float *t = &in_texcoords[2 * static_cast<size_t>(i.vt_idx)];
+        mesh.texcoords[tex++] = t[0];
+        mesh.texcoords[tex++] = t[1];
+      }
+    }
+  });
+
+  // Indices and per-face data, a piece per task.
+  mesh.indices.resize(idx);
+  mesh.num_vertices.resize(face);
+  mesh.material_ids.resize(face, material_id);
+  parallelFor(pieces.size(), numThreads, [&](size_t p) {
+    const weld_piece &piece = pieces[p];
+    const unsigned int *vertex = piece.vertex.data();
+    const unsigned int *corner = cornerVertex.data() + piece.firstCorner;
+    size_t idx = piece.index, face = piece.face;
+    for (size_t i = 0; i < piece.spans.size(); i++) {
+      const face_span &s = piece.spans[i];
+      for (size_t f = s.face; f < s.lastFace; f++) {
+        size_t npolys = s.faces->sizes[f];
+
+        if (triangulate) {
+          // Polygon -> triangle fan conversion
+          for (size_t k = 2; k < npolys; k++) {
+            mesh.indices[idx++] = vertex[corner[0]];
+            mesh.indices[idx++] = vertex[corner[k - 1]];
+            mesh.indices[idx++] = vertex[corner[k]];
+            mesh.num_vertices[face++] = 3;
+          }
+        } else {
+          for (size_t k = 0; k < npolys; k++) {
+            mesh.indices[idx++] = vertex[corner[k]];
+          }
+          mesh.num_vertices[face++] = static_cast<unsigned char>(npolys);
+        }
+        corner += npolys;
+      }
+    }
+  });
+}
+
+#endif // TINYOBJLOADER_NO_THREADS
+
+// Parses `size` bytes of .obj at `data` on `num_threads` threads; see
+// LoadObjParallel.
+static bool loadObjParallel(std::vector<shape_t> &shapes,
+                            std::vector<material_t> &materials,
+                            std::string &err, const char *data, size_t size,
+                            MaterialReader &readMatFn, bool triangulate,
+                            unsigned int num_threads) {
+#ifdef TINYOBJLOADER_NO_THREADS
+  (void)num_threads;
+  return LoadObjFromMemory(shapes, materials, err, data, size, readMatFn,
+                           triangulate);
+#else
+  // Chunks smaller than this are not worth a thread, nor are face groups of
+  // fewer corners than this.
+  const size_t minChunkSize = 1 << 20;
+  const size_t minParallelCorners = 1 << 18;
+
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  size_t numChunks =
+      std::min(static_cast<size_t>(num_threads), size / minChunkSize);
+  if (numChunks <= 1) {
+    return LoadObjFromMemory(shapes, materials, err, data, size, readMatFn,
+                             triangulate);
+  }
+
+  // Split at line boundaries.
+  const char *dataEnd = data + size;
+  std::vector<obj_chunk> chunks(numChunks);
+  for (size_t i = 0; i < numChunks; i++) {
+    chunks[i].begin = (i == 0) ? data : chunks[i - 1].end;
+    if (i == numChunks - 1) {
+      chunks[i].end = dataEnd;
+      break;
+    }
+    const char *split =
+        std::max(chunks[i].begin, data + size / numChunks * (i + 1));
+    const char *nl = static_cast<const char *>(
+        memchr(split, '\n', static_cast<size_t>(dataEnd - split)));
+    chunks[i].end = nl ? nl + 1 : dataEnd;
+  }
+
+  parallelFor(numChunks, num_threads,
+              [&](size_t i) { countObjChunk(chunks[i]); });
+
+  size_t num_v = 0, num_vn = 0, num_vt = 0;
+  for (size_t i = 0; i < numChunks; i++) {
+    chunks[i].v_base = num_v;
+    chunks[i].vn_base = num_vn;
+    chunks[i].vt_base = num_vt;
+    num_v += chunks[i].num_v;
+    num_vn += chunks[i].num_vn;
+    num_vt += chunks[i].num_vt;
+  }
+
+  obj_reader r;
+  r.deferExport = true;
+  r.v.resize(3 * num_v);
+  r.vn.resize(3 * num_vn);
+  r.vt.resize(2 * num_vt);
+
+  parallelFor(numChunks, num_threads, [&](size_t i) {
+    parseObjChunk(chunks[i], r.v, r.vn, r.vt);
+  });
+
+  // Replay groups, objects and materials in file order.
+  for (size_t i = 0; i < numChunks; i++) {
+    obj_chunk &chunk = chunks[i];
+    size_t face = 0, corner = 0;
+    for (size_t e = 0; e < chunk.events.size(); e++) {
+      addChunkSpan(r, chunk, face, corner, chunk.events[e].first,
+                   chunk.eventCorners[e]);
+      const std::string &line = chunk.events[e].second;
+      if (!parseObjLine(r, line.c_str(), line.c_str() + line.size(), shapes,
+                        materials, err, readMatFn, triangulate)) {
+        return false;
+      }
+    }
+    addChunkSpan(r, chunk, face, corner, chunk.faces.sizes.size(),
+                 chunk.faces.corners.size());
+  }
+  finishObj(r, shapes, triangulate);
+
+  // Export every shape's face groups. Shapes of small groups are exported
+  // one shape per task. A shape with a large group is exported on its own,
+  // group by group, with its large groups welded on every thread.
+  std::vector<char> hasLargeGroup(shapes.size(), 0);
+  for (size_t i = 0; i < shapes.size(); i++) {
+    for (size_t j = 0; j < r.exports[i].size(); j++) {
+      if (countCorners(r.exports[i][j].spans) >= minParallelCorners) {
+        hasLargeGroup[i] = 1;
+      }
+    }
+  }
+
+  parallelFor(shapes.size(), num_threads, [&](size_t i) {
+    if (hasLargeGroup[i]) {
+      return;
+    }
+    std::vector<deferred_export> &exports = r.exports[i];
+    export_scratch scratch;
+    face_group faces;
+    for (size_t j = 0; j < exports.size(); j++) {
+      gatherFaces(faces, exports[j].spans);
+      exportFaces(shapes[i].mesh, scratch, r.v, r.vn, r.vt, faces,
+                  exports[j].material_id, triangulate);
+    }
+  });
+
+  export_scratch scratch;
+  face_group faces;
+  for (size_t i = 0; i < shapes.size(); i++) {
+    if (!hasLargeGroup[i]) {
+      continue;
+    }
+    std::vector<deferred_export> &exports = r.exports[i];
+    for (size_t j = 0; j < exports.size(); j++) {
+      if (countCorners(exports[j].spans) >= minParallelCorners) {
+        exportFacesParallel(shapes[i].mesh, r.v, r.vn, r.vt, exports[j].spans,
+                            exports[j].material_id, triangulate, num_threads);
+      } else {
+        gatherFaces(faces, exports[j].spans);
+        exportFaces(shapes[i].mesh, scratch, r.v, r.vn, r.vt, faces,
+                    exports[j].material_id, triangulate);
+      }
+    }
+  }
+
+  return true;
+#endif
+}
+
+bool LoadObjParallel(std::vector<shape_t> &shapes,       // [output]
+                     std::vector<material_t> &materials, // [output]
+                     std::string &err, const char *filename,
+                     const char *mtl_basepath, bool triangulate,
+                     unsigned int num_threads) {
+  shapes.clear();
+
+  mapped_file file;
+  if (!file.open(filename)) {
+    std::stringstream errss;
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
+  }
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  MaterialFileReader matFileReader(basePath);
+
+  return loadObjParallel(shapes, materials, err, file.data(), file.size(),
+                         matFileReader, triangulate, num_threads);
+}
+
+// --- Binary mesh cache ---
+//
+// Layout: a cache_header, then the payload. Every field is written in host
+// byte order. Arrays are a 64-bit count followed by the elements, starting at
+// a multiple of kCacheAlign from the start of the file; strings are a count
+// and the characters. The payload holds the .obj path, the .mtl files read
+// (path, size, mtime), the materials and the shapes, each with its levels
+// of detail.
+
+#define TINYOBJ_CACHE_VERSION 2
+static const char kCacheMagic[8] = {'T', 'O', 'B', 'J', 'C', 'A', 'C', 'H'};
+static const size_t kCacheAlign = 16;
+
+struct cache_header {
+  char magic[8];
+  unsigned int version;
+  unsigned int byte_order; // 0x01020304 as written by the host
+  unsigned int flags;      // bit 0: triangulated
+  unsigned int lod_levels; // levels of detail generated per shape
+  unsigned long long obj_size;
+  long long obj_mtime;
+  unsigned long long obj_hash;
+  unsigned long long payload_size;
+  unsigned long long payload_hash;
+};
+
+// Size and modification time of a file, in nanoseconds.
+// A missing file has size ~0.
+struct file_stamp {
+  file_stamp() : size(~0ULL), mtime(0) {}
+  unsigned long long size;
+  long long mtime;
+
+  bool operator==(const file_stamp &other) const {
+    return size == other.size && mtime == other.mtime;
+  }
+};
+
+static file_stamp stampFile(const char *path) {
+  file_stamp stamp;
+  struct stat sb;
+  if (stat(path, &sb) != 0) {
+    return stamp;
+  }
+  stamp.size = static_cast<unsigned long long>(sb.st_size);
+#if defined(_WIN32)
+  stamp.mtime = static_cast<long long>(sb.st_mtime) * 1000000000LL;
+#elif defined(__APPLE__)
+  stamp.mtime = static_cast<long long>(sb.st_mtimespec.tv_sec) * 1000000000LL +
+                sb.st_mtimespec.tv_nsec;
+#else
+  stamp.mtime = static_cast<long long>(sb.st_mtim.tv_sec) * 1000000000LL +
+                sb.st_mtim.tv_nsec;
+#endif
+  return stamp;
+}
+
+static inline unsigned long long rotl64(unsigned long long x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// 64-bit hash of [data, data + len). Four independent lanes of 8 byte words,
+// so it runs at memory speed; not meant to resist deliberate collisions.
+static unsigned long long hashBytes(const char *data, size_t len,
+                                   unsigned long long seed) {
+  const unsigned long long P1 = 0x9E3779B185EBCA87ULL;
+  const unsigned long long P2 = 0xC2B2AE3D27D4EB4FULL;
+  unsigned long long acc[4] = {seed + P1, seed + P2, seed, seed - P1};
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      unsigned long long w;
+      memcpy(&w, data + i + 8 * lane, 8);
+      acc[lane] = rotl64(acc[lane] + w * P2, 31) * P1;
+    }
+  }
+  unsigned long long h = rotl64(acc[0], 1) + rotl64(acc[1], 7) +
+                         rotl64(acc[2], 12) + rotl64(acc[3], 18);
+  for (; i < len; i += 8) {
+    unsigned long long w = 0;
+    memcpy(&w, data + i, std::min<size_t>(8, len - i));
+    h = rotl64(h ^ (rotl64(w * P2, 31) * P1), 27) * P1 + P2;
+  }
+
+  h ^= static_cast<unsigned long long>(len);
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P1;
+  h ^= h >> 32;
+  return h;
+}
+
+// Hash of a whole file's contents. Fixed size blocks are hashed on their own
+// (in parallel where threads are available) and the block hashes are then
+// hashed together, so the result does not depend on the thread count.
+static unsigned long long hashContents(const char *data, size_t size) {
+  const size_t blockSize = 4 << 20;
+  size_t numBlocks = (size + blockSize - 1) / blockSize;
+  std::vector<unsigned long long> blocks(numBlocks);
+  auto hashBlock = [&](size_t i) {
+    size_t begin = i * blockSize;
+    blocks[i] = hashBytes(data + begin, std::min(blockSize, size - begin), i);
+  };
+#ifdef TINYOBJLOADER_NO_THREADS
+  for (size_t i = 0; i < numBlocks; i++) {
+    hashBlock(i);
+  }
+#else
+  parallelFor(numBlocks, std::max(1u, std::thread::hardware_concurrency()),
+              hashBlock);
+#endif
+  return hashBytes(reinterpret_cast<const char *>(blocks.data()),
+                   blocks.size() * sizeof(unsigned long long), size);
+}
+
+// Reads .mtl files like MaterialFileReader, and records the path of every
+// file it was asked for so the cache can check them for changes.
+class recording_material_reader : public MaterialReader {
+public:
+  recording_material_reader(const std::string &mtl_basepath)
+      : m_mtlBasePath(mtl_basepath), m_reader(mtl_basepath) {}
+  virtual ~recording_material_reader() {}
+  virtual bool operator()(const std::string &matId,
+                          std::vector<material_t> &materials,
+                          std::map<std::string, int> &matMap,
+                          std::string &err) {
+    paths.push_back(m_mtlBasePath + matId);
+    return m_reader(matId, materials, matMap, err);
+  }
+
+  std::vector<std::string> paths;
+
+private:
+  std::string m_mtlBasePath;
+  MaterialFileReader m_reader;
+};
+
+// Appends cache fields to a file, keeping track of alignment.
+class cache_writer {
+public:
+  cache_writer(FILE *fp) : fp_(fp), offset_(0), ok_(true) {}
+
+  bool ok() const { return ok_; }
+
+  void write(const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, fp_) != len) {
+      ok_ = false;
+    }
+    offset_ += len;
+  }
+
+  void align() {
+    static const char zeros[kCacheAlign] = {0};
+    write(zeros, (kCacheAlign - offset_ % kCacheAlign) % kCacheAlign);
+  }
+
+  void count(size_t n) {
+    unsigned long long n64 = n;
+    write(&n64, sizeof(n64));
+  }
+
+  void string(const std::string &s) {
+    count(s.size());
+    write(s.data(), s.size());
+  }
+
+  template <typename T> void array(const std::vector<T> &v) {
+    count(v.size());
+    align();
+    write(v.data(), v.size() * sizeof(T));
+  }
+
+private:
+  FILE *fp_;
+  size_t offset_;
+  bool ok_;
+};
+
+// Reads cache fields back out of a mapped cache. Every read is bounds
+// checked; after the first failure ok() is false and nothing more is read.
+class cache_reader {
+public:
+  cache_reader(const char *data, size_t size)
+      : base_(data), p_(data), end_(data + size), ok_(true) {}
+
+  bool ok() const { return ok_; }
+  bool atEnd() const { return p_ == end_; }
+
+  bool read(void *out, size_t len) {
+    if (!ok_ || static_cast<size_t>(end_ - p_) < len) {
+      return ok_ = false;
+    }
+    memcpy(out, p_, len);
+    p_ += len;
+    return true;
+  }
+
+  void align() {
+    size_t pad = (kCacheAlign - static_cast<size_t>(p_ - base_) % kCacheAlign) %
+                 kCacheAlign;
+    if (static_cast<size_t>(end_ - p_) < pad) {
+      ok_ = false;
+      return;
+    }
+    p_ += pad;
+  }
+
+  // Reads a count of at most `limit`.
+  bool count(size_t &n, size_t limit) {
+    unsigned long long n64 = 0;
+    if (!read(&n64, sizeof(n64)) || n64 > limit) {
+      return ok_ = false;
+    }
+    n = static_cast<size_t>(n64);
+    return true;
+  }
+
+  bool string(std::string &s) {
+    size_t n;
+    if (!count(n, remaining())) {
+      return false;
+    }
+    s.assign(p_, n);
+    p_ += n;
+    return true;
+  }
+
+  template <typename T> bool array(std::vector<T> &v) {
+    size_t n;
+    if (!count(n, remaining())) {
+      return false;
+    }
+    align();
+    if (!ok_ || n > remaining() / sizeof(T)) {
+      return ok_ = false;
+    }
+    const T *data = reinterpret_cast<const T *>(p_);
+    v.assign(data, data + n);
+    p_ += n * sizeof(T);
+    return true;
+  }
+
+private:
+  size_t remaining() const { return static_cast<size_t>(end_ - p_); }
+
+  const char *base_;
+  const char *p_;
+  const char *end_;
+  bool ok_;
+};
+
+static void writeMaterial(cache_writer &w, const material_t &m) {
+  w.string(m.name);
+  w.write(m.ambient, sizeof(m.ambient));
+  w.write(m.diffuse, sizeof(m.diffuse));
+  w.write(m.specular, sizeof(m.specular));
+  w.write(m.transmittance, sizeof(m.transmittance));
+  w.write(m.emission, sizeof(m.emission));
+  w.write(&m.shininess, sizeof(m.shininess));
+  w.write(&m.ior, sizeof(m.ior));
+  w.write(&m.dissolve, sizeof(m.dissolve));
+  w.write(&m.illum, sizeof(m.illum));
+  w.write(&m.dummy, sizeof(m.dummy));
+  w.string(m.ambient_texname);
+  w.string(m.diffuse_texname);
+  w.string(m.specular_texname);
+  w.string(m.specular_highlight_texname);
+  w.string(m.bump_texname);
+  w.string(m.displacement_texname);
+  w.string(m.alpha_texname);
+  w.count(m.unknown_parameter.size());
+  for (std::map<std::string, std::string>::const_iterator it =
+           m.unknown_parameter.begin();
+       it != m.unknown_parameter.end(); ++it) {
+    w.string(it->first);
+    w.string(it->second);
+  }
+}
+
+static bool readMaterial(cache_reader &r, material_t &m) {
+  r.string(m.name);
+  r.read(m.ambient, sizeof(m.ambient));
+  r.read(m.diffuse, sizeof(m.diffuse));
+  r.read(m.specular, sizeof(m.specular));
+  r.read(m.transmittance, sizeof(m.transmittance));
+  r.read(m.emission, sizeof(m.emission));
+  r.read(&m.shininess, sizeof(m.shininess));
+  r.read(&m.ior, sizeof(m.ior));
+  r.read(&m.dissolve, sizeof(m.dissolve));
+  r.read(&m.illum, sizeof(m.illum));
+  r.read(&m.dummy, sizeof(m.dummy));
+  r.string(m.ambient_texname);
+  r.string(m.diffuse_texname);
+  r.string(m.specular_texname);
+  r.string(m.specular_highlight_texname);
+  r.string(m.bump_texname);
+  r.string(m.displacement_texname);
+  r.string(m.alpha_texname);
+  size_t numParams = 0;
+  r.count(numParams, ~static_cast<size_t>(0));
+  for (size_t i = 0; i < numParams && r.ok(); i++) {
+    std::string key, value;
+    r.string(key);
+    r.string(value);
+    m.unknown_parameter[key] = value;
+  }
+  return r.ok();
+}
+
+static void writeShape(cache_writer &w, const shape_t &shape) {
+  const mesh_t &mesh = shape.mesh;
+  w.string(shape.name);
+  w.array(mesh.positions);
+  w.array(mesh.normals);
+  w.array(mesh.texcoords);
+  w.array(mesh.indices);
+  w.array(mesh.num_vertices);
+  w.array(mesh.material_ids);
+  w.count(mesh.tags.size());
+  for (size_t i = 0; i < mesh.tags.size(); i++) {
+    const tag_t &tag = mesh.tags[i];
+    w.string(tag.name);
+    w.array(tag.intValues);
+    w.array(tag.floatValues);
+    w.count(tag.stringValues.size());
+    for (size_t j = 0; j < tag.stringValues.size(); j++) {
+      w.string(tag.stringValues[j]);
+    }
+  }
+  w.count(mesh.lods.size());
+  for (size_t i = 0; i < mesh.lods.size(); i++) {
+    w.array(mesh.lods[i].indices);
+    w.array(mesh.lods[i].material_ids);
+    w.write(&mesh.lods[i].error, sizeof(float));
+  }
+}
+
+static bool readShape(cache_reader &r, shape_t &shape) {
+  mesh_t &mesh = shape.mesh;
+  r.string(shape.name);
+  r.array(mesh.positions);
+  r.array(mesh.normals);
+  r.array(mesh.texcoords);
+  r.array(mesh.indices);
+  r.array(mesh.num_vertices);
+  r.array(mesh.material_ids);
+  size_t numTags = 0;
+  r.count(numTags, ~static_cast<size_t>(0));
+  for (size_t i = 0; i < numTags && r.ok(); i++) {
+    mesh.tags.push_back(tag_t());
+    tag_t &tag = mesh.tags.back();
+    r.string(tag.name);
+    r.array(tag.intValues);
+    r.array(tag.floatValues);
+    size_t numStrings = 0;
+    r.count(numStrings, ~static_cast<size_t>(0));
+    for (size_t j = 0; j < numStrings && r.ok(); j++) {
+      tag.stringValues.push_back(std::string());
+      r.string(tag.stringValues.back());
+    }
+  }
+  size_t numLods = 0;
+  r.count(numLods, ~static_cast<size_t>(0));
+  for (size_t i = 0; i < numLods && r.ok(); i++) {
+    mesh.lods.push_back(mesh_lod_t());
+    mesh_lod_t &lod = mesh.lods.back();
+    r.array(lod.indices);
+    r.array(lod.material_ids);
+    r.read(&lod.error, sizeof(float));
+  }
+  return r.ok();
+}
+
+// Loads shapes and materials from the cache at `cachePath`. Returns false if
+// the cache is missing, stale or corrupt; `shapes` and `materials` are left
+// untouched in that case.
+static bool readMeshCache(std::vector<shape_t> &shapes,
+                          std::vector<material_t> &materials,
+                          const char *cachePath, const char *filename,
+                          const mapped_file &obj, const file_stamp &objStamp,
+                          bool triangulate, unsigned int lodLevels) {
+  mapped_file cache;
+  if (!cache.open(cachePath) || cache.size() < sizeof(cache_header)) {
+    return false;
+  }
+
+  cache_header header;
+  memcpy(&header, cache.data(), sizeof(header));
+  if (memcmp(header.magic, kCacheMagic, sizeof(kCacheMagic)) != 0 ||
+      header.version != TINYOBJ_CACHE_VERSION ||
+      header.byte_order != 0x01020304u ||
+      header.flags != (triangulate ? 1u : 0u) ||
+      header.lod_levels != lodLevels ||
+      header.obj_size != objStamp.size || header.obj_mtime != objStamp.mtime ||
+      header.payload_size != cache.size() - sizeof(cache_header)) {
+    return false;
+  }
+
+  const char *payload = cache.data() + sizeof(cache_header);
+  if (hashContents(payload, header.payload_size) != header.payload_hash ||
+      hashContents(obj.data(), obj.size()) != header.obj_hash) {
+    return false;
+  }
+
+  cache_reader r(cache.data(), cache.size());
+  r.read(&header, sizeof(header));
+
+  std::string objPath;
+  r.string(objPath);
+  if (!r.ok() || objPath != filename) {
+    return false;
+  }
+
+  size_t numDeps = 0;
+  r.count(numDeps, ~static_cast<size_t>(0));
+  for (size_t i = 0; i < numDeps && r.ok(); i++) {
+    std::string path;
+    file_stamp stamp;
+    r.string(path);
+    r.read(&stamp.size, sizeof(stamp.size));
+    r.read(&stamp.mtime, sizeof(stamp.mtime));
+    if (r.ok() && !(stampFile(path.c_str()) == stamp)) {
+      return false;
+    }
+  }
+
+  std::vector<material_t> cachedMaterials;
+  size_t numMaterials = 0;
+  r.count(numMaterials, cache.size());
+  for (size_t i = 0; i < numMaterials && r.ok(); i++) {
+    cachedMaterials.push_back(material_t());
+    readMaterial(r, cachedMaterials.back());
+  }
+
+  std::vector<shape_t> cachedShapes;
+  size_t numShapes = 0;
+  r.count(numShapes, cache.size());
+  cachedShapes.resize(numShapes);
+  for (size_t i = 0; i < numShapes && r.ok(); i++) {
+    readShape(r, cachedShapes[i]);
+  }
+
+  if (!r.ok() || !r.atEnd()) {
+    return false;
+  }
+
+  shapes.swap(cachedShapes);
+  materials.insert(materials.end(), cachedMaterials.begin(),
+                   cachedMaterials.end());
+  return true;
+}
+
+// Writes shapes and materials to the cache at `cachePath`. The cache is
+// written to a temporary file first and renamed into place once complete, so
+// a reader never sees a partial cache.
+static bool writeMeshCache(const std::vector<shape_t> &shapes,
+                           const std::vector<material_t> &materials,
+                           const std::vector<std::string> &mtlPaths,
+                           const char *cachePath, const char *filename,
+                           const mapped_file &obj, const file_stamp &objStamp,
+                           bool triangulate, unsigned int lodLevels) {
+  std::string tmpPath = std::string(cachePath) + ".tmp";
+  FILE *fp = fopen(tmpPath.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+
+  cache_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = TINYOBJ_CACHE_VERSION;
+  header.byte_order = 0x01020304u;
+  header.flags = triangulate ? 1u : 0u;
+  header.lod_levels = lodLevels;
+  header.obj_size = objStamp.size;
+  header.obj_mtime = objStamp.mtime;
+  header.obj_hash = hashContents(obj.data(), obj.size());
+
+  cache_writer w(fp);
+  w.write(&header, sizeof(header));
+  w.string(filename);
+  w.count(mtlPaths.size());
+  for (size_t i = 0; i < mtlPaths.size(); i++) {
+    file_stamp stamp = stampFile(mtlPaths[i].c_str());
+    w.string(mtlPaths[i]);
+    w.write(&stamp.size, sizeof(stamp.size));
+    w.write(&stamp.mtime, sizeof(stamp.mtime));
+  }
+  w.count(materials.size());
+  for (size_t i = 0; i < materials.size(); i++) {
+    writeMaterial(w, materials[i]);
+  }
+  w.count(shapes.size());
+  for (size_t i = 0; i < shapes.size(); i++) {
+    writeShape(w, shapes[i]);
+  }
+  bool ok = w.ok() && fclose(fp) == 0;
+
+  // Hash the payload as written, then fill in the header.
+  if (ok) {
+    mapped_file written;
+    ok = written.open(tmpPath.c_str()) &&
+         written.size() >= sizeof(cache_header);
+    if (ok) {
+      header.payload_size = written.size() - sizeof(cache_header);
+      header.payload_hash = hashContents(written.data() + sizeof(cache_header),
+                                         header.payload_size);
+    }
+  }
+  if (ok) {
+    fp = fopen(tmpPath.c_str(), "r+b");
+    ok = fp && fwrite(&header, sizeof(header), 1, fp) == 1;
+    ok = fp && fclose(fp) == 0 && ok;
+  }
+
+#if defined(_WIN32)
+  if (ok) {
+    remove(cachePath); // rename does not replace an existing file here.
+  }
+#endif
+  if (!ok || rename(tmpPath.c_str(), cachePath) != 0) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Shared by LoadObjCached and LoadObjStreaming. With a `consumer`, every
+// shape is also handed to it as soon as it is complete, and a cache miss is
+// parsed serially so that shapes complete in file order.
+static bool loadObjCached(std::vector<shape_t> &shapes,
+                          std::vector<material_t> &materials,
+                          std::string &err, const char *filename,
+                          const char *mtl_basepath, bool triangulate,
+                          const char *cache_path, unsigned int lodLevels,
+                          ShapeConsumer *consumer) {
+  std::string cachePath =
+      cache_path ? cache_path : std::string(filename) + ".tobjcache";
+
+  shapes.clear();
+
+  mapped_file file;
+  if (!file.open(filename)) {
+    std::stringstream errss;
+    errss << "Cannot open file [" << filename << "]" << std::endl;
+    err = errss.str();
+    return false;
+  }
+  file_stamp objStamp = stampFile(filename);
+
+  if (readMeshCache(shapes, materials, cachePath.c_str(), filename, file,
+                    objStamp, triangulate, lodLevels)) {
+    for (size_t i = 0; consumer && i < shapes.size(); i++) {
+      (*consumer)(shapes[i], materials);
+    }
+    return true;
+  }
+
+  std::string basePath;
+  if (mtl_basepath) {
+    basePath = mtl_basepath;
+  }
+  recording_material_reader matFileReader(basePath);
+
+  size_t firstMaterial = materials.size();
+  if (consumer) {
+    obj_reader reader;
+    reader.consumer = consumer;
+    reader.loadedMaterials = &materials;
+    reader.lodLevels = lodLevels;
+    if (!parseObjBuffer(reader, shapes, materials, err, file.data(),
+                        file.size(), matFileReader, triangulate)) {
+      return false;
+    }
+  } else {
+    if (!loadObjParallel(shapes, materials, err, file.data(), file.size(),
+                         matFileReader, triangulate, 0)) {
+      return false;
+    }
+    if (lodLevels > 0) {
+#ifdef TINYOBJLOADER_NO_THREADS
+      for (size_t i = 0; i < shapes.size(); i++) {
+        GenerateLods(shapes[i].mesh, lodLevels);
+      }
+#else
+      parallelFor(shapes.size(),
+                  std::max(1u, std::thread::hardware_concurrency()),
+                  [&](size_t i) { GenerateLods(shapes[i].mesh, lodLevels); });
+#endif
+    }
+  }
+
+  std::vector<material_t> loadedMaterials(
+      materials.begin() + static_cast<std::ptrdiff_t>(firstMaterial),
+      materials.end());
+  if (!writeMeshCache(shapes, loadedMaterials, matFileReader.paths,
+                      cachePath.c_str(), filename, file, objStamp,
+                      triangulate, lodLevels)) {
+    std::stringstream ss;
+    ss << "WARN: Cannot write mesh cache [ " << cachePath << " ]."
+       << std::endl;
+    err += ss.str();
+  }
+  return true;
+}
+
+bool LoadObjCached(std::vector<shape_t> &shapes,       // [output]
+                   std::vector<material_t> &materials, // [output]
+                   std::string &err, const char *filename,
+                   const char *mtl_basepath, bool triangulate,
+                   const char *cache_path, unsigned int lod_levels) {
+  return loadObjCached(shapes, materials, err, filename, mtl_basepath,
+                       triangulate, cache_path, lod_levels, NULL);
+}
+
+bool LoadObjStreaming(ShapeConsumer &consumer,
+                      std::vector<material_t> &materials, // [output]
+                      std::string &err, const char *filename,
+                      const char *mtl_basepath, bool triangulate,
+                      const char *cache_path, unsigned int lod_levels) {
+  std::vector<shape_t> shapes;
+  return loadObjCached(shapes, materials, err, filename, mtl_basepath,
+                       triangulate, cache_path, lod_levels, &consumer);
 }
 
 } // namespace
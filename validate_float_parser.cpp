@@ -0,0 +1,285 @@
+/**
+ * validate_float_parser checks the loader's float parser against strtof,
+ * bit for bit. It parses, with parseFloat as selected at compile time:
+ * 		obj_tokens   - every number of the v, vt, vn and vp lines (and MTL
+ * 		               colour and scalar lines) of the files given
+ * 		midpoints    - halfway points between adjacent floats, printed
+ * 		               exactly, padded past 19 digits, and rounded to 9 and
+ * 		               17 digits or nudged just above and below
+ * 		long_digits  - significands of 19 to 30 digits
+ * 		exponents    - short significands with exponents from subnormal
+ * 		               and underflow to overflow, and fixed edge cases
+ * 		fallback     - inf, nan, hex floats and malformed numbers
+ * 		vertices     - %.6f and %g printed vertex-style values
+ * Random cases use a fixed seed, so every run checks the same inputs.
+ * Mismatches are printed to stderr and make the exit status 1. Only the
+ * default tryParseFloat is expected to pass: the older parsers round
+ * twice, which the midpoint cases catch.
+ *
+ * Build (one per parser selection):
+ * 		g++ -O2 -std=c++11 -pthread validate_float_parser.cpp -o validate_float_parser
+ * 		g++ -O2 -std=c++11 -pthread -DTINY_OBJ_LOADER_DOUBLE_FLOAT_PARSER validate_float_parser.cpp -o validate_float_parser_double
+ * 		g++ -O2 -std=c++11 -pthread -DTINY_OBJ_LOADER_OLD_FLOAT_PARSER validate_float_parser.cpp -o validate_float_parser_old
+ * Usage:
+ * 		validate_float_parser [-n randomInputsPerCase] [file.obj ...]
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// The parser is static to the loader, so it is compiled in here rather
+// than linked from tiny_obj_loader.cc
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#if defined(TINY_OBJ_LOADER_OLD_FLOAT_PARSER)
+#define PARSER_NAME "atof"
+#elif defined(TINY_OBJ_LOADER_DOUBLE_FLOAT_PARSER)
+#define PARSER_NAME "tryParseDouble"
+#else
+#define PARSER_NAME "tryParseFloat"
+#endif
+
+// Mismatches printed per case; the rest are only counted
+#define MAX_REPORTED 10
+
+static unsigned int floatBits(float f){
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static float bitsFloat(unsigned int bits){
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/**
+ * A Case counts the inputs of one kind that were checked and those that
+ * did not match strtof.
+ */
+struct Case{
+	const char *name;
+	size_t checked;
+	size_t mismatches;
+
+	Case(const char *name) : name(name), checked(0), mismatches(0) {}
+
+	/**
+	 * check parses token, which must hold no whitespace, with parseFloat
+	 * and with strtof. NaNs match any NaN, since their payload is not
+	 * part of the result the loader keeps.
+	 */
+	void check(const std::string &token){
+		const char *s = token.c_str();
+		float parsed = tinyobj::parseFloat(s);
+		float expected = strtof(token.c_str(), NULL);
+		checked++;
+		if( floatBits(parsed) == floatBits(expected) || (std::isnan(parsed) && std::isnan(expected)) ){
+			return;
+		}
+		if( mismatches++ < MAX_REPORTED ){
+			fprintf(stderr, "%s: \"%s\" parsed as %.9g (0x%08x), strtof gives %.9g (0x%08x)\n", name, token.c_str(),
+				parsed, floatBits(parsed), expected, floatBits(expected));
+		}
+	}
+
+	void print(){
+		printf("%-12s %10zu checked, %zu mismatches\n", name, checked, mismatches);
+	}
+};
+
+// Keywords of OBJ and MTL lines made of floats
+static bool isFloatLine(const std::string &keyword){
+	static const char *keywords[] = {"v", "vt", "vn", "vp", "Ka", "Kd", "Ks", "Ke", "Tf", "Ns", "Ni", "d", "Tr"};
+	for( int i=0; i<sizeof(keywords) / sizeof(keywords[0]); i++ ){
+		if( keyword == keywords[i] ){
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool checkFile(Case &c, const std::string &path){
+	std::ifstream file(path.c_str());
+	if( !file.is_open() ){
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	std::string line, keyword, token;
+	while( std::getline(file, line) ){
+		std::istringstream tokens(line);
+		if( !(tokens >> keyword) || !isFloatLine(keyword) ){
+			continue;
+		}
+		while( tokens >> token ){
+			c.check(token);
+		}
+	}
+	return true;
+}
+
+// Exact decimal value of d, which printf gives in full with enough digits,
+// without trailing zeros
+static std::string exactDecimal(double d){
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "%.160e", d);
+	std::string s(buffer);
+	size_t e = s.find('e');
+	size_t last = s.find_last_not_of('0', e - 1);
+	if( s[last] == '.' ){
+		last--;
+	}
+	return s.substr(0, last + 1) + s.substr(e);
+}
+
+static std::string format(const char *fmt, double d){
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), fmt, d);
+	return buffer;
+}
+
+/**
+ * checkMidpoints takes random finite floats, including subnormals, and
+ * checks the point halfway to the next float up, which a double holds
+ * exactly. Strtof rounds exact midpoints to even; the nearby strings must
+ * round to the nearer neighbour.
+ */
+static void checkMidpoints(Case &c, std::mt19937 &random, int n){
+	std::uniform_int_distribution<unsigned int> bits(0, 0x7f7ffffe);
+	for( int i=0; i<n; i++ ){
+		float f = bitsFloat(bits(random));
+		float next = nextafterf(f, INFINITY);
+		double mid = 0.5 * ((double)f + (double)next);
+		std::string exact = exactDecimal(mid);
+		c.check(exact);
+		size_t e = exact.find('e');
+		std::string padded = exact.substr(0, e) + (exact.find('.') < e ? "" : ".") + "0000000000000000000000" + exact.substr(e);
+		c.check(padded);
+		c.check("-" + exact);
+		c.check(format("%.8e", mid));
+		c.check(format("%.16e", mid));
+		c.check(format("%.17g", nextafter(mid, 0.0)));
+		c.check(format("%.17g", nextafter(mid, INFINITY)));
+	}
+}
+
+static std::string randomDigits(std::mt19937 &random, int count){
+	std::uniform_int_distribution<int> digit(0, 9);
+	std::string digits;
+	for( int i=0; i<count; i++ ){
+		digits += (char)('0' + digit(random));
+	}
+	return digits;
+}
+
+// Significands too long for tryParseFloat's 64-bit accumulator
+static void checkLongDigits(Case &c, std::mt19937 &random, int n){
+	std::uniform_int_distribution<int> length(19, 30);
+	std::uniform_int_distribution<int> exponent(-50, 40);
+	for( int i=0; i<n; i++ ){
+		std::string digits = randomDigits(random, length(random));
+		size_t point = random() % (digits.size() + 1);
+		std::string token = digits.substr(0, point) + "." + digits.substr(point);
+		if( i % 2 ){
+			token += "e" + std::to_string(exponent(random));
+		}
+		c.check(token);
+	}
+}
+
+/**
+ * checkExponents covers the float range and past it: subnormals, values
+ * rounding to the smallest subnormal or to zero, and to FLT_MAX or inf.
+ */
+static void checkExponents(Case &c, std::mt19937 &random, int n){
+	static const char *edges[] = {
+		"0", "-0", "0e999", "0.0e-999", "1e-38", "1.17549435e-38", "1.17549421e-38",
+		"1e-45", "1.4e-45", "1.401298464e-45", "7.006492321e-46", "7.006492322e-46",
+		"7e-46", "8e-46", "1e-46", "1e-50", "1e-400", "123456789e-50",
+		"3.4028234e38", "3.40282347e38", "3.4028235e38", "3.40282357e38", "3.4028236e38",
+		"1e38", "1e39", "1e400", "-1e400", "16777216", "16777217", "16777218", "16777219",
+		"1e10", "1e11", "1e-10", "1e-11", "9007199254740993", "0.000000000000000000000000000000000000000001"
+	};
+	for( int i=0; i<sizeof(edges) / sizeof(edges[0]); i++ ){
+		c.check(edges[i]);
+	}
+	std::uniform_int_distribution<int> length(1, 9);
+	std::uniform_int_distribution<int> exponent(-70, 50);
+	for( int i=0; i<n; i++ ){
+		c.check(randomDigits(random, length(random)) + (i % 2 ? "e" : "E") + std::to_string(exponent(random)));
+	}
+}
+
+// Inputs tryParseFloat leaves to strtof or does not take as a number
+static void checkFallback(Case &c){
+	static const char *inputs[] = {
+		"inf", "-inf", "+inf", "INF", "infinity", "-Infinity", "nan", "-nan", "NaN", "nan(123)",
+		"0x1p-3", "0x1.8p1", "-0x10", "0X1P+4", "0x1.fffffep127", "0x1p-149",
+		"", "-", "+", ".", "-.", "e5", ".e5", "abc", "1e", "1e+", "1e-", "1.5e+x", "1.", ".5", "-.5",
+		"+1.5", "00000000000000000000001.5", "1.500000000000000000000000", "1/2/3", "1,5"
+	};
+	for( int i=0; i<sizeof(inputs) / sizeof(inputs[0]); i++ ){
+		c.check(inputs[i]);
+	}
+}
+
+// Values as exporters print them
+static void checkVertices(Case &c, std::mt19937 &random, int n){
+	std::uniform_real_distribution<float> coordinate(-100.0f, 100.0f);
+	for( int i=0; i<n; i++ ){
+		float f = coordinate(random);
+		c.check(format("%.6f", f));
+		c.check(format("%g", f));
+		c.check(format("%.9g", f));
+	}
+}
+
+int main(int argc, char **argv){
+	int n = 1000000;
+	std::vector<std::string> paths;
+	for( int i=1; i<argc; i++ ){
+		if( !strcmp(argv[i], "-n") && i + 1 < argc ){
+			n = std::max(0, atoi(argv[++i]));
+		}else{
+			paths.push_back(argv[i]);
+		}
+	}
+
+	printf("Checking %s against strtof\n", PARSER_NAME);
+	std::mt19937 random(1);
+	std::vector<Case> cases;
+	bool ok = true;
+
+	cases.push_back(Case("obj_tokens"));
+	for( int i=0; i<paths.size(); i++ ){
+		ok &= checkFile(cases.back(), paths[i]);
+	}
+	cases.push_back(Case("midpoints"));
+	checkMidpoints(cases.back(), random, n);
+	cases.push_back(Case("long_digits"));
+	checkLongDigits(cases.back(), random, n);
+	cases.push_back(Case("exponents"));
+	checkExponents(cases.back(), random, n);
+	cases.push_back(Case("fallback"));
+	checkFallback(cases.back());
+	cases.push_back(Case("vertices"));
+	checkVertices(cases.back(), random, n);
+
+	for( int i=0; i<cases.size(); i++ ){
+		cases[i].print();
+		ok &= cases[i].mismatches == 0;
+	}
+	printf("%s\n", ok ? "All match" : "MISMATCH");
+	return ok ? 0 : 1;
+}